@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <netinet/in.h>
@@ -34,50 +35,261 @@ unsigned int hashpower = HASHPOWER_DEFAULT;
 #define hashsize(n) ((uint64_t)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
-/* Main hash table. This is where we look except during expansion. */
-static item** primary_hashtable = 0;
-
 /*
- * Previous hash table. During expansion, we look here for keys that haven't
- * been moved over to the primary yet.
+ * The table grows and shrinks a bucket at a time (linear hashing). With n
+ * buckets, 2^L <= n < 2^(L+1), an item lives in bucket hv & hashmask(L + 1),
+ * or in hv & hashmask(L) if that bucket doesn't exist yet. Growing splits
+ * bucket n - 2^L: the items in it with bit L of hv set move to the new
+ * bucket n. Shrinking merges the last bucket back the same way.
+ *
+ * The two buckets of a split only differ in bit L, above the item lock
+ * bits, so they share an item lock and the maintenance thread needs nothing
+ * else to split or merge them. Lookups hold that lock too, and only the
+ * buckets being split map differently before and after n changes, so they
+ * always see a bucket whole. Nothing is swapped out from under the worker
+ * threads and they are never paused.
+ *
+ * Buckets live in segments that never move. Segment 0 holds the first
+ * hashsize(hashpower_init) buckets and segment i the 2^(init + i - 1) after
+ * that, so each new segment doubles the table. A segment is mapped when
+ * the first bucket in it is split off, and its pages are given back once the
+ * last is merged. The mapping itself stays, so a bucket can be read without
+ * its item lock: at worst it is stale, or all zeroes.
  */
-static item** old_hashtable = 0;
-
-/* Flag: Are we in the middle of expanding now? */
-static bool expanding = false;
+static uint64_t hash_buckets = 0;
+/* log2 of the size of segment 0, which the table never shrinks below */
+static unsigned int segment_power = 0;
+static void *segments[HASHPOWER_MAX + 1];
+static bool segment_live[HASHPOWER_MAX + 1];
 
 /*
- * During expansion we migrate values with bucket granularity; this is how
- * far we've gotten so far. Ranges from 0 .. hashsize(hashpower - 1) - 1.
+ * -o hash_table=tagged: instead of a chain head, each bucket is a cache line
+ * holding up to ASSOC_SLOTS item pointers and a one byte tag per slot, taken
+ * from the item's hv. A lookup compares all the tags at once and only
+ * touches the items whose tag matches, so most misses and non-matching
+ * entries never cost a cache miss on item memory.
+ *
+ * Items never probe into neighbouring buckets: a bucket is covered by
+ * exactly one item lock, and the bucket next door is not. Once the slots are
+ * full, further items go on an overflow chain through h_next, like in the
+ * chained table. Buckets are sized for ASSOC_TAGGED_LOAD items on average,
+ * so that is rare.
  */
-static uint64_t expand_bucket = 0;
+#define ASSOC_SLOTS 6
+#define ASSOC_TAGGED_LOAD 3
+
+typedef struct {
+    uint8_t tags[8];            /* per slot, 0 if empty. the rest are 0 */
+    item *its[ASSOC_SLOTS];
+    item *overflow;             /* once every slot is taken */
+} assoc_bucket;
+
+static bool tagged = false;
+
+/* Twice the items per bucket the table grows past: 1.5 chained, 3 tagged */
+static uint64_t load_limit2 = 3;
+
+static inline size_t assoc_bucket_size(void) {
+    return tagged ? sizeof(assoc_bucket) : sizeof(void *);
+}
+
+static void *assoc_alloc_segment(const uint64_t buckets) {
+    if (tagged) {
+        void *ptr = NULL;
+        // one bucket per cache line
+        if (posix_memalign(&ptr, 64, buckets * sizeof(assoc_bucket)) != 0) {
+            return NULL;
+        }
+        memset(ptr, 0, buckets * sizeof(assoc_bucket));
+        return ptr;
+    }
+    return calloc(buckets, sizeof(void *));
+}
+
+/* Segments past the first are mapped directly, so their pages can be
+ * released without the address range ever becoming invalid. */
+static void *assoc_map_segment(const uint64_t buckets) {
+    void *ptr = mmap(NULL, buckets * assoc_bucket_size(), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANON, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/* Leaves the segment mapped and zeroed. */
+static void assoc_release_segment(void *ptr, const uint64_t buckets) {
+    size_t len = buckets * assoc_bucket_size();
+#if defined(__linux__) && defined(MADV_DONTNEED)
+    // private anonymous pages read back as zeroes
+    if (madvise(ptr, len, MADV_DONTNEED) == 0) {
+        return;
+    }
+#endif
+    // the pages stay with the process, but the table is correct
+    memset(ptr, 0, len);
+}
+
+static inline void *assoc_bucket_at(const uint64_t bucket) {
+    if (bucket < hashsize(segment_power)) {
+        return (char *)segments[0] + bucket * assoc_bucket_size();
+    }
+    unsigned int top = 63 - __builtin_clzll(bucket);
+    return (char *)segments[top - segment_power + 1]
+        + (bucket - hashsize(top)) * assoc_bucket_size();
+}
+
+/* The bucket hv is in. The caller holds item_lock(hv), so it can't be split
+ * or merged while the caller looks at it. */
+static inline uint64_t assoc_bucket_of(const uint32_t hv) {
+    uint64_t n = __atomic_load_n(&hash_buckets, __ATOMIC_ACQUIRE);
+    unsigned int level = 63 - __builtin_clzll(n);
+    uint64_t bucket = hv & hashmask(level + 1);
+    return bucket < n ? bucket : hv & hashmask(level);
+}
 
 void assoc_init(const int hashtable_init) {
     if (hashtable_init) {
         hashpower = hashtable_init;
     }
-    primary_hashtable = calloc(hashsize(hashpower), sizeof(void *));
-    if (! primary_hashtable) {
+    tagged = settings.hash_table == ASSOC_TABLE_TAGGED;
+    load_limit2 = tagged ? ASSOC_TAGGED_LOAD * 2 : 3;
+    segment_power = hashpower;
+    hash_buckets = hashsize(hashpower);
+    segments[0] = assoc_alloc_segment(hash_buckets);
+    if (! segments[0]) {
         fprintf(stderr, "Failed to init hashtable.\n");
         exit(EXIT_FAILURE);
     }
     STATS_LOCK();
     stats_state.hash_power_level = hashpower;
-    stats_state.hash_bytes = hashsize(hashpower) * sizeof(void *);
+    stats_state.hash_buckets = hash_buckets;
+    stats_state.hash_bytes = hash_buckets * assoc_bucket_size();
     STATS_UNLOCK();
 }
 
-item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
-    item *it;
-    uint64_t oldbucket;
+/* The low bits of hv pick the bucket, so the tag is taken from the high bits
+ * of a remix. 0 marks an empty slot. */
+static inline uint8_t assoc_tag(const uint32_t hv) {
+    uint8_t tag = (hv * 0x9e3779b1U) >> 24;
+    return tag ? tag : 1;
+}
+
+#define ASSOC_ONES 0x0101010101010101ULL
+#define ASSOC_LOW7 0x7f7f7f7f7f7f7f7fULL
+#define ASSOC_SLOT_BITS 0x0000808080808080ULL
+
+/* The slots holding tag, as the top bit of byte i for slot i. All eight tags
+ * are compared in one go: a byte of x is zero only where the tag matches, and
+ * adding 0x7f to the low seven bits of a byte carries into its top bit unless
+ * the byte is zero. Unlike the usual (x - 0x01..) & ~x trick this is exact,
+ * as nothing carries between bytes. */
+static inline uint64_t assoc_tag_match(const assoc_bucket *b, const uint8_t tag) {
+    uint64_t x;
+    memcpy(&x, b->tags, sizeof(x));
+#ifdef ENDIAN_BIG
+    x = __builtin_bswap64(x);
+#endif
+    x ^= tag * ASSOC_ONES;
+    return ~(((x & ASSOC_LOW7) + ASSOC_LOW7) | x | ASSOC_LOW7) & ASSOC_SLOT_BITS;
+}
+
+static inline int assoc_next_slot(uint64_t *m) {
+    int slot = __builtin_ctzll(*m) >> 3;
+    *m &= *m - 1;
+    return slot;
+}
+
+static inline assoc_bucket *assoc_tagged_bucket(const uint32_t hv) {
+    return assoc_bucket_at(assoc_bucket_of(hv));
+}
 
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        it = old_hashtable[oldbucket];
+static void assoc_tagged_add(assoc_bucket *b, item *it) {
+    uint64_t m = assoc_tag_match(b, 0);
+    if (m) {
+        int slot = assoc_next_slot(&m);
+        b->tags[slot] = assoc_tag(it->hv);
+        b->its[slot] = it;
+        it->h_next = 0;
     } else {
-        it = primary_hashtable[hv & hashmask(hashpower)];
+        it->h_next = b->overflow;
+        b->overflow = it;
     }
+}
+
+static item *assoc_tagged_find(const char *key, const size_t nkey, const uint32_t hv) {
+    assoc_bucket *b = assoc_tagged_bucket(hv);
+    uint64_t m = assoc_tag_match(b, assoc_tag(hv));
+    item *ret = NULL;
+#ifdef ENABLE_DTRACE
+    int depth = 0;
+#endif
+    while (m) {
+        item *it = b->its[assoc_next_slot(&m)];
+        if ((nkey == it->nkey) && (memcmp(key, ITEM_key(it), nkey) == 0)) {
+            ret = it;
+            goto done;
+        }
+#ifdef ENABLE_DTRACE
+        ++depth;
+#endif
+    }
+    for (item *it = b->overflow; it; it = it->h_next) {
+        if ((nkey == it->nkey) && (memcmp(key, ITEM_key(it), nkey) == 0)) {
+            ret = it;
+            break;
+        }
+#ifdef ENABLE_DTRACE
+        ++depth;
+#endif
+    }
+done:
+    MEMCACHED_ASSOC_FIND(key, nkey, depth);
+    return ret;
+}
+
+/* A freed slot is refilled from the overflow chain, so the chain only holds
+ * items while the slots are all taken. The moved item's h_next is left as it
+ * was, for assoc_tagged_iterate(). */
+static void assoc_tagged_delete(const char *key, const size_t nkey, const uint32_t hv) {
+    assoc_bucket *b = assoc_tagged_bucket(hv);
+    uint64_t m = assoc_tag_match(b, assoc_tag(hv));
+    while (m) {
+        int slot = assoc_next_slot(&m);
+        item *it = b->its[slot];
+        if ((nkey == it->nkey) && (memcmp(key, ITEM_key(it), nkey) == 0)) {
+            MEMCACHED_ASSOC_DELETE(key, nkey);
+            item *o = b->overflow;
+            if (o) {
+                b->overflow = o->h_next;
+                b->tags[slot] = assoc_tag(o->hv);
+                b->its[slot] = o;
+            } else {
+                b->tags[slot] = 0;
+                b->its[slot] = NULL;
+            }
+            return;
+        }
+    }
+
+    item **pos = &b->overflow;
+    while (*pos && ((nkey != (*pos)->nkey) || memcmp(key, ITEM_key(*pos), nkey))) {
+        pos = &(*pos)->h_next;
+    }
+    if (*pos) {
+        MEMCACHED_ASSOC_DELETE(key, nkey);
+        item *nxt = (*pos)->h_next;
+        (*pos)->h_next = 0;
+        *pos = nxt;
+        return;
+    }
+    /* the callers don't delete things they can't find. */
+    assert(*pos != 0);
+}
+
+item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
+    if (tagged) {
+        return assoc_tagged_find(key, nkey, hv);
+    }
+
+    item *it = *(item **)assoc_bucket_at(assoc_bucket_of(hv));
 
     item *ret = NULL;
 #ifdef ENABLE_DTRACE
@@ -97,20 +309,45 @@ item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
     return ret;
 }
 
+/* Start fetching the bucket hv is in. Nothing in the bucket is read, so
+ * this needs no lock: if the table shrinks underneath, the prefetch is
+ * wasted. */
+void assoc_prefetch(const uint32_t hv) {
+    __builtin_prefetch(assoc_bucket_at(assoc_bucket_of(hv)));
+}
+
+/* Start fetching the items assoc_find(hv) will compare keys with: the ones
+ * with a matching tag, or the head of the chain. Needs no lock either:
+ * segments stay mapped, so without item_lock(hv) the bucket may be stale,
+ * and the items it points at freed, but only prefetches go through them. */
+void assoc_prefetch_items(const uint32_t hv) {
+    if (tagged) {
+        assoc_bucket *b = assoc_tagged_bucket(hv);
+        uint64_t m = assoc_tag_match(b, assoc_tag(hv));
+        while (m) {
+            item *it = b->its[assoc_next_slot(&m)];
+            // the key starts in the header's line and may run into the next
+            __builtin_prefetch(it);
+            __builtin_prefetch((char *)it + 64);
+        }
+        if (b->overflow) {
+            __builtin_prefetch(b->overflow);
+        }
+        return;
+    }
+
+    item *it = *(item **)assoc_bucket_at(assoc_bucket_of(hv));
+    if (it) {
+        __builtin_prefetch(it);
+        __builtin_prefetch((char *)it + 64);
+    }
+}
+
 /* returns the address of the item pointer before the key.  if *item == 0,
    the item wasn't found */
 
 static item** _hashitem_before (const char *key, const size_t nkey, const uint32_t hv) {
-    item **pos;
-    uint64_t oldbucket;
-
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        pos = &old_hashtable[oldbucket];
-    } else {
-        pos = &primary_hashtable[hv & hashmask(hashpower)];
-    }
+    item **pos = assoc_bucket_at(assoc_bucket_of(hv));
 
     while (*pos && ((nkey != (*pos)->nkey) || memcmp(key, ITEM_key(*pos), nkey))) {
         pos = &(*pos)->h_next;
@@ -118,31 +355,127 @@ static item** _hashitem_before (const char *key, const size_t nkey, const uint32
     return pos;
 }
 
-/* grows the hashtable to the next power of 2. */
-static void assoc_expand(void) {
-    old_hashtable = primary_hashtable;
-
-    primary_hashtable = calloc(hashsize(hashpower + 1), sizeof(void *));
-    if (primary_hashtable) {
-        if (settings.verbose > 1)
-            fprintf(stderr, "Hash table expansion starting\n");
-        hashpower++;
-        expanding = true;
-        expand_bucket = 0;
+/* Empty bucket from, refiling its items into lo, or into hi if bit is set
+ * in their hv. from may be lo or hi. */
+static void assoc_move(const uint64_t from, const uint64_t lo, const uint64_t hi,
+        const uint64_t bit) {
+    if (tagged) {
+        assoc_bucket *b = assoc_bucket_at(from);
+        assoc_bucket old = *b;
+        memset(b, 0, sizeof(*b));
+        for (int i = 0; i < ASSOC_SLOTS; i++) {
+            if (old.tags[i]) {
+                item *it = old.its[i];
+                assoc_tagged_add(assoc_bucket_at(it->hv & bit ? hi : lo), it);
+            }
+        }
+        item *next;
+        for (item *it = old.overflow; it; it = next) {
+            next = it->h_next;
+            assoc_tagged_add(assoc_bucket_at(it->hv & bit ? hi : lo), it);
+        }
+        return;
+    }
+
+    item **head = assoc_bucket_at(from);
+    item *it = *head;
+    item *next;
+    *head = NULL;
+    for (; it != NULL; it = next) {
+        next = it->h_next;
+        item **to = assoc_bucket_at(it->hv & bit ? hi : lo);
+        it->h_next = *to;
+        *to = it;
+    }
+}
+
+/* Add or remove one bucket. Returns 0 if the item lock the bucket needs is
+ * busy, -1 if a new segment couldn't be allocated. Only the maintenance
+ * thread calls this, so it can read hash_buckets plainly. */
+static int assoc_resize_step(const bool grow) {
+    uint64_t last = grow ? hash_buckets : hash_buckets - 1;
+    unsigned int level = 63 - __builtin_clzll(last);
+    uint64_t bit = hashsize(level);
+    uint64_t split = last - bit;
+    unsigned int seg = level - segment_power + 1;
+
+    if (grow && !segment_live[seg]) {
+        if (segments[seg] == NULL) {
+            segments[seg] = assoc_map_segment(bit);
+            if (segments[seg] == NULL) {
+                /* Bad news, but we can keep running. */
+                return -1;
+            }
+        }
+        segment_live[seg] = true;
         STATS_LOCK();
-        stats_state.hash_power_level = hashpower;
-        stats_state.hash_bytes += hashsize(hashpower) * sizeof(void *);
-        stats_state.hash_is_expanding = true;
+        stats_state.hash_bytes += bit * assoc_bucket_size();
         STATS_UNLOCK();
+    }
+
+    /* bucket = hv & hashmask(hashpower) => the bucket of the hash table is
+     * the lowest N bits of the hv, and the bucket of item_locks is also the
+     * lowest M bits of hv, and N is greater than M. split and last only
+     * differ in bit N, so one item_lock covers both. */
+    void *item_lock = item_trylock(split);
+    if (item_lock == NULL) {
+        return 0;
+    }
+    if (grow) {
+        assoc_move(split, split, last, bit);
     } else {
-        primary_hashtable = old_hashtable;
-        /* Bad news, but we can keep running. */
+        assoc_move(last, split, split, bit);
     }
+    // the segment is published along with the bucket count
+    __atomic_store_n(&hash_buckets, grow ? last + 1 : last, __ATOMIC_RELEASE);
+    item_trylock_unlock(item_lock);
+
+    // anyone who could still map an item into bucket last would have held
+    // its item lock, so nothing in its segment is in use.
+    if (!grow && last == bit) {
+        assoc_release_segment(segments[seg], bit);
+        segment_live[seg] = false;
+        STATS_LOCK();
+        stats_state.hash_bytes -= bit * assoc_bucket_size();
+        STATS_UNLOCK();
+    }
+
+    hashpower = 63 - __builtin_clzll(hash_buckets);
+    STATS_LOCK();
+    stats_state.hash_power_level = hashpower;
+    stats_state.hash_buckets = hash_buckets;
+    STATS_UNLOCK();
+    return 1;
 }
 
-void assoc_start_expand(uint64_t curr_items) {
+/* The bucket count the table should be resized to for curr_items, or the
+ * current one if its load is in range: the next power of two that brings
+ * the load back under the limit, or down to 1/3 of it when shrinking, so
+ * the table doesn't keep resizing around a steady item count. Stopping part
+ * way into a segment would save no memory, as a segment is allocated whole
+ * and only freed once it is empty. */
+static uint64_t assoc_resize_target(const uint64_t curr_items) {
+    uint64_t n = hash_buckets;
+    uint64_t target = n;
+    if (curr_items * 2 > n * load_limit2) {
+        target = curr_items * 2 / load_limit2 + 1;
+    } else if (curr_items * 12 < n * load_limit2) {
+        target = curr_items * 6 / load_limit2;
+    }
+    if (target != n && target > 1) {
+        target = hashsize(64 - __builtin_clzll(target - 1));
+    }
+    if (target < hashsize(segment_power)) {
+        target = hashsize(segment_power);
+    } else if (target > hashsize(HASHPOWER_MAX)) {
+        target = hashsize(HASHPOWER_MAX);
+    }
+    return target;
+}
+
+void assoc_start_resize(uint64_t curr_items) {
     if (pthread_mutex_trylock(&maintenance_lock) == 0) {
-        if (curr_items > (hashsize(hashpower) * 3) / 2 && hashpower < HASHPOWER_MAX) {
+        if (assoc_resize_target(curr_items) != hash_buckets) {
             pthread_cond_signal(&maintenance_cond);
         }
         pthread_mutex_unlock(&maintenance_lock);
@@ -151,18 +484,14 @@ void assoc_start_expand(uint64_t curr_items) {
 
 /* Note: this isn't an assoc_update.  The key must not already exist to call this */
 int assoc_insert(item *it, const uint32_t hv) {
-    uint64_t oldbucket;
-
 //    assert(assoc_find(ITEM_key(it), it->nkey) == 0);  /* shouldn't have duplicately named things defined */
 
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        it->h_next = old_hashtable[oldbucket];
-        old_hashtable[oldbucket] = it;
+    if (tagged) {
+        assoc_tagged_add(assoc_tagged_bucket(hv), it);
     } else {
-        it->h_next = primary_hashtable[hv & hashmask(hashpower)];
-        primary_hashtable[hv & hashmask(hashpower)] = it;
+        item **head = assoc_bucket_at(assoc_bucket_of(hv));
+        it->h_next = *head;
+        *head = it;
     }
 
     MEMCACHED_ASSOC_INSERT(ITEM_key(it), it->nkey);
@@ -170,6 +499,11 @@ int assoc_insert(item *it, const uint32_t hv) {
 }
 
 void assoc_delete(const char *key, const size_t nkey, const uint32_t hv) {
+    if (tagged) {
+        assoc_tagged_delete(key, nkey, hv);
+        return;
+    }
+
     item **before = _hashitem_before(key, nkey, hv);
 
     if (*before) {
@@ -195,67 +529,47 @@ static volatile int do_run_maintenance_thread = 1;
 int hash_bulk_move = DEFAULT_HASH_BULK_MOVE;
 
 static void *assoc_maintenance_thread(void *arg) {
+    uint64_t target = 0;
+    bool resizing = false;
 
     mutex_lock(&maintenance_lock);
     while (do_run_maintenance_thread) {
         int ii = 0;
 
-        /* There is only one expansion thread, so no need to global lock. */
-        for (ii = 0; ii < hash_bulk_move && expanding; ++ii) {
-            item *it, *next;
-            uint64_t bucket;
-            void *item_lock = NULL;
-
-            /* bucket = hv & hashmask(hashpower) =>the bucket of hash table
-             * is the lowest N bits of the hv, and the bucket of item_locks is
-             *  also the lowest M bits of hv, and N is greater than M.
-             *  So we can process expanding with only one item_lock. cool! */
-            if ((item_lock = item_trylock(expand_bucket))) {
-                    for (it = old_hashtable[expand_bucket]; NULL != it; it = next) {
-                        next = it->h_next;
-                        bucket = hash(ITEM_key(it), it->nkey) & hashmask(hashpower);
-                        it->h_next = primary_hashtable[bucket];
-                        primary_hashtable[bucket] = it;
-                    }
-
-                    old_hashtable[expand_bucket] = NULL;
-
-                    expand_bucket++;
-                    if (expand_bucket == hashsize(hashpower - 1)) {
-                        expanding = false;
-                        free(old_hashtable);
-                        STATS_LOCK();
-                        stats_state.hash_bytes -= hashsize(hashpower - 1) * sizeof(void *);
-                        stats_state.hash_is_expanding = false;
-                        STATS_UNLOCK();
-                        if (settings.verbose > 1)
-                            fprintf(stderr, "Hash table expansion done\n");
-                    }
-
-            } else {
+        /* There is only one resizing thread, so no need to global lock. */
+        for (ii = 0; ii < hash_bulk_move && resizing; ++ii) {
+            int ret = assoc_resize_step(target > hash_buckets);
+            if (ret == 0) {
                 usleep(10*1000 - 1);
+            } else if (ret < 0) {
+                target = hash_buckets;
             }
 
-            if (item_lock) {
-                item_trylock_unlock(item_lock);
-                item_lock = NULL;
+            if (target == hash_buckets) {
+                resizing = false;
+                STATS_LOCK();
+                stats_state.hash_is_expanding = false;
+                STATS_UNLOCK();
+                if (settings.verbose > 1)
+                    fprintf(stderr, "Hash table resize done\n");
             }
         }
 
-        if (!expanding) {
-            /* We are done expanding.. just wait for next invocation */
+        if (!resizing) {
+            /* We are done resizing.. just wait for next invocation */
             pthread_cond_wait(&maintenance_cond, &maintenance_lock);
-            /* assoc_expand() swaps out the hash table entirely, so we need
-             * all threads to not hold any references related to the hash
-             * table while this happens.
-             * This is instead of a more complex, possibly slower algorithm to
-             * allow dynamic hash table expansion without causing significant
-             * wait times.
-             */
-            if (do_run_maintenance_thread) {
-                pause_threads(PAUSE_ALL_THREADS);
-                assoc_expand();
-                pause_threads(RESUME_ALL_THREADS);
+            /* The target is fixed for the whole resize, rather than
+             * following the item count, so it doesn't stop as soon as the
+             * load is back under the limit. */
+            target = assoc_resize_target(stats_state.curr_items);
+            if (do_run_maintenance_thread && target != hash_buckets) {
+                resizing = true;
+                STATS_LOCK();
+                stats_state.hash_is_expanding = true;
+                STATS_UNLOCK();
+                if (settings.verbose > 1)
+                    fprintf(stderr, "Hash table %s starting\n",
+                            target > hash_buckets ? "expansion" : "shrink");
             }
         }
     }
@@ -298,6 +612,7 @@ struct assoc_iterator {
     uint64_t bucket;
     item *it;
     item *next;
+    int slot;       /* hash_table=tagged: next slot, then the overflow chain */
     bool bucket_locked;
 };
 
@@ -306,7 +621,7 @@ void *assoc_get_iterator(void) {
     if (iter == NULL) {
         return NULL;
     }
-    // this will hang the caller while a hash table expansion is running.
+    // this will hang the caller while a hash table resize is running.
     if (mutex_trylock(&maintenance_lock) == 0) {
         return iter;
     } else {
@@ -315,9 +630,48 @@ void *assoc_get_iterator(void) {
     }
 }
 
+/* The slots, then the overflow chain as it was when the bucket was locked.
+ * Like the chained walk this survives the caller unlinking the item it was
+ * given: an overflow item moved into a slot by that is still found through
+ * the old chain. */
+static bool assoc_tagged_iterate(struct assoc_iterator *iter, item **it) {
+    if (!iter->bucket_locked) {
+        if (iter->bucket == hash_buckets) {
+            return false;
+        }
+        item_lock(iter->bucket);
+        iter->bucket_locked = true;
+        iter->slot = 0;
+        iter->next = ((assoc_bucket *)assoc_bucket_at(iter->bucket))->overflow;
+    }
+
+    assoc_bucket *b = assoc_bucket_at(iter->bucket);
+    while (iter->slot < ASSOC_SLOTS) {
+        int slot = iter->slot++;
+        if (b->tags[slot]) {
+            *it = b->its[slot];
+            return true;
+        }
+    }
+    if (iter->next != NULL) {
+        *it = iter->next;
+        iter->next = iter->next->h_next;
+        return true;
+    }
+
+    // returning no item between buckets lets the caller do other work
+    item_unlock(iter->bucket);
+    iter->bucket_locked = false;
+    iter->bucket++;
+    return true;
+}
+
 bool assoc_iterate(void *iterp, item **it) {
     struct assoc_iterator *iter = (struct assoc_iterator *) iterp;
     *it = NULL;
+    if (tagged) {
+        return assoc_tagged_iterate(iter, it);
+    }
     // - if locked bucket and next, update next and return
     if (iter->bucket_locked) {
         if (iter->next != NULL) {
@@ -336,12 +690,12 @@ bool assoc_iterate(void *iterp, item **it) {
     }
 
     // - loop until we hit the end or find something.
-    if (iter->bucket != hashsize(hashpower)) {
+    if (iter->bucket != hash_buckets) {
         // - lock next bucket
         item_lock(iter->bucket);
         iter->bucket_locked = true;
-        // - only check the primary hash table since expand is blocked.
-        iter->it = primary_hashtable[iter->bucket];
+        // - the table can't be resized while we hold the maintenance lock.
+        iter->it = *(item **)assoc_bucket_at(iter->bucket);
         if (iter->it != NULL) {
             // - set it, next and return
             iter->next = iter->it->h_next;
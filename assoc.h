@@ -1,13 +1,20 @@
 /* associative array */
+enum assoc_table {
+    ASSOC_TABLE_CHAINED = 0,    /* a chain of items per bucket */
+    ASSOC_TABLE_TAGGED,         /* tagged slots per bucket, see assoc.c */
+};
+
 void assoc_init(const int hashpower_init);
 
 item *assoc_find(const char *key, const size_t nkey, const uint32_t hv);
+void assoc_prefetch(const uint32_t hv);
+void assoc_prefetch_items(const uint32_t hv);
 int assoc_insert(item *item, const uint32_t hv);
 void assoc_delete(const char *key, const size_t nkey, const uint32_t hv);
 
 int start_assoc_maintenance_thread(void);
 void stop_assoc_maintenance_thread(void);
-void assoc_start_expand(uint64_t curr_items);
+void assoc_start_resize(uint64_t curr_items);
 
 /* walk functions */
 void *assoc_get_iterator(void);
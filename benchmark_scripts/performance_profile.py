@@ -3,14 +3,17 @@ TRACE_FILE = "/users/aryankh/wiki_cache_00.trace"
 LOG_FOLDER = "/users/aryankh/memcached_embed/logs/"
 CLIENT_SCRIPT = "/users/aryankh/memcached_embed/benchmark_scripts/memcached_benchmark"
 
-EXECUTABLE_PATH = {
-	"EMB": "/users/aryankh/memcached_embed/memcached_emb",
-	"LRU": "/users/aryankh/memcached_embed/memcached_lru",
+MEMCACHED_PATH = "/users/aryankh/memcached_embed/memcached"
+
+EVICT_POLICY = {
+	"EMB": "emb",
+	"LRU": "lru",
+	"TINYLFU": "tinylfu",
 }
 
 def launch_memcached(executable, num_server_workers, memory_limit=512, port=11211):
 	return subprocess.Popen(
-		[EXECUTABLE_PATH[executable], "-p", str(port), "-m", str(memory_limit), "-t", str(num_server_workers), "-o", "no_lru_crawler", "-o", "no_lru_maintainer"],
+		[MEMCACHED_PATH, "-p", str(port), "-m", str(memory_limit), "-t", str(num_server_workers), "-o", "no_lru_crawler", "-o", "no_lru_maintainer", "-o", f"evict_policy={EVICT_POLICY[executable]}"],
 		stdout=subprocess.PIPE,
 		stderr=subprocess.PIPE,
 	)
@@ -58,7 +61,7 @@ def main():
 	# requirements: stop and start memcached instances, detect abormal exits
 	# once we have run all the experiments, generate associated plots
 
-	# for each policy in [memcached_lru, memcached_emb]
+	# for each policy in [lru, emb]
 	# for each num of worker threads in [1, 2, 4, 8, 16, 32]
 	# for each num of worker clients in [1, 2, 4, 8, 16, 32]
 	# launch memcached instance
@@ -69,7 +72,7 @@ def main():
 		#for num_client_workers in [1, 2, 4, 8, 16, 32, 64, 128, 256]:
 	for num_server_workers in [2, 4]:
 		for num_client_workers in [1, 2, 4, 8]:
-			for executable in ["LRU", "EMB"]:
+			for executable in ["LRU", "TINYLFU", "EMB"]:
 				run_experiment(executable, num_server_workers, num_client_workers)
 
 
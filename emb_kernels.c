@@ -0,0 +1,399 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Dot product, axpy, normalize and fp16 conversion kernels for embedding
+ * vectors. A scalar version of each is always available; SIMD versions are
+ * compiled with per-function target attributes and picked at startup based
+ * on what the CPU reports, so the binary still runs on older hardware.
+ */
+#include <string.h>
+#include <math.h>
+#include "emb_kernels.h"
+
+#if EMBEDDING_DIM % 8 != 0
+#error "embedding kernels assume EMBEDDING_DIM is a multiple of 8"
+#endif
+
+/*** SCALAR ***/
+
+static float scalar_dot(const float *a, const float *b) {
+    float sum = 0.0f;
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void scalar_axpy(float *y, float a, const float *x) {
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static void scalar_normalize(float *x) {
+    float mag = sqrtf(scalar_dot(x, x));
+    if (mag == 0.0f) {
+        return;
+    }
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        x[i] /= mag;
+    }
+}
+
+static float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    float f;
+
+    if (exp == 0) {
+        // zero or subnormal: mant * 2^-24
+        f = ldexpf((float)mant, -24);
+        return sign ? -f : f;
+    } else if (exp == 31) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/* Round to nearest even, same as the hardware conversions. */
+static uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    x &= 0x7fffffff;
+
+    if (x >= 0x47800000) {
+        // overflow, inf or nan
+        return sign | (x > 0x7f800000 ? 0x7e00 : 0x7c00);
+    } else if (x < 0x38800000) {
+        // subnormal half, or too small and flushed to zero
+        if (x < 0x33000000) {
+            return sign;
+        }
+        uint32_t m = (x & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - (x >> 23);
+        uint32_t r = m >> shift;
+        uint32_t rem = m & ((1U << shift) - 1);
+        uint32_t half = 1U << (shift - 1);
+        if (rem > half || (rem == half && (r & 1))) {
+            r++;
+        }
+        return sign | r;
+    }
+
+    uint32_t h = (x >> 13) - (112 << 10);
+    uint32_t rem = x & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        h++;
+    }
+    return sign | h;
+}
+
+static void scalar_to_fp16(uint16_t *dst, const float *src) {
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
+
+static void scalar_from_fp16(float *dst, const uint16_t *src) {
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        dst[i] = half_to_float(src[i]);
+    }
+}
+
+static float scalar_dot_fp16(const uint16_t *a, const float *b) {
+    float sum = 0.0f;
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        sum += half_to_float(a[i]) * b[i];
+    }
+    return sum;
+}
+
+static float scalar_dot_int8(const int8_t *a, const float *b) {
+    float sum = 0.0f;
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        sum += (float)a[i] * b[i];
+    }
+    return sum / EMB_INT8_SCALE;
+}
+
+static const emb_kernels_t kernels_scalar = {
+    .name = "scalar",
+    .dot = scalar_dot,
+    .dot_fp16 = scalar_dot_fp16,
+    .dot_int8 = scalar_dot_int8,
+    .axpy = scalar_axpy,
+    .normalize = scalar_normalize,
+    .to_fp16 = scalar_to_fp16,
+    .from_fp16 = scalar_from_fp16,
+};
+
+emb_kernels_t emb_kernels = {
+    .name = "scalar",
+    .dot = scalar_dot,
+    .dot_fp16 = scalar_dot_fp16,
+    .dot_int8 = scalar_dot_int8,
+    .axpy = scalar_axpy,
+    .normalize = scalar_normalize,
+    .to_fp16 = scalar_to_fp16,
+    .from_fp16 = scalar_from_fp16,
+};
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define EMB_KERNELS_X86
+
+/*** SSE4.1 ***/
+
+__attribute__((target("sse4.1")))
+static inline float sse_hsum(__m128 v) {
+    __m128 shuf = _mm_movehdup_ps(v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("sse4.1")))
+static float sse41_dot(const float *a, const float *b) {
+    __m128 acc = _mm_mul_ps(_mm_loadu_ps(a), _mm_loadu_ps(b));
+    for (int i = 4; i < EMBEDDING_DIM; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    return sse_hsum(acc);
+}
+
+__attribute__((target("sse4.1")))
+static float sse41_dot_int8(const int8_t *a, const float *b) {
+    __m128 acc = _mm_setzero_ps();
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        int32_t q;
+        memcpy(&q, a + i, sizeof(q));
+        __m128 x = _mm_cvtepi32_ps(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(q)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(x, _mm_loadu_ps(b + i)));
+    }
+    return sse_hsum(acc) / EMB_INT8_SCALE;
+}
+
+__attribute__((target("sse4.1")))
+static void sse41_axpy(float *y, float a, const float *x) {
+    __m128 va = _mm_set1_ps(a);
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        __m128 vy = _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i)));
+        _mm_storeu_ps(y + i, vy);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void sse41_normalize(float *x) {
+    float mag = sqrtf(sse41_dot(x, x));
+    if (mag == 0.0f) {
+        return;
+    }
+    __m128 vm = _mm_set1_ps(mag);
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        _mm_storeu_ps(x + i, _mm_div_ps(_mm_loadu_ps(x + i), vm));
+    }
+}
+
+static const emb_kernels_t kernels_sse41 = {
+    .name = "sse4.1",
+    .dot = sse41_dot,
+    .dot_fp16 = scalar_dot_fp16,
+    .dot_int8 = sse41_dot_int8,
+    .axpy = sse41_axpy,
+    .normalize = sse41_normalize,
+    .to_fp16 = scalar_to_fp16,
+    .from_fp16 = scalar_from_fp16,
+};
+
+/*** AVX2 + FMA + F16C ***/
+
+#define AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+
+AVX2_TARGET
+static inline float avx2_hsum(__m256 v) {
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+AVX2_TARGET
+static float avx2_dot(const float *a, const float *b) {
+    __m256 acc = _mm256_mul_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b));
+    for (int i = 8; i < EMBEDDING_DIM; i += 8) {
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+    }
+    return avx2_hsum(acc);
+}
+
+AVX2_TARGET
+static float avx2_dot_fp16(const uint16_t *a, const float *b) {
+    __m256 acc = _mm256_setzero_ps();
+    for (int i = 0; i < EMBEDDING_DIM; i += 8) {
+        __m256 x = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(a + i)));
+        acc = _mm256_fmadd_ps(x, _mm256_loadu_ps(b + i), acc);
+    }
+    return avx2_hsum(acc);
+}
+
+AVX2_TARGET
+static float avx2_dot_int8(const int8_t *a, const float *b) {
+    __m256 acc = _mm256_setzero_ps();
+    for (int i = 0; i < EMBEDDING_DIM; i += 8) {
+        __m128i q = _mm_loadl_epi64((const __m128i *)(a + i));
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q));
+        acc = _mm256_fmadd_ps(x, _mm256_loadu_ps(b + i), acc);
+    }
+    return avx2_hsum(acc) / EMB_INT8_SCALE;
+}
+
+AVX2_TARGET
+static void avx2_axpy(float *y, float a, const float *x) {
+    __m256 va = _mm256_set1_ps(a);
+    for (int i = 0; i < EMBEDDING_DIM; i += 8) {
+        __m256 vy = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+        _mm256_storeu_ps(y + i, vy);
+    }
+}
+
+AVX2_TARGET
+static void avx2_normalize(float *x) {
+    float mag = sqrtf(avx2_dot(x, x));
+    if (mag == 0.0f) {
+        return;
+    }
+    __m256 vm = _mm256_set1_ps(mag);
+    for (int i = 0; i < EMBEDDING_DIM; i += 8) {
+        _mm256_storeu_ps(x + i, _mm256_div_ps(_mm256_loadu_ps(x + i), vm));
+    }
+}
+
+AVX2_TARGET
+static void avx2_to_fp16(uint16_t *dst, const float *src) {
+    for (int i = 0; i < EMBEDDING_DIM; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(dst + i), h);
+    }
+}
+
+AVX2_TARGET
+static void avx2_from_fp16(float *dst, const uint16_t *src) {
+    for (int i = 0; i < EMBEDDING_DIM; i += 8) {
+        __m256 f = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_ps(dst + i, f);
+    }
+}
+
+static const emb_kernels_t kernels_avx2 = {
+    .name = "avx2",
+    .dot = avx2_dot,
+    .dot_fp16 = avx2_dot_fp16,
+    .dot_int8 = avx2_dot_int8,
+    .axpy = avx2_axpy,
+    .normalize = avx2_normalize,
+    .to_fp16 = avx2_to_fp16,
+    .from_fp16 = avx2_from_fp16,
+};
+
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define EMB_KERNELS_NEON
+
+/*** NEON ***/
+
+static float neon_dot(const float *a, const float *b) {
+    float32x4_t acc = vmulq_f32(vld1q_f32(a), vld1q_f32(b));
+    for (int i = 4; i < EMBEDDING_DIM; i += 4) {
+        acc = vfmaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    return vaddvq_f32(acc);
+}
+
+static float neon_dot_fp16(const uint16_t *a, const float *b) {
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        float32x4_t x = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(a + i)));
+        acc = vfmaq_f32(acc, x, vld1q_f32(b + i));
+    }
+    return vaddvq_f32(acc);
+}
+
+static float neon_dot_int8(const int8_t *a, const float *b) {
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (int i = 0; i < EMBEDDING_DIM; i += 8) {
+        int16x8_t w = vmovl_s8(vld1_s8(a + i));
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(w)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_high_s16(w));
+        acc = vfmaq_f32(acc, lo, vld1q_f32(b + i));
+        acc = vfmaq_f32(acc, hi, vld1q_f32(b + i + 4));
+    }
+    return vaddvq_f32(acc) / EMB_INT8_SCALE;
+}
+
+static void neon_axpy(float *y, float a, const float *x) {
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        vst1q_f32(y + i, vfmaq_n_f32(vld1q_f32(y + i), vld1q_f32(x + i), a));
+    }
+}
+
+static void neon_normalize(float *x) {
+    float mag = sqrtf(neon_dot(x, x));
+    if (mag == 0.0f) {
+        return;
+    }
+    float32x4_t vm = vdupq_n_f32(mag);
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        vst1q_f32(x + i, vdivq_f32(vld1q_f32(x + i), vm));
+    }
+}
+
+static void neon_to_fp16(uint16_t *dst, const float *src) {
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    }
+}
+
+static void neon_from_fp16(float *dst, const uint16_t *src) {
+    for (int i = 0; i < EMBEDDING_DIM; i += 4) {
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+    }
+}
+
+static const emb_kernels_t kernels_neon = {
+    .name = "neon",
+    .dot = neon_dot,
+    .dot_fp16 = neon_dot_fp16,
+    .dot_int8 = neon_dot_int8,
+    .axpy = neon_axpy,
+    .normalize = neon_normalize,
+    .to_fp16 = neon_to_fp16,
+    .from_fp16 = neon_from_fp16,
+};
+#endif
+
+void emb_kernels_init(bool use_simd) {
+    emb_kernels = kernels_scalar;
+    if (!use_simd) {
+        return;
+    }
+#if defined(EMB_KERNELS_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+            && __builtin_cpu_supports("f16c")) {
+        emb_kernels = kernels_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        emb_kernels = kernels_sse41;
+    }
+#elif defined(EMB_KERNELS_NEON)
+    // NEON is part of the aarch64 baseline.
+    emb_kernels = kernels_neon;
+#endif
+}
@@ -0,0 +1,32 @@
+#ifndef EMB_KERNELS_H
+#define EMB_KERNELS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EMBEDDING_DIM 16
+
+/* Vector math used by the embedding code. All vectors are EMBEDDING_DIM
+ * long. int8 vectors hold components in [-1, 1] scaled by EMB_INT8_SCALE;
+ * dot_int8 returns the unscaled result. */
+#define EMB_INT8_SCALE 127.0f
+
+typedef struct {
+    const char *name;
+    float (*dot)(const float *a, const float *b);
+    float (*dot_fp16)(const uint16_t *a, const float *b);
+    float (*dot_int8)(const int8_t *a, const float *b);
+    void (*axpy)(float *y, float a, const float *x); /* y += a * x */
+    void (*normalize)(float *x);
+    void (*to_fp16)(uint16_t *dst, const float *src);
+    void (*from_fp16)(float *dst, const uint16_t *src);
+} emb_kernels_t;
+
+/* Set by emb_kernels_init(); scalar until then. */
+extern emb_kernels_t emb_kernels;
+
+/* Pick the best kernels this CPU supports, or the scalar ones if use_simd
+ * is false. */
+void emb_kernels_init(bool use_simd);
+
+#endif
@@ -1,576 +1,2113 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "memcached.h"
+#include "bipbuffer.h"
 #include "storage.h"
+#include "restart.h"
 #include "embeddings.h"
-
-static pthread_mutex_t emb_lock;
-
-void emb_init() {
-	pthread_mutexattr_t attr;
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&emb_lock, &attr);
-	pthread_mutexattr_destroy(&attr);
-}
+#include "emb_kernels.h"
+
+/* Embedding storage
+ *
+ * With -o emb_inline every item is allocated with ITEM_EMB and carries its
+ * item_emb block right after the CAS, so finding it is pointer arithmetic.
+ * Otherwise the block lives in emb_hashmap, bucketed by the item's hash value.
+ *
+ * Vectors are stored as fp32, fp16 or int8 (-o emb_precision). Training
+ * decodes into a float working copy and encodes the result back; scoring
+ * works on the stored format directly. See emb_kernels.c for the math.
+ *
+ * Every tracked item is also in a sampling pool of its slab class, so an
+ * eviction for class id only ever frees a chunk slabs_alloc(id) can use.
+ * Each class is split into -o emb_shards pools picked by the high bits of
+ * hv, so adding and removing items only contends with items in the same
+ * shard. With many worker threads, raise it so they don't queue up behind
+ * each other's links and unlinks.
+ *
+ * Locking overview
+ *
+ * The map is larger than the item lock table and both are indexed by the low
+ * bits of hv, so every item in a map bucket shares one item lock: holding
+ * item_lock(hv) is enough to walk a bucket, add or remove entries and modify
+ * the vectors in it. Adding or removing pool members additionally takes the
+ * shard's lock. The only field written without the owning item's lock is
+ * pool_idx, which is protected by the shard lock.
+ *
+ * The evictor takes no pool locks. It reads entries and scores their vectors
+ * while they may be changing underneath it. For that to be safe the entry
+ * arrays and map slots it may be looking at are never freed directly: they
+ * are retired into the per-thread lists and freed by the maintainer thread
+ * once every thread that could have seen them has left its sampling epoch.
+ * The lowest scoring samples are kept per thread between evictions as
+ * (item, hv) pairs, and a victim is only evicted once item_trylock(hv) shows
+ * it is still linked with that hv and tracked.
+ *
+ * The hit path never takes a pool lock for tracked items: accesses are
+ * recorded into a per-thread history (emb_thread), and the embedding
+ * maintainer thread periodically merges the per-thread rolling averages into
+ * the global average that items are trained towards and evictions are scored
+ * against. The average is published under a seqlock (emb_model_seq), so
+ * readers take no lock and never hold up the maintainer.
+ *
+ * Locks are taken in this order, and never the other way around:
+ *
+ *   emb_maintainer_lock
+ *     item lock (item_lock, or item_trylock from the evictor)
+ *       pool shard lock, or ann list lock (never both)
+ *         emb_thread_lock
+ *           emb_thread mutex (emb_retire() takes it under a pool lock)
+ *
+ * Only one item lock is held at a time, and no emb lock is held while taking
+ * one: code that finds items through the pools or a thread's queue drops
+ * everything first, then item_trylock()s or item_lock()s them one by one.
+ *
+ * With -o emb_async_train a hit on a tracked item only queues an emb_access
+ * into the thread's train_buf, the same way lru_bump_async() defers COLD
+ * bumps. The maintainer thread drains the queues in batches and does the
+ * training under the item lock. Queued items hold no reference, so they are
+ * validated the same way the evictor validates its samples.
+ *
+ * With -o emb_model=sgns (which implies emb_async_train) the queued accesses
+ * are not pulled towards the average. Each thread's queue is its access
+ * sequence, and the maintainer trains it word2vec style: keys accessed
+ * close together are pulled together and keys sampled from elsewhere in the
+ * sequence are pushed apart (see emb_sgns_batch()). The trained vectors feed
+ * an online k-means of EMB_CENTROIDS centroids, one per workload phase, and
+ * evictions score items against the nearest active centroid instead of the
+ * single average.
+ */
 
 #define EMB_HISTORY 50
-// define circular buffer
-embedding emb_ring_buffer[EMB_HISTORY];
-embedding rolling_avg;
-uint32_t rolling_avg_write_ptr;
+#define EMB_LEARNING_RATE 0.1
+#define EMB_TRAIN_BUF_SIZE 8192
+#define EMB_TRAIN_BATCH 64
+
+/* emb_model=sgns: accesses before each one that count as its context, and
+ * negative samples per access */
+#define EMB_SGNS_WINDOW 2
+#define EMB_SGNS_NEGATIVE 2
+#define EMB_SGNS_RATE 0.05f
+/* dot products of unit vectors are scaled by this before the sigmoid, so
+ * well separated pairs stop being trained */
+#define EMB_SGNS_SCALE 5.0f
+#define EMB_CENTROIDS 4
+/* a centroid moves like the average of its last this many samples */
+#define EMB_CENTROID_MEMORY 1024
+/* a sample less similar than this to every centroid starts a new one, if one
+ * is idle */
+#define EMB_CENTROID_SPLIT 0.5f
+/* per merge interval; a phase fades in a couple of seconds */
+#define EMB_CENTROID_DECAY 0.995f
+
+typedef struct {
+    item *it;
+    uint32_t hv;
+    rel_time_t time;
+} emb_access;
 
+typedef struct embedding_map_slot embedding_map_slot;
+typedef struct _emb_pool_array emb_pool_array;
+
+/* Eviction candidates a thread keeps between evictions, Redis style: the
+ * lowest scoring items of its earlier scans of a slab class, sorted by
+ * score. They are validated like fresh samples before being evicted. */
+#define EMB_EVICT_POOL 16
+typedef struct {
+    item *it;
+    uint32_t hv;
+    float score;
+    rel_time_t time;    /* when it was scored */
+} emb_candidate;
+
+typedef struct {
+    emb_candidate c[EMB_EVICT_POOL];
+    int n;
+    bool has_victims;
+    float victim_avg;   /* moving average of the scores of its victims */
+} emb_evict_pool;
+
+typedef struct _emb_thread {
+    struct _emb_thread *next;
+    pthread_mutex_t mutex;
+    embedding ring[EMB_HISTORY]; /* last accessed vectors, pre-scaled */
+    embedding avg;               /* sum of ring: this thread's rolling avg */
+    uint32_t ring_ptr;
+    uint64_t updates;            /* accesses recorded by this thread */
+    uint64_t merged;             /* value of updates at last merge */
+    uint64_t epoch;              /* epoch while sampling, 0 otherwise */
+    /* memory retired by this thread, by epoch % 3 */
+    embedding_map_slot *dead_slots[3];
+    emb_pool_array *dead_arrays[3];
+    bipbuf_t *train_buf;         /* emb_access queue, with emb_async_train */
+    uint64_t train_dropped;      /* accesses lost to a full train_buf */
+    uint64_t hits;               /* client hits, written without the mutex */
+    /* only touched by the owning thread, counters read without the mutex */
+    emb_evict_pool evict_pools[MAX_NUMBER_OF_SLAB_CLASSES];
+    uint64_t evict_samples;      /* items scored to refill evict_pools */
+    uint64_t evict_early;        /* scans that stopped at a good victim */
+    uint64_t evict_reclaimed;    /* expired items freed instead of a victim */
+    mc_rng rng;                  /* under the mutex for emb_shared_thread */
+} emb_thread;
+
+static pthread_key_t emb_thread_key;
+static emb_thread *emb_thread_head = NULL;
+static pthread_mutex_t emb_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+/* used by threads without their own state (restart fixup, LRU maintainer) */
+static emb_thread emb_shared_thread;
+
+/* The model items are trained towards and scored against: the global
+ * rolling average and, with emb_model=sgns, the active context centroids.
+ * Written only by the maintainer thread (and restart, before there are
+ * other threads) between emb_model_write_begin() and _end(). Other threads
+ * copy it out with emb_read_model(), which retries while emb_model_seq is
+ * odd or has moved on: a seqlock, so readers never block the writer. */
+typedef struct {
+    embedding c[EMB_CENTROIDS];
+    int n;
+} emb_context;
+
+static embedding emb_avg;
+static emb_context emb_ctx;
+static uint32_t emb_model_seq = 0;
+
+static inline void emb_model_write_begin(void) {
+    __atomic_store_n(&emb_model_seq, emb_model_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
+static inline void emb_model_write_end(void) {
+    __atomic_store_n(&emb_model_seq, emb_model_seq + 1, __ATOMIC_RELEASE);
+}
 
-const bool EMB_ERR_PRINT = false;
-const bool EMB_API_PRINT = false;
+/* Copy out a consistent average and, if ctx isn't NULL, context. The model
+ * is a few hundred bytes and only changes every maintainer pass, so a
+ * retry is rare. */
+static void emb_read_model(embedding *avg, emb_context *ctx) {
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&emb_model_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(avg, &emb_avg, sizeof(*avg));
+        if (ctx != NULL) {
+            memcpy(ctx, &emb_ctx, sizeof(*ctx));
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1)
+            || __atomic_load_n(&emb_model_seq, __ATOMIC_RELAXED) != seq);
+}
 
+/* k-means state behind emb_ctx, only used by the maintainer thread (and
+ * restart, before it starts). A centroid with a count under 1 is idle. */
+static embedding emb_km[EMB_CENTROIDS];
+static float emb_km_count[EMB_CENTROIDS];
+static uint64_t emb_sgns_pairs = 0;
 
+/* Reclamation epoch, only advanced by the maintainer thread. Starts at 1 so
+ * that 0 can mean "not sampling". */
+static uint64_t emb_epoch = 1;
 
 // ------- HASHMAP
 #define EMB_MAP_SIZE (1 << 20)
-typedef struct embedding_map_slot embedding_map_slot;
 struct embedding_map_slot {
-	embedding emb;
-	item* it;
-	uint32_t sample_pool_idx;
-	embedding_map_slot* next;
-	bool present;
+    item* it;
+    embedding_map_slot* next;
+    item_emb ie; /* must be last: the stored vector follows it */
 };
 
-// define hashmap
-// each slot entry will be
+/* bytes of stored vector following each item_emb */
+static size_t emb_vec_size = 0;
+
 embedding_map_slot* emb_hashmap[EMB_MAP_SIZE];
 
-// sampling pool: big bucket of item* pointers
-// array that we can pull from in O(1)
-// track size as we add/remove
-item* emb_valid_items[EMB_MAP_SIZE];
-volatile uint32_t emb_valid_items_size = 0;
-
-embedding_map_slot* emb_map_lookup(item* it, uint32_t hv);
-embedding* get_obj_emb(item* it, uint32_t hv);
-uint32_t get_sample_pool_idx(item* it, uint32_t hv);
-bool emb_map_make_entry(item* it, uint32_t hv);
-void emb_map_delete_entry(item* it, uint32_t hv);
-
-void make_random_emb(embedding* obj_emb);
-void emb_normalize(embedding* obj_emb);
-void shift_to_rolling_avg(embedding* obj_emb);
-void emb_update_rolling_avg(embedding* obj_emb);
-float emb_compute_obj_similarity(embedding* obj_emb);
-
-uint32_t add_valid_item(item* it);
-void emb_remove_item_nolock(item* it, uint32_t hv);
-void verify_pool_and_map(void);
-
-void verify_pool_and_map() {
-	return;
-	if (rand() % 50 != 0) {
-		//return;
-	}
-	for (uint32_t i = 0; i < emb_valid_items_size; i++) {
-		item* curr_it = emb_valid_items[i];
-		uint32_t curr_hv = hash(ITEM_key(curr_it), curr_it->nkey);
-		embedding_map_slot* itslot = emb_map_lookup(curr_it, curr_hv);
-		if (itslot == NULL) {
-			fprintf(stderr, "EMB_ERR: item hash %x in pool slot %u has no entry in hashmap\n", curr_hv, i);
-			abort();
-		}
-
-		if (itslot->sample_pool_idx != i) {
-			fprintf(stderr, "EMB_ERR: item hash %x in pool slot %u has WRONG entry in hashmap, it says index is %u\n", curr_hv, i, itslot->sample_pool_idx);
-			abort();
-		}
-	}
-}
-
-
-embedding_map_slot* emb_map_lookup(item* it, uint32_t hv) {
-	embedding_map_slot* curr_slot = emb_hashmap[hv % EMB_MAP_SIZE];
-	while (curr_slot != NULL && curr_slot->it != it) {
-		curr_slot = curr_slot->next;
-	}
-	if (EMB_DEBUG_PRINT) {
-		fprintf(stderr, "[EMB_DEBUG] looking up item ptr %p hv %x result %p\n", (void*) it, hv, (void*) curr_slot);
-	}
-	return curr_slot;
-}
-
-// get the pointer to embedding associated with an item
-embedding* get_obj_emb(item* it, uint32_t hv) {
-	// lookup the slot
-	embedding_map_slot* slot = emb_map_lookup(it, hv);
-	// if null, return null
-	if (slot == NULL) {
-		return NULL;
-	}
-	return &(slot->emb);
-}
-
-uint32_t get_sample_pool_idx(item* it, uint32_t hv) {
-	// lookup the slot
-	embedding_map_slot* slot = emb_map_lookup(it, hv);
-	// if null, return null
-	if (slot == NULL) {
-		return (uint32_t) (-1);
-	}
-
-	return slot->sample_pool_idx;
-}
-
-bool emb_map_make_entry(item* it, uint32_t hv) {
-	if (emb_map_lookup(it, hv) != NULL) {
-		// it must not be present
-		embedding_map_slot* slot = emb_map_lookup(it, hv);
-		if (slot->present) {
-			if (EMB_DEBUG_PRINT || EMB_ERR_PRINT) {
-				fprintf(stderr, "EMB_ERROR: duplicate entry for object in hashmap\n");
-			}
-			abort();
-		}
-		slot->present = true;
-		return true;
-	}
-
-	// add to the map
-	embedding_map_slot* curr_slot = emb_hashmap[hv % EMB_MAP_SIZE];
-	if (curr_slot == NULL) {
-		curr_slot = (embedding_map_slot*) malloc(sizeof(embedding_map_slot));
-		emb_hashmap[hv % EMB_MAP_SIZE] = curr_slot;
-
-		curr_slot->it = it;
-		curr_slot->sample_pool_idx = (uint32_t) -1;
-		curr_slot->next = NULL;
-		curr_slot->present = true;
-		return false;
-	}
-
-	while (curr_slot->next != NULL) {
-		curr_slot = curr_slot->next;
-	}
-
-	curr_slot->next = malloc(sizeof(embedding_map_slot));
-	curr_slot = curr_slot->next;
-
-	curr_slot->it = it;
-	curr_slot->sample_pool_idx = (uint32_t) -1;
-	curr_slot->next = NULL;
-	curr_slot->present = true;
-	return false;
-}
-
-void emb_map_delete_entry(item* it, uint32_t hv) {
-	// remove from the map
-	embedding_map_slot* curr_slot = emb_hashmap[hv % EMB_MAP_SIZE];
-	if (curr_slot != NULL && curr_slot->it == it) {
-		emb_hashmap[hv % EMB_MAP_SIZE] = curr_slot->next;
-		free(curr_slot);
-		return;
-	}
-
-	if (curr_slot == NULL) {
-		// problem, we are trying to delete something that's not there
-		if (EMB_DEBUG_PRINT || EMB_ERR_PRINT) {
-			fprintf(stderr, "EMB_ERROR: trying to delete nonexistent item\n");
-		}
-		abort();
-		return;
-	}
-
-	while (curr_slot->next != NULL && curr_slot->next->it != it) {
-		curr_slot = curr_slot->next;
-	}
-
-	// at this point, if next is null then it DNE
-	if (curr_slot->next == NULL) {
-		// problem, we are trying to delete something that's not there
-		if (EMB_DEBUG_PRINT || EMB_ERR_PRINT) {
-			fprintf(stderr, "EMB_ERROR: trying to delete nonexistent item\n");
-		}
-		abort();
-		return;
-	}
-
-	if (EMB_ERR_PRINT && curr_slot->next->it != it) {
-		fprintf(stderr, "EMB_ERROR: curr_slot->next->it != it\n");
-	}
-	// replace curr.next with curr.next.next
-	embedding_map_slot* next_slot = curr_slot->next->next;
-	free(curr_slot->next);
-	curr_slot->next = next_slot;
-}
-
-
-
-
-
-
-void make_random_emb(embedding* obj) {
-	for (int i = 0; i < EMBEDDING_DIM; i++) {
-		// make something random in [0, 1]
-		float r = ((float)rand() / (float)RAND_MAX);
-		// shift it to [-1, 1]
-		obj->vec[i] = r * 2.0f - 1.0f;
-	}
-}
-
-// normalize a vector
-void emb_normalize(embedding* obj_vec) {
-	// find mag, divide
-	float mag = 0;
-	for (int i = 0; i < EMBEDDING_DIM; i++) {
-		mag += obj_vec->vec[i] * obj_vec->vec[i];
-	}
-	mag = sqrtf(mag);
-	for (int i = 0; i < EMBEDDING_DIM; i++) {
-		obj_vec->vec[i] /= mag;
-	}
+// sampling pools: emb_nshards per slab class, each a dense array of
+// linked items we track that we can pull from in O(1). removal swaps the
+// tail entry into the hole.
+typedef struct {
+    item *it;
+    item_emb *ie;
+} emb_pool_entry;
+
+struct _emb_pool_array {
+    emb_pool_array *next; /* link in a dead_arrays list once retired */
+    emb_pool_entry e[];
+};
+
+/* The evictor reads size and entries without the lock. Entries are only
+ * replaced by a larger array, published before size can exceed the old
+ * capacity. */
+typedef struct {
+    pthread_mutex_t lock;
+    emb_pool_array *entries;
+    uint32_t size;
+    uint32_t cap;
+    bool ann;       /* a nearest neighbour list: entries use ann_idx */
+} emb_pool;
+
+#define EMB_POOL_INITIAL 256
+/* Items scored per eviction: the most while the retained candidates are
+ * running low, the fewest while at least half of them are left. */
+#define EMB_EVICT_SAMPLES 32
+#define EMB_EVICT_MIN_SAMPLES 4
+/* Retained candidates were scored against the model of up to this many
+ * seconds ago. Older ones are dropped rather than rescored. */
+#define EMB_EVICT_POOL_TTL 2
+/* weight of each victim in emb_evict_pool's victim_avg */
+#define EMB_EVICT_AVG_WEIGHT 0.05f
+/* emb_evict_score=gdsf: the least an item's fit can count for, so even the
+ * worst fitting items are still ranked by cost and size */
+#define EMB_GDSF_FIT_FLOOR 0.05f
+/* an item with this many seconds left to live counts half as much */
+#define EMB_GDSF_TTL_HALF 60
+
+/* MAX_NUMBER_OF_SLAB_CLASSES * emb_nshards pools, see emb_pool_of() */
+static emb_pool *emb_pools = NULL;
+static unsigned int emb_nshards = 0;
+/* hv >> this picks a shard, by the high bits */
+static unsigned int emb_shard_shift = 32;
+
+/* Nearest neighbour index (-o emb_ann_lists)
+ *
+ * Every tracked item is also filed in one of emb_ann_nlists inverted lists:
+ * the list of the coarse centroid its vector is most similar to. A query
+ * only scores the items in the EMB_ANN_PROBE lists whose centroids are
+ * nearest to the query vector, rather than every tracked item.
+ *
+ * Lists are emb_pools that index their entries with ann_idx, and queries
+ * read them under an epoch without locks, like the evictor reads the
+ * sampling pools. Vectors keep moving as they are trained, so every
+ * interval the maintainer thread refines the centroids with mini-batch
+ * k-means over a sample of tracked items and walks part of the lists,
+ * moving items whose nearest centroid changed (emb_ann_maintain()). An item
+ * filed under a stale list can be missed by a query, but results are always
+ * scored against current vectors. */
+#define EMB_ANN_NONE ((uint32_t) -1)
+#define EMB_ANN_PROBE 4
+/* items sampled per interval to refine the centroids */
+#define EMB_ANN_TRAIN_SAMPLES 64
+/* a centroid moves like the average of its last this many samples */
+#define EMB_ANN_MEMORY 4096
+/* list entries checked for a better list per interval */
+#define EMB_ANN_REASSIGN 1024
+
+static emb_pool *emb_ann_lists = NULL;
+static unsigned int emb_ann_nlists = 0;
+/* Centroids, double-buffered and published by flipping emb_ann_cur. Until
+ * there are enough items to seed them emb_ann_seeded is false and
+ * everything is filed in list 0. */
+static embedding *emb_ann_buf[2];
+static volatile int emb_ann_cur = 0;
+static volatile bool emb_ann_seeded = false;
+/* k-means state behind emb_ann_buf, only used by the maintainer thread */
+static embedding *emb_ann_km;
+static float *emb_ann_count;
+static unsigned int emb_ann_cursor_list = 0;
+static uint32_t emb_ann_cursor_pos = 0;
+static uint64_t emb_ann_queries = 0;
+static uint64_t emb_ann_scanned = 0;
+static uint64_t emb_ann_moved = 0;
+/* tracked extstore headers per slab class, for emb_prefetch_scan() */
+static uint32_t emb_hdr_items[MAX_NUMBER_OF_SLAB_CLASSES];
+
+static void emb_thread_link_q(emb_thread *et) {
+    pthread_mutex_lock(&emb_thread_lock);
+    et->next = emb_thread_head;
+    emb_thread_head = et;
+    pthread_mutex_unlock(&emb_thread_lock);
 }
 
-#define EMB_LEARNING_RATE 0.1
-// shift a vector closer to the rolling avg
-void shift_to_rolling_avg(embedding* obj_emb) {
-	// update each entry in obj_emb to be itself times alpha + rolling avg times alpha + noise
-	// TODO: fast noise
-	for (int i = 0; i < EMBEDDING_DIM; i++) {
-		obj_emb->vec[i] += EMB_LEARNING_RATE * rolling_avg.vec[i];
-	}
+const char *emb_precision_str(void) {
+    switch (settings.emb_precision) {
+    case EMB_PRECISION_FP16:
+        return "fp16";
+    case EMB_PRECISION_INT8:
+        return "int8";
+    default:
+        return "fp32";
+    }
+}
+
+/* Start a thread's history as if its last EMB_HISTORY accesses had all been
+ * the global average, so a model restored on warm restart carries on rather
+ * than being diluted by an empty ring. On a cold start this is all zeroes. */
+static void emb_thread_seed(emb_thread *et) {
+    embedding avg;
+    emb_read_model(&avg, NULL);
+    for (int j = 0; j < EMB_HISTORY; j++) {
+        for (int i = 0; i < EMBEDDING_DIM; i++) {
+            et->ring[j].vec[i] = avg.vec[i] / EMB_HISTORY;
+        }
+    }
+    et->avg = avg;
+}
+
+static void emb_rng_seed(emb_thread *et) {
+    static uint64_t emb_rng_seq = 0;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t seq = __atomic_fetch_add(&emb_rng_seq, 1, __ATOMIC_RELAXED);
+    mc_rng_seed(&et->rng, ((uint64_t)tv.tv_sec << 20 ^ tv.tv_usec) + (seq << 48));
+}
+
+/* Publish the centroids holding at least a quarter of their fair share of
+ * recent samples, then fade all counts so abandoned phases drop out. */
+static void emb_publish_context(void) {
+    float total = 0;
+    for (int k = 0; k < EMB_CENTROIDS; k++) {
+        total += emb_km_count[k];
+    }
+
+    int n = 0;
+    emb_model_write_begin();
+    for (int k = 0; k < EMB_CENTROIDS; k++) {
+        if (emb_km_count[k] >= 1 && emb_km_count[k] * EMB_CENTROIDS * 4 >= total) {
+            emb_ctx.c[n++] = emb_km[k];
+        }
+        emb_km_count[k] *= EMB_CENTROID_DECAY;
+    }
+    emb_ctx.n = n;
+    emb_model_write_end();
+}
+
+/* Assign a trained vector to its nearest centroid and move that centroid
+ * towards it, or start a new centroid if it is far from all of them. */
+static void emb_km_add(const embedding *x) {
+    int best = -1;
+    int idle = -1;
+    float best_sim = -2.0f;
+    for (int k = 0; k < EMB_CENTROIDS; k++) {
+        if (emb_km_count[k] < 1) {
+            if (idle < 0) {
+                idle = k;
+            }
+            continue;
+        }
+        float sim = emb_kernels.dot(emb_km[k].vec, x->vec);
+        if (sim > best_sim) {
+            best = k;
+            best_sim = sim;
+        }
+    }
+
+    if (idle >= 0 && (best < 0 || best_sim < EMB_CENTROID_SPLIT)) {
+        emb_km[idle] = *x;
+        emb_km_count[idle] = 1;
+        return;
+    }
+
+    embedding *c = &emb_km[best];
+    emb_km_count[best] += 1;
+    float m = emb_km_count[best] < EMB_CENTROID_MEMORY
+        ? emb_km_count[best] : EMB_CENTROID_MEMORY;
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        c->vec[i] += (x->vec[i] - c->vec[i]) / m;
+    }
+    emb_kernels.normalize(c->vec);
+}
+
+/* Warm restart metadata. Item vectors are kept inline in the memory file
+ * (-e implies emb_inline), so only the model is saved here: the global
+ * rolling average and any sgns centroids, as comma separated hex floats. */
+static void emb_restart_set_vec(void *ctx, const char *key, const embedding *e) {
+    char buf[EMBEDDING_DIM * 24];
+    int len = 0;
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%a",
+                i ? "," : "", e->vec[i]);
+    }
+    restart_set_kv(ctx, key, "%s", buf);
+}
+
+static bool emb_restart_get_vec(const char *val, embedding *e) {
+    const char *p = val;
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        char *end;
+        e->vec[i] = strtof(p, &end);
+        if (end == p || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return true;
+}
+
+static int emb_restart_save(const char *tag, void *ctx, void *data) {
+    restart_set_kv(ctx, "dim", "%d", EMBEDDING_DIM);
+    emb_restart_set_vec(ctx, "avg", &emb_avg);
+    for (int k = 0; k < EMB_CENTROIDS; k++) {
+        if (emb_km_count[k] >= 1) {
+            char key[16];
+            snprintf(key, sizeof(key), "centroid%d", k);
+            emb_restart_set_vec(ctx, key, &emb_km[k]);
+        }
+    }
+    return 0;
+}
+
+static int emb_restart_load(const char *tag, void *ctx, void *data) {
+    char *key;
+    char *val;
+    int r;
+    int k;
+    while ((r = restart_get_kv(ctx, &key, &val)) == RESTART_OK) {
+        if (strcmp(key, "dim") == 0) {
+            if (atoi(val) != EMBEDDING_DIM) {
+                fprintf(stderr, "[restart] embedding dimension changed\n");
+                return -1;
+            }
+        } else if (strcmp(key, "avg") == 0) {
+            emb_model_write_begin();
+            bool ok = emb_restart_get_vec(val, &emb_avg);
+            emb_model_write_end();
+            if (!ok) {
+                fprintf(stderr, "[restart] bad embedding average\n");
+                return -1;
+            }
+            emb_thread_seed(&emb_shared_thread);
+        } else if (sscanf(key, "centroid%d", &k) == 1
+                && k >= 0 && k < EMB_CENTROIDS) {
+            if (!emb_restart_get_vec(val, &emb_km[k])) {
+                fprintf(stderr, "[restart] bad embedding centroid\n");
+                return -1;
+            }
+            // worth a fraction of a live phase until samples confirm it
+            emb_km_count[k] = EMB_CENTROID_MEMORY / 4;
+        } else {
+            fprintf(stderr, "[restart] unhandled key: %s\n", key);
+        }
+    }
+    if (settings.emb_model == EMB_MODEL_SGNS) {
+        emb_publish_context();
+    }
+    return r == RESTART_DONE ? 0 : -1;
 }
 
-// add a vector to rolling avg, remove old one
-void emb_update_rolling_avg(embedding* obj_emb) {
-	for (int i = 0; i < EMBEDDING_DIM; i++) {
-		// add obj_emb, remove the old one
-		rolling_avg.vec[i] -= emb_ring_buffer[rolling_avg_write_ptr].vec[i];
-		emb_ring_buffer[rolling_avg_write_ptr].vec[i] = obj_emb->vec[i] / EMB_HISTORY;
-		rolling_avg.vec[i] += emb_ring_buffer[rolling_avg_write_ptr].vec[i];
-	}
+const char *emb_model_str(void) {
+    return settings.emb_model == EMB_MODEL_SGNS ? "sgns" : "avg";
+}
 
-	rolling_avg_write_ptr++;
-	rolling_avg_write_ptr %= EMB_HISTORY;
+const char *emb_evict_score_str(void) {
+    return settings.emb_evict_score == EMB_EVICT_GDSF ? "gdsf" : "sim";
 }
 
-float emb_compute_obj_similarity(embedding* obj_emb) {
-	// return dot product of rolling avg and obj emb
-	float sim = 0.0f;
-	for (int i = 0; i < EMBEDDING_DIM; i++) {
-		sim += obj_emb->vec[i] * rolling_avg.vec[i];
-	}
-	return sim;
+void emb_init(void) {
+    switch (settings.emb_precision) {
+    case EMB_PRECISION_FP16:
+        emb_vec_size = EMBEDDING_DIM * sizeof(uint16_t);
+        break;
+    case EMB_PRECISION_INT8:
+        emb_vec_size = EMBEDDING_DIM * sizeof(int8_t);
+        break;
+    default:
+        emb_vec_size = sizeof(embedding);
+        break;
+    }
+    if (settings.emb_inline) {
+        settings.emb_item_size = sizeof(item_emb) + emb_vec_size;
+    }
+    emb_kernels_init(settings.emb_simd);
+    emb_nshards = settings.emb_shards;
+    emb_shard_shift = 32;
+    for (unsigned int n = emb_nshards; n > 1; n >>= 1) {
+        emb_shard_shift--;
+    }
+    emb_pools = calloc((size_t)MAX_NUMBER_OF_SLAB_CLASSES * emb_nshards,
+            sizeof(emb_pool));
+    if (emb_pools == NULL) {
+        fprintf(stderr, "Failed to allocate embedding pools\n");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned int i = 0; i < MAX_NUMBER_OF_SLAB_CLASSES * emb_nshards; i++) {
+        pthread_mutex_init(&emb_pools[i].lock, NULL);
+    }
+    if (settings.emb_ann_lists) {
+        emb_ann_nlists = settings.emb_ann_lists;
+        emb_ann_lists = calloc(emb_ann_nlists, sizeof(emb_pool));
+        emb_ann_buf[0] = calloc(emb_ann_nlists, sizeof(embedding));
+        emb_ann_buf[1] = calloc(emb_ann_nlists, sizeof(embedding));
+        emb_ann_km = calloc(emb_ann_nlists, sizeof(embedding));
+        emb_ann_count = calloc(emb_ann_nlists, sizeof(float));
+        if (emb_ann_lists == NULL || emb_ann_buf[0] == NULL
+                || emb_ann_buf[1] == NULL || emb_ann_km == NULL
+                || emb_ann_count == NULL) {
+            fprintf(stderr, "Failed to allocate the embedding index\n");
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned int l = 0; l < emb_ann_nlists; l++) {
+            pthread_mutex_init(&emb_ann_lists[l].lock, NULL);
+            emb_ann_lists[l].ann = true;
+        }
+    }
+    pthread_key_create(&emb_thread_key, NULL);
+    emb_rng_seed(&emb_shared_thread);
+    pthread_mutex_init(&emb_shared_thread.mutex, NULL);
+    emb_thread_link_q(&emb_shared_thread);
+    if (settings.memory_file != NULL) {
+        restart_register("emb", emb_restart_load, emb_restart_save, NULL);
+    }
+}
+
+/* Must be called from the thread that will own the state. */
+void *emb_thread_create(void) {
+    emb_thread *et = calloc(1, sizeof(emb_thread));
+    if (et == NULL) {
+        return NULL;
+    }
+    if (settings.emb_async_train) {
+        et->train_buf = bipbuf_new(sizeof(emb_access) * EMB_TRAIN_BUF_SIZE);
+        if (et->train_buf == NULL) {
+            free(et);
+            return NULL;
+        }
+    }
+    emb_thread_seed(et);
+    emb_rng_seed(et);
+    pthread_mutex_init(&et->mutex, NULL);
+    pthread_setspecific(emb_thread_key, et);
+    emb_thread_link_q(et);
+    return et;
 }
 
+/* State for threads that didn't call emb_thread_create(), created on first
+ * use. Falls back to the shared state if that fails. */
+static emb_thread *emb_thread_get(void) {
+    emb_thread *et = pthread_getspecific(emb_thread_key);
+    if (et == NULL) {
+        et = emb_thread_create();
+        if (et == NULL) {
+            et = &emb_shared_thread;
+        }
+    }
+    return et;
+}
 
-// called from user command path when objects are accessed
+/* Anything the evictor reads from pools or item_embs while in an epoch stays
+ * allocated until it leaves. */
+static inline void emb_epoch_enter(emb_thread *et) {
+    __atomic_store_n(&et->epoch, __atomic_load_n(&emb_epoch, __ATOMIC_RELAXED),
+            __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void emb_epoch_leave(emb_thread *et) {
+    __atomic_store_n(&et->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Free a map slot or pool array once no sampler can see it. It must already
+ * be unreachable from the map and pools. */
+static void emb_retire(embedding_map_slot *slot, emb_pool_array *arr) {
+    emb_thread *et = emb_thread_get();
+    pthread_mutex_lock(&et->mutex);
+    int e = __atomic_load_n(&emb_epoch, __ATOMIC_SEQ_CST) % 3;
+    if (slot != NULL) {
+        slot->next = et->dead_slots[e];
+        et->dead_slots[e] = slot;
+    }
+    if (arr != NULL) {
+        arr->next = et->dead_arrays[e];
+        et->dead_arrays[e] = arr;
+    }
+    pthread_mutex_unlock(&et->mutex);
+}
+
+static inline emb_pool *emb_pool_of(const unsigned int id, const unsigned int shard) {
+    return &emb_pools[id * emb_nshards + shard];
+}
+
+static inline unsigned int emb_shard_of(const uint32_t hv) {
+    // a shift by 32 is undefined, hence the widening for emb_shards=1
+    return (uint64_t)hv >> emb_shard_shift;
+}
+
+static embedding_map_slot* emb_map_lookup(item* it, uint32_t hv) {
+    embedding_map_slot* curr_slot = emb_hashmap[hv & (EMB_MAP_SIZE - 1)];
+    while (curr_slot != NULL && curr_slot->it != it) {
+        curr_slot = curr_slot->next;
+    }
+    if (EMB_DEBUG_PRINT) {
+        fprintf(stderr, "[EMB_DEBUG] looking up item ptr %p hv %x result %p\n", (void*) it, hv, (void*) curr_slot);
+    }
+    return curr_slot;
+}
+
+/* Called on freshly allocated ITEM_EMB items: the block is whatever the
+ * slab chunk held before. Copies made by the slab mover or read back from
+ * extstore keep their trained vector. */
+void emb_item_init(item *it) {
+    item_emb *ie = (item_emb *) ITEM_emb(it);
+    __atomic_store_n(&ie->owner, NULL, __ATOMIC_RELEASE);
+    ie->pool_idx = (uint32_t) -1;
+    ie->flags = 0;
+}
+
+// get the embedding state associated with an item, NULL if untracked.
+// inline blocks may be copies of another item's, so they only count if the
+// owner matches.
+static item_emb *get_obj_emb(item* it, uint32_t hv) {
+    if (it->it_flags & ITEM_EMB) {
+        item_emb *ie = (item_emb *) ITEM_emb(it);
+        return ie->owner == it ? ie : NULL;
+    }
+    embedding_map_slot* slot = emb_map_lookup(it, hv);
+    if (slot == NULL) {
+        return NULL;
+    }
+    return &(slot->ie);
+}
+
+/* The item lock must be held. */
+static embedding_map_slot *emb_map_make_entry(item* it, uint32_t hv) {
+    embedding_map_slot *slot = malloc(sizeof(embedding_map_slot) + emb_vec_size);
+    if (slot == NULL) {
+        return NULL;
+    }
+    slot->it = it;
+    slot->ie.owner = NULL;
+    slot->ie.pool_idx = (uint32_t) -1;
+    slot->ie.hv = hv;
+    slot->ie.flags = 0;
+    slot->next = emb_hashmap[hv & (EMB_MAP_SIZE - 1)];
+    emb_hashmap[hv & (EMB_MAP_SIZE - 1)] = slot;
+    return slot;
+}
+
+/* The item lock must be held. The evictor may still be reading the slot,
+ * so it is retired rather than freed. */
+static void emb_map_delete_entry(item* it, uint32_t hv) {
+    embedding_map_slot **pp = &emb_hashmap[hv & (EMB_MAP_SIZE - 1)];
+    while (*pp != NULL) {
+        if ((*pp)->it == it) {
+            embedding_map_slot *todel = *pp;
+            *pp = todel->next;
+            emb_retire(todel, NULL);
+            return;
+        }
+        pp = &(*pp)->next;
+    }
+}
+
+static void make_random_emb(embedding* obj) {
+    emb_thread *et = emb_thread_get();
+    if (et == &emb_shared_thread) {
+        pthread_mutex_lock(&et->mutex);
+    }
+    mc_rng_fill_floats(&et->rng, obj->vec, EMBEDDING_DIM, -1.0f, 1.0f);
+    if (et == &emb_shared_thread) {
+        pthread_mutex_unlock(&et->mutex);
+    }
+}
+
+/* Get a float view of an item's vector. fp32 vectors are used in place,
+ * others are decoded into work and need an emb_store() after changes. */
+static embedding *emb_load(item_emb *ie, embedding *work) {
+    switch (settings.emb_precision) {
+    case EMB_PRECISION_FP16:
+        emb_kernels.from_fp16(work->vec, ITEM_EMB_VEC(ie));
+        return work;
+    case EMB_PRECISION_INT8: {
+        int8_t *q = ITEM_EMB_VEC(ie);
+        for (int i = 0; i < EMBEDDING_DIM; i++) {
+            work->vec[i] = q[i] / EMB_INT8_SCALE;
+        }
+        return work;
+    }
+    default:
+        return ITEM_EMB_VEC(ie);
+    }
+}
+
+static void emb_store(item_emb *ie, const embedding *obj) {
+    switch (settings.emb_precision) {
+    case EMB_PRECISION_FP16:
+        emb_kernels.to_fp16(ITEM_EMB_VEC(ie), obj->vec);
+        break;
+    case EMB_PRECISION_INT8: {
+        int8_t *q = ITEM_EMB_VEC(ie);
+        for (int i = 0; i < EMBEDDING_DIM; i++) {
+            float v = lrintf(obj->vec[i] * EMB_INT8_SCALE);
+            q[i] = v > 127 ? 127 : (v < -127 ? -127 : v);
+        }
+        break;
+    }
+    default:
+        if ((void *)obj != ITEM_EMB_VEC(ie)) {
+            memcpy(ITEM_EMB_VEC(ie), obj, sizeof(embedding));
+        }
+        break;
+    }
+}
+
+// add a vector to this thread's rolling avg, remove the oldest one
+static void emb_thread_update_avg(emb_thread *et, embedding* obj_emb) {
+    embedding *old = &et->ring[et->ring_ptr];
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        et->avg.vec[i] -= old->vec[i];
+        old->vec[i] = obj_emb->vec[i] / EMB_HISTORY;
+        et->avg.vec[i] += old->vec[i];
+    }
+
+    et->ring_ptr++;
+    et->ring_ptr %= EMB_HISTORY;
+    et->updates++;
+}
+
+// dot product of the rolling avg and the item's stored vector
+static float emb_compute_obj_similarity(item_emb *ie, const embedding *avg) {
+    switch (settings.emb_precision) {
+    case EMB_PRECISION_FP16:
+        return emb_kernels.dot_fp16(ITEM_EMB_VEC(ie), avg->vec);
+    case EMB_PRECISION_INT8:
+        return emb_kernels.dot_int8(ITEM_EMB_VEC(ie), avg->vec);
+    default:
+        return emb_kernels.dot(ITEM_EMB_VEC(ie), avg->vec);
+    }
+}
+
+/* How well an item fits the recent workload: its similarity to the nearest
+ * context centroid, or to the rolling avg if there are none. */
+static float emb_score(item_emb *ie, const embedding *avg, const emb_context *ctx) {
+    if (ctx == NULL || ctx->n == 0) {
+        return emb_compute_obj_similarity(ie, avg);
+    }
+    float best = emb_compute_obj_similarity(ie, &ctx->c[0]);
+    for (int k = 1; k < ctx->n; k++) {
+        float sim = emb_compute_obj_similarity(ie, &ctx->c[k]);
+        if (sim > best) {
+            best = sim;
+        }
+    }
+    return best;
+}
+
+/* How much it is worth keeping an item: lower is evicted first. With
+ * emb_evict_score=gdsf this is GreedyDual-Size-Frequency with similarity
+ * standing in for frequency: fit times the client's cost hint, per KB the
+ * eviction frees, scaled down as the item nears expiry. Sampled items are
+ * read without their lock, so this may be scoring garbage; victims are
+ * validated afterwards. */
+static float emb_evict_score(item *it, item_emb *ie, const embedding *avg,
+        const emb_context *ctx) {
+    float sim = emb_score(ie, avg, ctx);
+    if (settings.emb_evict_score != EMB_EVICT_GDSF) {
+        return sim;
+    }
+
+    float fit = sim < -1.0f ? 0 : (sim > 1.0f ? 1.0f : (sim + 1.0f) / 2);
+    float cost = it->cost ? it->cost : 1;
+    float score = (fit + EMB_GDSF_FIT_FLOOR) * cost * 1024 / ITEM_ntotal(it);
+    rel_time_t exptime = it->exptime;
+    if (exptime != 0) {
+        float left = exptime > current_time ? exptime - current_time : 0;
+        score *= left / (left + EMB_GDSF_TTL_HALF);
+    }
+    return score;
+}
+
+static inline uint32_t *emb_pool_idx(emb_pool *pool, item_emb *ie) {
+    return pool->ann ? &ie->ann_idx : &ie->pool_idx;
+}
+
+/* Pool lock must be held. */
+static bool emb_pool_add(emb_pool *pool, item *it, item_emb *ie) {
+    if (pool->size == pool->cap) {
+        uint32_t cap = pool->cap ? pool->cap * 2 : EMB_POOL_INITIAL;
+        emb_pool_array *arr = malloc(sizeof(emb_pool_array) + sizeof(emb_pool_entry) * cap);
+        if (arr == NULL) {
+            return false;
+        }
+        emb_pool_array *old = pool->entries;
+        if (old != NULL) {
+            memcpy(arr->e, old->e, sizeof(emb_pool_entry) * pool->size);
+        }
+        __atomic_store_n(&pool->entries, arr, __ATOMIC_RELEASE);
+        pool->cap = cap;
+        if (old != NULL) {
+            emb_retire(NULL, old);
+        }
+    }
+
+    *emb_pool_idx(pool, ie) = pool->size;
+    pool->entries->e[pool->size].it = it;
+    pool->entries->e[pool->size].ie = ie;
+    __atomic_store_n(&pool->size, pool->size + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Pool lock must be held. */
+static void emb_pool_remove(emb_pool *pool, item_emb *ie) {
+    emb_pool_entry *e = pool->entries->e;
+    uint32_t idx = *emb_pool_idx(pool, ie);
+    assert(idx < pool->size && e[idx].ie == ie);
+
+    // write the tail into the index of the removed item
+    uint32_t last = pool->size - 1;
+    if (idx != last) {
+        e[idx] = e[last];
+        *emb_pool_idx(pool, e[idx].ie) = idx;
+    }
+    __atomic_store_n(&pool->size, last, __ATOMIC_RELEASE);
+    *emb_pool_idx(pool, ie) = (uint32_t) -1;
+}
+
+/* The list a vector should be filed in. */
+static unsigned int emb_ann_nearest(const embedding *v) {
+    if (!emb_ann_seeded) {
+        return 0;
+    }
+    const embedding *c = emb_ann_buf[emb_ann_cur];
+    unsigned int best = 0;
+    float best_sim = emb_kernels.dot(c[0].vec, v->vec);
+    for (unsigned int l = 1; l < emb_ann_nlists; l++) {
+        float sim = emb_kernels.dot(c[l].vec, v->vec);
+        if (sim > best_sim) {
+            best = l;
+            best_sim = sim;
+        }
+    }
+    return best;
+}
+
+/* File a tracked item in the list nearest to its vector. Item lock must be
+ * held. On failure the item stays out of the index. */
+static void emb_ann_add(item *it, item_emb *ie) {
+    embedding work;
+    unsigned int l = emb_ann_nearest(emb_load(ie, &work));
+    emb_pool *list = &emb_ann_lists[l];
+    pthread_mutex_lock(&list->lock);
+    if (emb_pool_add(list, it, ie)) {
+        ie->ann_list = l;
+    }
+    pthread_mutex_unlock(&list->lock);
+}
+
+/* Item lock must be held. */
+static void emb_ann_remove(item_emb *ie) {
+    if (ie->ann_list == EMB_ANN_NONE) {
+        return;
+    }
+    emb_pool *list = &emb_ann_lists[ie->ann_list];
+    pthread_mutex_lock(&list->lock);
+    emb_pool_remove(list, ie);
+    pthread_mutex_unlock(&list->lock);
+    ie->ann_list = EMB_ANN_NONE;
+}
+
+/* Start tracking a newly linked item. Item lock must be held.
+ * Returns NULL if the item is left untracked for lack of memory. */
+static item_emb *emb_track_item(item *it, uint32_t hv) {
+    item_emb *ie = NULL;
+    if (it->it_flags & ITEM_EMB) {
+        ie = (item_emb *) ITEM_emb(it);
+    } else {
+        embedding_map_slot *slot = emb_map_make_entry(it, hv);
+        if (slot == NULL) {
+            return NULL;
+        }
+        ie = &slot->ie;
+    }
+
+    // must be initialized before the evictor can see it in the pool.
+    if ((ie->flags & EMB_VALID) == 0) {
+        embedding rnd;
+        make_random_emb(&rnd);
+        emb_store(ie, &rnd);
+        ie->flags |= EMB_VALID;
+    }
+
+    emb_pool *pool = emb_pool_of(ITEM_clsid(it), emb_shard_of(hv));
+    pthread_mutex_lock(&pool->lock);
+    bool added = emb_pool_add(pool, it, ie);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!added) {
+        if ((it->it_flags & ITEM_EMB) == 0) {
+            emb_map_delete_entry(it, hv);
+        }
+        return NULL;
+    }
+    // inline blocks may have been copied from another item
+    ie->ann_list = EMB_ANN_NONE;
+    if (emb_ann_lists != NULL) {
+        emb_ann_add(it, ie);
+    }
+    if (it->it_flags & ITEM_HDR) {
+        __atomic_fetch_add(&emb_hdr_items[ITEM_clsid(it)], 1, __ATOMIC_RELAXED);
+    }
+    // the evictor trusts hv once it sees itself as the owner
+    ie->hv = hv;
+    __atomic_store_n(&ie->owner, it, __ATOMIC_RELEASE);
+    return ie;
+}
+
+/* Shift an item's vector towards the rolling avg. work must not be shared;
+ * returns the trained vector, which may or may not be work. The item lock
+ * must be held. */
+static embedding *emb_train(item_emb *ie, const embedding *avg, embedding *work) {
+    embedding *obj_emb = emb_load(ie, work);
+    emb_kernels.axpy(obj_emb->vec, EMB_LEARNING_RATE, avg->vec);
+    emb_kernels.normalize(obj_emb->vec);
+    emb_store(ie, obj_emb);
+    return obj_emb;
+}
+
+static void emb_queue_access(emb_thread *et, item *it, uint32_t hv) {
+    pthread_mutex_lock(&et->mutex);
+    emb_access *ea = (emb_access *) bipbuf_request(et->train_buf, sizeof(emb_access));
+    if (ea != NULL) {
+        ea->it = it;
+        ea->hv = hv;
+        ea->time = current_time;
+        if (bipbuf_push(et->train_buf, sizeof(emb_access)) == 0) {
+            et->train_dropped++;
+        }
+    } else {
+        et->train_dropped++;
+    }
+    pthread_mutex_unlock(&et->mutex);
+}
+
+/* Track the item if needed and train it on this access. Item lock must be
+ * held. */
+static void emb_update(item *it) {
+    if ((it->it_flags & ITEM_LINKED) == 0) {
+        return;
+    }
+
+    item_emb *ie = get_obj_emb(it, it->hv);
+    if (ie == NULL) {
+        ie = emb_track_item(it, it->hv);
+        if (ie == NULL) {
+            return;
+        }
+    }
+
+    emb_thread *et = emb_thread_get();
+    if (et->train_buf != NULL) {
+        emb_queue_access(et, it, ie->hv);
+        return;
+    }
+
+    embedding avg;
+    embedding work;
+    emb_read_model(&avg, NULL);
+    embedding *obj_emb = emb_train(ie, &avg, &work);
+
+    // record the access in this thread's history
+    pthread_mutex_lock(&et->mutex);
+    emb_thread_update_avg(et, obj_emb);
+    pthread_mutex_unlock(&et->mutex);
+}
+
+// called from user command path when objects are accessed.
 void emb_update_object(item* it) {
-	pthread_mutex_lock(&emb_lock);
-
-	if ((it->it_flags & ITEM_LINKED) == 0) {
-		pthread_mutex_unlock(&emb_lock);
-		return;
-	}
-	if (EMB_ERR_PRINT) verify_pool_and_map();
-
-	if (EMB_DEBUG_PRINT) {
-		fprintf(stderr, "[EMBDEBUG] updating key=%.*s\n", it->nkey, ITEM_key(it));
-	}
-	uint32_t hv = hash(ITEM_key(it), it->nkey);
-	if (EMB_API_PRINT) {
-		fprintf(stderr, "[%lu] UPDATE ptr %p hash %x\n", (unsigned long) pthread_self(), (void*) it, hv);
-	}
-	
-	// if there is no entry
-	embedding* obj_emb = get_obj_emb(it, hv);
-	if (obj_emb == NULL) {
-		if (EMB_DEBUG_PRINT || EMB_API_PRINT) {
-			fprintf(stderr, "[EMBDEBUG] new object\n");
-		}
-		// install it in hashmap
-		bool had_previous_emb = emb_map_make_entry(it, hv);
-		obj_emb = get_obj_emb(it, hv);
-		if (!had_previous_emb) {
-			if (EMB_DEBUG_PRINT) {
-				fprintf(stderr, "[EMBDEBUG] did not have previous emb\n");
-			}
-			// initialize vector
-			make_random_emb(obj_emb);
-		}
-		// update the sample pool idx
-		embedding_map_slot* slot = emb_map_lookup(it, hv);
-		slot->sample_pool_idx = add_valid_item(it);
-		if (EMB_API_PRINT) {
-			fprintf(stderr, "[%lu] ADDPOOL item %p hash %x slot %u\n", (unsigned long) pthread_self(), (void*) it, hv, slot->sample_pool_idx);
-		}
-	} else {
-		if (EMB_DEBUG_PRINT || EMB_API_PRINT) {
-			fprintf(stderr, "[EMBDEBUG] old object\n");
-		}
-	}
-
-	embedding_map_slot* slot = emb_map_lookup(it, hv);
-	if (EMB_ERR_PRINT && emb_valid_items[slot->sample_pool_idx] != it) {
-		fprintf(stderr, "[EMB_ERR] inserting item with hash %x ptr %p, obj->slot = %u but valid_items[slot] has ptr %p\n", hv, (void*) it, slot->sample_pool_idx, (void*) emb_valid_items[slot->sample_pool_idx]);
-		abort();
-	}
-
-	// shift it towards the rolling avg
-	shift_to_rolling_avg(obj_emb);
-	emb_normalize(obj_emb);
-
-	// update ring buffer and rolling avg
-	emb_update_rolling_avg(obj_emb);
-
-	if (EMB_ERR_PRINT) verify_pool_and_map();
-	if (EMB_API_PRINT) {
-		fprintf(stderr, "[%lu] FINISHED UPDATE\n", (unsigned long) pthread_self());
-	}
-	pthread_mutex_unlock(&emb_lock);
-}
-
-void emb_query_embedding(item* it) {
-	// TODO
-	uint32_t hv = hash(ITEM_key(it), it->nkey);
-	embedding* emb = get_obj_emb(it, hv);
-	if (emb == NULL) {
-		// print item key -> null
-	} else {
-		// print item key -> emb
-	}
-}
-
-
-uint32_t add_valid_item(item* it) {
-	// increase size by one
-	if (emb_valid_items_size == EMB_MAP_SIZE) {
-		if (EMB_DEBUG_PRINT || EMB_ERR_PRINT) {
-			fprintf(stderr, "EMB_ERROR: valid items pool ran out of slots!\n");
-		}
-		abort();
-		return (uint32_t) -1;
-	}
-
-	emb_valid_items_size++;
-	if (EMB_ERR_PRINT && emb_valid_items[emb_valid_items_size - 1] != NULL) {
-		fprintf(stderr, "EMB_ERR: trying to add to tail at slot %u but ptr %p is in there\n", emb_valid_items_size - 1, (void*) emb_valid_items[emb_valid_items_size - 1]);
-	}
-	emb_valid_items[emb_valid_items_size - 1] = it;
-	return emb_valid_items_size - 1;
-}
-
-/*bool emb_evict_candidate() {
-	pthread_mutex_lock(&emb_lock);
-	if (EMB_API_PRINT) {
-		fprintf(stderr, "[%lu] FIND_EVICT\n", (unsigned long) pthread_self());
-	}
-	if (EMB_ERR_PRINT) verify_pool_and_map();
-	if (EMB_DEBUG_PRINT) {
-		fprintf(stderr, "[EMBDEBUG] searching for eviction candidate\n");
-	}
-	if (emb_valid_items_size == 0) {
-		if (EMB_DEBUG_PRINT) {
-			fprintf(stderr, "[EMBDEBUG] no valid items\n");
-		}
-		pthread_mutex_unlock(&emb_lock);
-		return false;
-	}
-	// randomly sample objects from the sampling pool
-	item* least_similar = NULL;
-	uint32_t least_similar_hash = (uint32_t) -1;
-	float least_similar_sim = 100;
-
-	for (int i = 0; i < 32; i++) {
-		// get a random item
-		uint32_t obj_index = rand() % emb_valid_items_size;
-		if (EMB_DEBUG_PRINT) {
-			fprintf(stderr, "[EMBDEBUG] sampling index %d\n", obj_index);
-		}
-		item* it = emb_valid_items[obj_index];
-		// if it is in the sample pool, it must be in the hashmap
-		uint32_t hv = hash(ITEM_key(it), it->nkey);
-		if (EMB_ERR_PRINT && emb_map_lookup(it, hv) == NULL) {
-			fprintf(stderr, "[EMBERR] trying to sample something that is not in hashmap num_valid=%u, sampled_index=%u, obj_hash=%x, item_ptr=%p\n", emb_valid_items_size, obj_index, hv, (void*)it);
-			abort();
-		}
-		if (EMB_ERR_PRINT && (emb_map_lookup(it, hv)->sample_pool_idx != obj_index)) {
-			fprintf(stderr, "[EMBERR] obj with hash %x object sample pool idx is %u but it's actually in %u\n", hv, emb_map_lookup(it,hv)->sample_pool_idx, obj_index);
-			abort();
-		}
-
-		// look it up in the table
-		embedding* obj_emb = get_obj_emb(it, hv);
-		// get its similarity to rolling avg
-		float obj_sim = emb_compute_obj_similarity(obj_emb);
-
-		if (least_similar == NULL || obj_sim < least_similar_sim) {
-			least_similar = it;
-			least_similar_hash = hv;
-			least_similar_sim = obj_sim;
-		}
-	}
-
-
-	if (EMB_API_PRINT) {
-		fprintf(stderr, "[%lu] EVICT ptr %p hv %x\n", (unsigned long) pthread_self(), (void*) least_similar, least_similar_hash);
-	}
-
-	// remove the least similar one: do_item_unlink()
-	// LOGGER_LOG(NULL, LOG_EVICTIONS, LOGGER_EVICTION, least_similar);
-	// STORAGE_delete(ext_storage, least_similar);
-	// emb_remove_item_nolock(least_similar, least_similar_hash);
-	if (EMB_ERR_PRINT) verify_pool_and_map();
-	//emb_remove_item_nolock(least_similar, least_similar_hash);
-	//do_item_unlink(least_similar, least_similar_hash);
-
-	pthread_mutex_unlock(&emb_lock);
-	// ^this will call emb_remove_item, but it will not see
-
-	// we evicted something
-	return true;
-}*/
-bool emb_evict_candidate() {
-    /* ---------- 1. pick a victim under emb_lock ---------- */
-    pthread_mutex_lock(&emb_lock);
-
-    if (emb_valid_items_size == 0) {
-        pthread_mutex_unlock(&emb_lock);
-        return false;
+    emb_thread *et = emb_thread_get();
+    __atomic_store_n(&et->hits, et->hits + 1, __ATOMIC_RELAXED);
+    emb_update(it);
+}
+
+/* items whose trained vector was kept on warm restart */
+static uint64_t emb_restored_items = 0;
+
+static void emb_link_object(item *it, const uint32_t hv) {
+    emb_update(it);
+}
+
+/* Items restored on warm restart keep their inline vector, but still point at
+ * the old process's pool. Track them again without training: being restored
+ * is not an access. */
+static void emb_restore_object(item *it, const uint32_t hv) {
+    if (it->it_flags & ITEM_EMB) {
+        item_emb *ie = (item_emb *) ITEM_emb(it);
+        __atomic_store_n(&ie->owner, NULL, __ATOMIC_RELEASE);
+        ie->pool_idx = (uint32_t) -1;
+        if (ie->flags & EMB_VALID) {
+            emb_restored_items++;
+        }
+    }
+    emb_track_item(it, hv);
+}
+
+static uint64_t emb_total_train_dropped(void) {
+    uint64_t total = 0;
+    pthread_mutex_lock(&emb_thread_lock);
+    for (emb_thread *et = emb_thread_head; et != NULL; et = et->next) {
+        pthread_mutex_lock(&et->mutex);
+        total += et->train_dropped;
+        pthread_mutex_unlock(&et->mutex);
+    }
+    pthread_mutex_unlock(&emb_thread_lock);
+    return total;
+}
+
+/* Drop retained candidates scored against a stale model. */
+static void emb_evict_pool_expire(emb_evict_pool *ep) {
+    int n = 0;
+    for (int i = 0; i < ep->n; i++) {
+        if (current_time - ep->c[i].time <= EMB_EVICT_POOL_TTL) {
+            ep->c[n++] = ep->c[i];
+        }
+    }
+    ep->n = n;
+}
+
+/* Expired or flushed, same test as lru_pull_tail(). */
+static inline bool emb_item_dead(item *it) {
+    return (it->exptime != 0 && it->exptime < current_time)
+        || item_is_flushed(it);
+}
+
+/* Keep a sampled item if it scores lower than the worst retained one. */
+static void emb_evict_pool_insert(emb_evict_pool *ep, item *it, uint32_t hv,
+        float score) {
+    int pos = ep->n;
+    for (int i = 0; i < ep->n; i++) {
+        if (ep->c[i].it == it) {
+            // sampled again: keep the older entry, it is about as good
+            return;
+        }
+        if (pos == ep->n && score < ep->c[i].score) {
+            pos = i;
+        }
+    }
+    if (pos == EMB_EVICT_POOL) {
+        return;
+    }
+    int last = ep->n < EMB_EVICT_POOL ? ep->n : EMB_EVICT_POOL - 1;
+    memmove(&ep->c[pos + 1], &ep->c[pos], sizeof(emb_candidate) * (last - pos));
+    ep->c[pos].it = it;
+    ep->c[pos].hv = hv;
+    ep->c[pos].score = score;
+    ep->c[pos].time = current_time;
+    if (ep->n < EMB_EVICT_POOL) {
+        ep->n++;
+    }
+}
+
+/* Score fresh samples of slab class id into the thread's retained
+ * candidates. Fewer are needed while plenty are retained, and scanning
+ * stops at the first item scoring below the thread's recent victims.
+ * Expired and flushed items are kept without being scored, ahead of every
+ * live candidate. Once one is found the rest of the samples are only
+ * checked for more of them. */
+static void emb_evict_pool_refill(emb_thread *et, const unsigned int id) {
+    emb_evict_pool *ep = &et->evict_pools[id];
+    int samples = ep->n >= EMB_EVICT_POOL / 2
+        ? EMB_EVICT_MIN_SAMPLES : EMB_EVICT_SAMPLES;
+
+    embedding avg;
+    emb_context ctx;
+    bool sgns = settings.emb_model == EMB_MODEL_SGNS;
+    emb_read_model(&avg, sgns ? &ctx : NULL);
+
+    emb_epoch_enter(et);
+
+    // shards are filled by hash, so picking one at random and then an entry
+    // in it is close enough to uniform.
+    int i = 0;
+    int dead = 0;
+    while (i < samples) {
+        emb_pool *pool = emb_pool_of(id, mc_rng_bounded(&et->rng, emb_nshards));
+        i++;
+        uint32_t size = __atomic_load_n(&pool->size, __ATOMIC_ACQUIRE);
+        if (size == 0) {
+            continue;
+        }
+        emb_pool_array *arr = __atomic_load_n(&pool->entries, __ATOMIC_ACQUIRE);
+        emb_pool_entry e = arr->e[mc_rng_bounded(&et->rng, size)];
+
+        // may be torn, emb_evict_candidate() validates it
+        if (emb_item_dead(e.it)) {
+            emb_evict_pool_insert(ep, e.it, e.ie->hv, -INFINITY);
+            dead++;
+            continue;
+        } else if (dead) {
+            continue;
+        }
+        float score = emb_evict_score(e.it, e.ie, &avg, sgns ? &ctx : NULL);
+        emb_evict_pool_insert(ep, e.it, e.ie->hv, score);
+        if (ep->has_victims && score < ep->victim_avg) {
+            __atomic_store_n(&et->evict_early, et->evict_early + 1,
+                    __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    emb_epoch_leave(et);
+    __atomic_store_n(&et->evict_samples, et->evict_samples + i,
+            __ATOMIC_RELAXED);
+}
+
+/* Evict the item from slab class id that is least similar to the recent
+ * access pattern, of those sampled by this thread. Expired or flushed items
+ * it sampled are reclaimed instead, all of them, and then nothing live is
+ * evicted. Returns the number of items freed. */
+int emb_evict_candidate(const unsigned int id) {
+    emb_thread *et = emb_thread_get();
+    if (et == &emb_shared_thread) {
+        // evict_pools can't be shared
+        return 0;
+    }
+
+    /* ---------- 1. pick a victim without locking the pools ---------- */
+    emb_evict_pool *ep = &et->evict_pools[id];
+    emb_evict_pool_expire(ep);
+    emb_evict_pool_refill(et, id);
+
+    /* Candidates may be stale or torn, and their item_embs may be gone: only
+     * the item memory itself is never freed. Only trust a candidate if,
+     * under the lock for the hv it claims, it is still linked with that hv
+     * and tracked. hv only changes while the item is unlinked. */
+    int reclaimed = 0;
+    while (ep->n > 0) {
+        if (reclaimed && ep->c[0].score != -INFINITY) {
+            break;
+        }
+        emb_candidate cand = ep->c[0];
+        ep->n--;
+        memmove(&ep->c[0], &ep->c[1], sizeof(emb_candidate) * ep->n);
+
+        item *victim = cand.it;
+        void *hold_lock = item_trylock(cand.hv);
+        if (hold_lock == NULL) {
+            continue;
+        }
+        if ((victim->it_flags & ITEM_LINKED) == 0
+                || victim->hv != cand.hv
+                || ITEM_clsid(victim) != id
+                || get_obj_emb(victim, cand.hv) == NULL) {
+            item_trylock_unlock(hold_lock);
+            continue;
+        }
+
+        /* ---------- 2. unlink safely ---------- */
+
+        /* Same refcount dance as lru_pull_tail(): skip busy items. */
+        if (refcount_incr(victim) != 2) {
+            refcount_decr(victim);
+            item_trylock_unlock(hold_lock);
+            continue;
+        }
+
+        /* Unlinking calls emb_remove_item() which updates the hashmap +
+           sampling pool. */
+        if (emb_item_dead(victim)) {
+            do_item_reclaim(victim, cand.hv);
+            do_item_remove(victim);
+            item_trylock_unlock(hold_lock);
+            reclaimed++;
+            continue;
+        } else if (cand.score == -INFINITY) {
+            // replaced by a live item since it was sampled
+            refcount_decr(victim);
+            item_trylock_unlock(hold_lock);
+            continue;
+        }
+        do_item_evict(victim, cand.hv);
+        do_item_remove(victim);        /* drops the ref we added above */
+        item_trylock_unlock(hold_lock);
+
+        if (!ep->has_victims) {
+            ep->victim_avg = cand.score;
+            ep->has_victims = true;
+        } else {
+            ep->victim_avg += (cand.score - ep->victim_avg) * EMB_EVICT_AVG_WEIGHT;
+        }
+        return 1;
+    }
+
+    if (reclaimed) {
+        __atomic_store_n(&et->evict_reclaimed, et->evict_reclaimed + reclaimed,
+                __ATOMIC_RELAXED);
+    }
+    return reclaimed;
+}
+
+/* Called when an item is unlinked. The item lock must be held. */
+void emb_remove_item(item* it, uint32_t hv) {
+    item_emb *ie = get_obj_emb(it, hv);
+    if (ie == NULL) {
+        // we don't know about this item, so it's okay
+        return;
+    }
+
+    emb_pool *pool = emb_pool_of(ITEM_clsid(it), emb_shard_of(hv));
+    pthread_mutex_lock(&pool->lock);
+    emb_pool_remove(pool, ie);
+    pthread_mutex_unlock(&pool->lock);
+    if (emb_ann_lists != NULL) {
+        emb_ann_remove(ie);
+    }
+    __atomic_store_n(&ie->owner, NULL, __ATOMIC_RELEASE);
+    if (it->it_flags & ITEM_HDR) {
+        __atomic_fetch_sub(&emb_hdr_items[ITEM_clsid(it)], 1, __ATOMIC_RELAXED);
+    }
+
+    if ((it->it_flags & ITEM_EMB) == 0) {
+        emb_map_delete_entry(it, hv);
+    }
+}
+
+/*** NEAREST NEIGHBOUR INDEX ***/
+
+typedef struct {
+    item *it;
+    item_emb *ie;
+    float sim;
+} emb_ann_candidate;
+
+/* Cosine similarity of an item's vector to the unit vector q. Untrained
+ * vectors aren't normalized, so the item's side is scaled here. */
+static float emb_ann_similarity(item_emb *ie, const embedding *q) {
+    embedding work;
+    embedding *v = emb_load(ie, &work);
+    float mag = emb_kernels.dot(v->vec, v->vec);
+    if (!(mag > 0)) {
+        return -2.0f;
+    }
+    return emb_kernels.dot(v->vec, q->vec) / sqrtf(mag);
+}
+
+/* The EMB_ANN_PROBE lists whose centroids are nearest to q. */
+static int emb_ann_probe(const embedding *q, unsigned int *lists) {
+    if (!emb_ann_seeded) {
+        lists[0] = 0;
+        return 1;
+    }
+    const embedding *c = emb_ann_buf[emb_ann_cur];
+    float sims[EMB_ANN_PROBE];
+    int n = 0;
+    for (unsigned int l = 0; l < emb_ann_nlists; l++) {
+        float sim = emb_kernels.dot(c[l].vec, q->vec);
+        if (n == EMB_ANN_PROBE && sim <= sims[n - 1]) {
+            continue;
+        }
+        if (n < EMB_ANN_PROBE) {
+            n++;
+        }
+        int j;
+        for (j = n - 1; j > 0 && sims[j - 1] < sim; j--) {
+            lists[j] = lists[j - 1];
+            sims[j] = sims[j - 1];
+        }
+        lists[j] = l;
+        sims[j] = sim;
     }
+    return n;
+}
 
-    item        *victim = NULL;
-    uint32_t     victim_hv = 0;
-    float        worst_sim = 999.0f;
+int emb_ann_query(item *it, const embedding *vec, emb_neighbour *out,
+        int k, float max_dist) {
+    emb_thread *et = emb_thread_get();
+    embedding q;
+
+    if (it != NULL) {
+        item_lock(it->hv);
+        item_emb *ie = get_obj_emb(it, it->hv);
+        if (ie != NULL) {
+            embedding *v = emb_load(ie, &q);
+            if (v != &q) {
+                memcpy(&q, v, sizeof(embedding));
+            }
+        }
+        item_unlock(it->hv);
+        if (ie == NULL) {
+            return -1;
+        }
+    } else {
+        memcpy(&q, vec, sizeof(embedding));
+    }
+    float mag = emb_kernels.dot(q.vec, q.vec);
+    if (!(mag > 0) || isinf(mag)) {
+        return -1;
+    }
+    emb_kernels.normalize(q.vec);
+    if (k > EMB_ANN_MAX_K) {
+        k = EMB_ANN_MAX_K;
+    }
+    if (k <= 0 || et == &emb_shared_thread) {
+        return 0;
+    }
 
-    for (int i = 0; i < 32; i++) {
-        uint32_t idx = rand() % emb_valid_items_size;
-        item    *it  = emb_valid_items[idx];
+    /* Score the probed lists without locking them, keeping twice the
+     * candidates asked for in case some are gone by the time they are
+     * checked. */
+    emb_ann_candidate cand[EMB_ANN_MAX_K * 2];
+    int want = k * 2;
+    int ncand = 0;
+    uint64_t scanned = 0;
+    float min_sim = 1.0f - max_dist;
+    unsigned int lists[EMB_ANN_PROBE];
+
+    emb_epoch_enter(et);
+    int nlists = emb_ann_probe(&q, lists);
+    for (int i = 0; i < nlists; i++) {
+        emb_pool *list = &emb_ann_lists[lists[i]];
+        uint32_t size = __atomic_load_n(&list->size, __ATOMIC_ACQUIRE);
+        if (size == 0) {
+            continue;
+        }
+        emb_pool_array *arr = __atomic_load_n(&list->entries, __ATOMIC_ACQUIRE);
+        scanned += size;
+        for (uint32_t j = 0; j < size; j++) {
+            emb_pool_entry e = arr->e[j];
+            if (e.it == it) {
+                continue;
+            }
+            float sim = emb_ann_similarity(e.ie, &q);
+            if (!(sim >= min_sim)
+                    || (ncand == want && sim <= cand[ncand - 1].sim)) {
+                continue;
+            }
+            // an item being moved between lists can be seen twice
+            bool dup = false;
+            for (int c = 0; c < ncand; c++) {
+                dup |= cand[c].it == e.it;
+            }
+            if (dup) {
+                continue;
+            }
+            if (ncand < want) {
+                ncand++;
+            }
+            int c;
+            for (c = ncand - 1; c > 0 && cand[c - 1].sim < sim; c--) {
+                cand[c] = cand[c - 1];
+            }
+            cand[c].it = e.it;
+            cand[c].ie = e.ie;
+            cand[c].sim = sim;
+        }
+    }
 
-        uint32_t hv  = hash(ITEM_key(it), it->nkey);
-        embedding *e = get_obj_emb(it, hv);
+    // validated like the evictor's victims, then the key is copied out
+    int n = 0;
+    for (int i = 0; i < ncand && n < k; i++) {
+        item *nit = cand[i].it;
+        item_emb *ie = cand[i].ie;
+        uint32_t hv = ie->hv;
+        item_lock(hv);
+        if (__atomic_load_n(&ie->owner, __ATOMIC_ACQUIRE) == nit && ie->hv == hv
+                && (nit->it_flags & ITEM_LINKED)
+                && (nit->exptime == 0 || nit->exptime > current_time)
+                && !item_is_flushed(nit)) {
+            memcpy(out[n].key, ITEM_key(nit), nit->nkey);
+            out[n].nkey = nit->nkey;
+            out[n].binary = (nit->it_flags & ITEM_KEY_BINARY) != 0;
+            out[n].sim = cand[i].sim;
+            n++;
+        }
+        item_unlock(hv);
+    }
+    emb_epoch_leave(et);
+
+    __atomic_fetch_add(&emb_ann_queries, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&emb_ann_scanned, scanned, __ATOMIC_RELAXED);
+    return n;
+}
+
+/* A tracked item from a random non-empty list, with its vector copied out
+ * under the item lock. Each list gets an equal share of samples, so the
+ * centroids of small lists don't go stale. Must be in an epoch. */
+static bool emb_ann_sample(emb_thread *self, embedding *v) {
+    for (int tries = 0; tries < 8; tries++) {
+        emb_pool *list = &emb_ann_lists[emb_ann_seeded
+            ? mc_rng_bounded(&self->rng, emb_ann_nlists) : 0];
+        uint32_t size = __atomic_load_n(&list->size, __ATOMIC_ACQUIRE);
+        if (size == 0) {
+            continue;
+        }
+        emb_pool_array *arr = __atomic_load_n(&list->entries, __ATOMIC_ACQUIRE);
+        emb_pool_entry e = arr->e[mc_rng_bounded(&self->rng, size)];
+        uint32_t hv = e.ie->hv;
+        void *hold_lock = item_trylock(hv);
+        if (hold_lock == NULL) {
+            continue;
+        }
+        bool ok = __atomic_load_n(&e.ie->owner, __ATOMIC_ACQUIRE) == e.it
+            && e.ie->hv == hv;
+        if (ok) {
+            embedding *src = emb_load(e.ie, v);
+            if (src != v) {
+                memcpy(v, src, sizeof(embedding));
+            }
+        }
+        item_trylock_unlock(hold_lock);
+        if (ok) {
+            emb_kernels.normalize(v->vec);
+            return true;
+        }
+    }
+    return false;
+}
 
-        float sim = emb_compute_obj_similarity(e);
-        if (sim < worst_sim) {
-            victim     = it;
-            victim_hv  = hv;
-            worst_sim  = sim;
+/* Seed the centroids from sampled items once there are a few items per
+ * list, then refine them with mini-batch k-means. */
+static void emb_ann_train(emb_thread *self) {
+    embedding x;
+    if (!emb_ann_seeded) {
+        if (__atomic_load_n(&emb_ann_lists[0].size, __ATOMIC_ACQUIRE)
+                < emb_ann_nlists * 4) {
+            return;
+        }
+        for (unsigned int l = 0; l < emb_ann_nlists; l++) {
+            if (!emb_ann_sample(self, &emb_ann_km[l])) {
+                return;
+            }
+            emb_ann_count[l] = 1;
         }
+    } else {
+        for (int i = 0; i < EMB_ANN_TRAIN_SAMPLES; i++) {
+            if (!emb_ann_sample(self, &x)) {
+                continue;
+            }
+            unsigned int l = emb_ann_nearest(&x);
+            embedding *c = &emb_ann_km[l];
+            if (emb_ann_count[l] < EMB_ANN_MEMORY) {
+                emb_ann_count[l] += 1;
+            }
+            for (int j = 0; j < EMBEDDING_DIM; j++) {
+                c->vec[j] += (x.vec[j] - c->vec[j]) / emb_ann_count[l];
+            }
+            emb_kernels.normalize(c->vec);
+        }
+    }
+
+    int next = emb_ann_cur ^ 1;
+    memcpy(emb_ann_buf[next], emb_ann_km, sizeof(embedding) * emb_ann_nlists);
+    __sync_synchronize();
+    emb_ann_cur = next;
+    emb_ann_seeded = true;
+}
+
+/* Check the next EMB_ANN_REASSIGN list entries and move the ones whose
+ * nearest centroid changed. Must be in an epoch. */
+static void emb_ann_reassign(void) {
+    if (!emb_ann_seeded) {
+        return;
+    }
+    for (int n = 0; n < EMB_ANN_REASSIGN; n++) {
+        unsigned int l = emb_ann_cursor_list;
+        emb_pool *list = &emb_ann_lists[l];
+        uint32_t size = __atomic_load_n(&list->size, __ATOMIC_ACQUIRE);
+        if (emb_ann_cursor_pos >= size) {
+            emb_ann_cursor_list = (l + 1) % emb_ann_nlists;
+            emb_ann_cursor_pos = 0;
+            continue;
+        }
+        emb_pool_array *arr = __atomic_load_n(&list->entries, __ATOMIC_ACQUIRE);
+        emb_pool_entry e = arr->e[emb_ann_cursor_pos++];
+
+        uint32_t hv = e.ie->hv;
+        void *hold_lock = item_trylock(hv);
+        if (hold_lock == NULL) {
+            continue;
+        }
+        if (__atomic_load_n(&e.ie->owner, __ATOMIC_ACQUIRE) == e.it
+                && e.ie->hv == hv && e.ie->ann_list == l) {
+            embedding work;
+            if (emb_ann_nearest(emb_load(e.ie, &work)) != l) {
+                emb_ann_remove(e.ie);
+                emb_ann_add(e.it, e.ie);
+                // the list's tail was moved into this slot
+                emb_ann_cursor_pos--;
+                emb_ann_moved++;
+            }
+        }
+        item_trylock_unlock(hold_lock);
+    }
+}
+
+static void emb_ann_maintain(emb_thread *self) {
+    emb_epoch_enter(self);
+    emb_ann_train(self);
+    emb_ann_reassign();
+    emb_epoch_leave(self);
+}
+
+#ifdef EXTSTORE
+#define EMB_PREFETCH_SAMPLES 64
+/* most headers queued by one scan */
+#define EMB_PREFETCH_BATCH 8
+
+/* reads emb_prefetch_scan() may still queue, refilled at ext_prefetch_rate */
+static double emb_prefetch_budget = 0;
+/* client hits seen by the last scan */
+static uint64_t emb_prefetch_hits = 0;
+
+/* Relinks done by extstore and the slab mover train embeddings too, but only
+ * client hits say anything about what will be requested next. */
+static bool emb_prefetch_hits_seen(void) {
+    uint64_t hits = 0;
+    pthread_mutex_lock(&emb_thread_lock);
+    for (emb_thread *et = emb_thread_head; et != NULL; et = et->next) {
+        hits += __atomic_load_n(&et->hits, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&emb_thread_lock);
+    bool seen = hits != emb_prefetch_hits;
+    emb_prefetch_hits = hits;
+    return seen;
+}
+
+/* Find items on flash that the workload is about to want: sample the slab
+ * classes holding extstore headers and queue the headers that score best
+ * against the recent accesses, if they score better than the average RAM
+ * item sampled alongside them. Runs on the maintainer thread, only while
+ * clients are hitting items. */
+static void emb_prefetch_scan(emb_thread *self, useconds_t slept) {
+    unsigned int rate = settings.ext_prefetch_rate;
+    if (rate == 0 || ext_storage == NULL) {
+        emb_prefetch_budget = 0;
+        return;
+    }
+    // allow up to a second's worth of reads to build up
+    emb_prefetch_budget += (double)rate * slept / 1000000;
+    if (emb_prefetch_budget > rate) {
+        emb_prefetch_budget = rate;
+    }
+    if (emb_prefetch_budget < 1 || !emb_prefetch_hits_seen()) {
+        return;
+    }
+
+    unsigned int ids[MAX_NUMBER_OF_SLAB_CLASSES];
+    unsigned int nids = 0;
+    for (unsigned int id = 1; id < MAX_NUMBER_OF_SLAB_CLASSES; id++) {
+        if (__atomic_load_n(&emb_hdr_items[id], __ATOMIC_RELAXED) > 0) {
+            ids[nids++] = id;
+        }
+    }
+    if (nids == 0) {
+        return;
     }
 
-    if (victim == NULL) {                /* should never happen */
-        pthread_mutex_unlock(&emb_lock);
+    int want = emb_prefetch_budget < EMB_PREFETCH_BATCH
+        ? (int)emb_prefetch_budget : EMB_PREFETCH_BATCH;
+    emb_pool_entry best[EMB_PREFETCH_BATCH];
+    float best_sim[EMB_PREFETCH_BATCH];
+    int nbest = 0;
+    float ram_sim = 0;
+    int nram = 0;
+
+    emb_epoch_enter(self);
+    // the maintainer is the model's only writer, so it reads it in place
+    embedding *avg = &emb_avg;
+    emb_context *ctx = settings.emb_model == EMB_MODEL_SGNS ? &emb_ctx : NULL;
+    for (int i = 0; i < EMB_PREFETCH_SAMPLES; i++) {
+        emb_pool *pool = emb_pool_of(ids[mc_rng_bounded(&self->rng, nids)],
+            mc_rng_bounded(&self->rng, emb_nshards));
+        uint32_t size = __atomic_load_n(&pool->size, __ATOMIC_ACQUIRE);
+        if (size == 0) {
+            continue;
+        }
+        emb_pool_array *arr = __atomic_load_n(&pool->entries, __ATOMIC_ACQUIRE);
+        emb_pool_entry e = arr->e[mc_rng_bounded(&self->rng, size)];
+        float sim = emb_score(e.ie, avg, ctx);
+        if ((e.it->it_flags & ITEM_HDR) == 0) {
+            ram_sim += sim;
+            nram++;
+            continue;
+        }
+
+        // keep the top want headers, lowest last
+        bool dup = false;
+        for (int j = 0; j < nbest; j++) {
+            dup |= best[j].it == e.it;
+        }
+        if (dup || (nbest == want && sim <= best_sim[nbest - 1])) {
+            continue;
+        }
+        if (nbest < want) {
+            nbest++;
+        }
+        int j;
+        for (j = nbest - 1; j > 0 && best_sim[j - 1] < sim; j--) {
+            best[j] = best[j - 1];
+            best_sim[j] = best_sim[j - 1];
+        }
+        best[j] = e;
+        best_sim[j] = sim;
+    }
+
+    for (int i = 0; i < nbest; i++) {
+        if (nram == 0 || best_sim[i] <= ram_sim / nram) {
+            break;
+        }
+        // validated like the evictor's victims
+        item *it = best[i].it;
+        item_emb *ie = best[i].ie;
+        uint32_t hv = ie->hv;
+        void *hold_lock = item_trylock(hv);
+        if (hold_lock == NULL) {
+            continue;
+        }
+        if (__atomic_load_n(&ie->owner, __ATOMIC_ACQUIRE) == it && ie->hv == hv
+                && (it->it_flags & (ITEM_LINKED|ITEM_HDR)) == (ITEM_LINKED|ITEM_HDR)) {
+            storage_prefetch(it, hv);
+            emb_prefetch_budget -= 1;
+        }
+        item_trylock_unlock(hold_lock);
+    }
+    emb_epoch_leave(self);
+}
+#endif
+
+/*** EMBEDDING MAINTAINER THREAD ***/
+
+/* Fold the per-thread rolling averages into the global one. Each thread is
+ * weighted by how many accesses it recorded since the last merge (capped at
+ * its history length), so idle threads don't drag stale history along. */
+static void emb_merge_averages(void) {
+    embedding acc;
+    float total = 0;
+    memset(&acc, 0, sizeof(acc));
+
+    pthread_mutex_lock(&emb_thread_lock);
+    for (emb_thread *et = emb_thread_head; et != NULL; et = et->next) {
+        pthread_mutex_lock(&et->mutex);
+        uint64_t delta = et->updates - et->merged;
+        et->merged = et->updates;
+        if (delta > 0) {
+            float w = delta > EMB_HISTORY ? EMB_HISTORY : delta;
+            for (int i = 0; i < EMBEDDING_DIM; i++) {
+                acc.vec[i] += w * et->avg.vec[i];
+            }
+            total += w;
+        }
+        pthread_mutex_unlock(&et->mutex);
+    }
+    pthread_mutex_unlock(&emb_thread_lock);
+
+    if (total == 0) {
+        return;
+    }
+
+    emb_model_write_begin();
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        emb_avg.vec[i] = acc.vec[i] / total;
+    }
+    emb_model_write_end();
+}
+
+/* Move to the next epoch if every sampling thread has seen the current one,
+ * then free what was retired two epochs ago: nobody can still hold it. */
+static void emb_epoch_advance(void) {
+    embedding_map_slot *slots = NULL;
+    emb_pool_array *arrays = NULL;
+
+    pthread_mutex_lock(&emb_thread_lock);
+    uint64_t cur = emb_epoch;
+    for (emb_thread *et = emb_thread_head; et != NULL; et = et->next) {
+        uint64_t e = __atomic_load_n(&et->epoch, __ATOMIC_ACQUIRE);
+        if (e != 0 && e != cur) {
+            pthread_mutex_unlock(&emb_thread_lock);
+            return;
+        }
+    }
+    __atomic_store_n(&emb_epoch, cur + 1, __ATOMIC_SEQ_CST);
+
+    int old = (cur + 2) % 3;
+    for (emb_thread *et = emb_thread_head; et != NULL; et = et->next) {
+        pthread_mutex_lock(&et->mutex);
+        while (et->dead_slots[old] != NULL) {
+            embedding_map_slot *slot = et->dead_slots[old];
+            et->dead_slots[old] = slot->next;
+            slot->next = slots;
+            slots = slot;
+        }
+        while (et->dead_arrays[old] != NULL) {
+            emb_pool_array *arr = et->dead_arrays[old];
+            et->dead_arrays[old] = arr->next;
+            arr->next = arrays;
+            arrays = arr;
+        }
+        pthread_mutex_unlock(&et->mutex);
+    }
+    pthread_mutex_unlock(&emb_thread_lock);
+
+    while (slots != NULL) {
+        embedding_map_slot *next = slots->next;
+        free(slots);
+        slots = next;
+    }
+    while (arrays != NULL) {
+        emb_pool_array *next = arrays->next;
+        free(arrays);
+        arrays = next;
+    }
+}
+
+/* The item_emb a queued access should train, or NULL if the item has been
+ * unlinked since. The item may even have been freed and its memory reused,
+ * so only trust it if it still owns its item_emb under the same hv. The lock
+ * for hv must be held. */
+static item_emb *emb_access_emb(item *it, uint32_t hv) {
+    item_emb *ie;
+    if (settings.emb_inline) {
+        ie = (item_emb *) ITEM_emb(it);
+    } else {
+        embedding_map_slot *slot = emb_map_lookup(it, hv);
+        if (slot == NULL) {
+            return NULL;
+        }
+        ie = &slot->ie;
+    }
+    if (__atomic_load_n(&ie->owner, __ATOMIC_ACQUIRE) != it || ie->hv != hv) {
+        return NULL;
+    }
+    return ie;
+}
+
+/* Train a run of queued accesses. The trained vectors are folded into self's
+ * history a batch at a time so its mutex isn't taken per item. */
+static void emb_train_batch(emb_thread *self, emb_access *ea, unsigned int n) {
+    embedding trained[EMB_TRAIN_BATCH];
+    embedding *avg = &emb_avg;
+
+    while (n > 0) {
+        unsigned int batch = n < EMB_TRAIN_BATCH ? n : EMB_TRAIN_BATCH;
+        unsigned int done = 0;
+        for (unsigned int i = 0; i < batch; i++, ea++) {
+            item_lock(ea->hv);
+            item_emb *ie = emb_access_emb(ea->it, ea->hv);
+            if (ie != NULL) {
+                embedding *obj_emb = emb_train(ie, avg, &trained[done]);
+                if (obj_emb != &trained[done]) {
+                    memcpy(&trained[done], obj_emb, sizeof(embedding));
+                }
+                done++;
+            }
+            item_unlock(ea->hv);
+        }
+
+        pthread_mutex_lock(&self->mutex);
+        for (unsigned int i = 0; i < done; i++) {
+            emb_thread_update_avg(self, &trained[i]);
+        }
+        pthread_mutex_unlock(&self->mutex);
+        n -= batch;
+    }
+}
+
+/* Train one pair of vectors: towards each other if label is 1 (co-accessed),
+ * apart if it is 0 (a negative sample). */
+static inline void emb_sgns_pair(embedding *a, embedding *b, float label) {
+    float dot = emb_kernels.dot(a->vec, b->vec);
+    float g = EMB_SGNS_RATE * (label - 1.0f / (1.0f + expf(-EMB_SGNS_SCALE * dot)));
+    embedding a0 = *a;
+    emb_kernels.axpy(a->vec, g, b->vec);
+    emb_kernels.axpy(b->vec, g, a0.vec);
+}
+
+/* The active centroid closest to v, or the rolling avg if there are none. */
+static const embedding *emb_nearest_context(const embedding *v,
+        const embedding *avg, const emb_context *ctx) {
+    const embedding *best = avg;
+    float best_sim = -2.0f;
+    for (int k = 0; k < ctx->n; k++) {
+        float sim = emb_kernels.dot(v->vec, ctx->c[k].vec);
+        if (sim > best_sim) {
+            best = &ctx->c[k];
+            best_sim = sim;
+        }
+    }
+    return best;
+}
+
+/* Skip-gram with negative sampling over a run of one thread's accesses.
+ * Each access is a word and the EMB_SGNS_WINDOW accesses before it are its
+ * context. Negatives are drawn from the same run, which samples keys by
+ * popularity like word2vec's unigram table. Items have a single vector, used
+ * both as word and as context.
+ *
+ * Vectors are copied out under their item lock, trained as copies, and the
+ * change is added back under the lock, so only one item lock is ever held
+ * and repeated keys in a run all contribute. Like with emb_model=avg, the
+ * accessed item is also pulled towards its nearest context centroid, which
+ * is what keeps it scoring well while its phase is active. */
+static void emb_sgns_batch(emb_thread *self, emb_access *ea, unsigned int n) {
+    embedding orig[EMB_TRAIN_BATCH];
+    embedding cur[EMB_TRAIN_BATCH];
+    bool valid[EMB_TRAIN_BATCH];
+    uint64_t pairs = 0;
+    embedding *avg = &emb_avg;
+    emb_context *ctx = &emb_ctx;
+
+    while (n > 0) {
+        unsigned int batch = n < EMB_TRAIN_BATCH ? n : EMB_TRAIN_BATCH;
+        unsigned int nvalid = 0;
+        for (unsigned int i = 0; i < batch; i++) {
+            item_lock(ea[i].hv);
+            item_emb *ie = emb_access_emb(ea[i].it, ea[i].hv);
+            valid[i] = ie != NULL;
+            if (valid[i]) {
+                embedding *v = emb_load(ie, &orig[i]);
+                if (v != &orig[i]) {
+                    memcpy(&orig[i], v, sizeof(embedding));
+                }
+                cur[i] = orig[i];
+                nvalid++;
+            }
+            item_unlock(ea[i].hv);
+        }
+
+        for (unsigned int i = 0; nvalid > 1 && i < batch; i++) {
+            if (!valid[i]) {
+                continue;
+            }
+            unsigned int j = i > EMB_SGNS_WINDOW ? i - EMB_SGNS_WINDOW : 0;
+            for (; j < i; j++) {
+                if (valid[j] && ea[j].it != ea[i].it) {
+                    emb_sgns_pair(&cur[i], &cur[j], 1.0f);
+                    pairs++;
+                }
+            }
+            for (int k = 0; k < EMB_SGNS_NEGATIVE; k++) {
+                unsigned int r = mc_rng_bounded(&self->rng, batch);
+                if (valid[r] && ea[r].it != ea[i].it) {
+                    emb_sgns_pair(&cur[i], &cur[r], 0.0f);
+                }
+            }
+        }
+
+        unsigned int done = 0;
+        for (unsigned int i = 0; i < batch; i++) {
+            if (!valid[i]) {
+                continue;
+            }
+            item_lock(ea[i].hv);
+            item_emb *ie = emb_access_emb(ea[i].it, ea[i].hv);
+            if (ie != NULL) {
+                embedding work;
+                embedding *v = emb_load(ie, &work);
+                emb_kernels.axpy(v->vec, 1.0f, cur[i].vec);
+                emb_kernels.axpy(v->vec, -1.0f, orig[i].vec);
+                emb_kernels.axpy(v->vec, EMB_LEARNING_RATE,
+                        emb_nearest_context(v, avg, ctx)->vec);
+                emb_kernels.normalize(v->vec);
+                emb_store(ie, v);
+                // orig is done with, keep the result for the history
+                memcpy(&orig[done++], v, sizeof(embedding));
+            }
+            item_unlock(ea[i].hv);
+        }
+
+        pthread_mutex_lock(&self->mutex);
+        for (unsigned int i = 0; i < done; i++) {
+            emb_thread_update_avg(self, &orig[i]);
+        }
+        pthread_mutex_unlock(&self->mutex);
+        for (unsigned int i = 0; i < done; i++) {
+            emb_km_add(&orig[i]);
+        }
+
+        ea += batch;
+        n -= batch;
+    }
+    __atomic_fetch_add(&emb_sgns_pairs, pairs, __ATOMIC_RELAXED);
+}
+
+/* Drain every thread's train_buf. Returns the number of accesses seen.
+ * Threads can be created while holding an item lock, so emb_thread_lock must
+ * not be held while training; the list is only ever prepended to, so it can
+ * be walked from a snapshot of the head. */
+static unsigned int emb_train_queued(emb_thread *self) {
+    unsigned int drained = 0;
+    pthread_mutex_lock(&emb_thread_lock);
+    emb_thread *head = emb_thread_head;
+    pthread_mutex_unlock(&emb_thread_lock);
+    for (emb_thread *et = head; et != NULL; et = et->next) {
+        unsigned int size;
+        if (et->train_buf == NULL) {
+            continue;
+        }
+        pthread_mutex_lock(&et->mutex);
+        emb_access *ea = (emb_access *) bipbuf_peek_all(et->train_buf, &size);
+        pthread_mutex_unlock(&et->mutex);
+
+        if (ea == NULL) {
+            continue;
+        }
+        if (settings.emb_model == EMB_MODEL_SGNS) {
+            emb_sgns_batch(self, ea, size / sizeof(emb_access));
+        } else {
+            emb_train_batch(self, ea, size / sizeof(emb_access));
+        }
+        drained += size / sizeof(emb_access);
+
+        pthread_mutex_lock(&et->mutex);
+        bipbuf_poll(et->train_buf, size);
+        pthread_mutex_unlock(&et->mutex);
+    }
+    return drained;
+}
+
+/* How the victim scored against the current model. The item lock is held. */
+static bool emb_victim_score(item *it, const uint32_t hv, float *score) {
+    item_emb *ie = get_obj_emb(it, hv);
+    if (ie == NULL) {
         return false;
     }
+    embedding avg;
+    emb_context ctx;
+    bool sgns = settings.emb_model == EMB_MODEL_SGNS;
+    emb_read_model(&avg, sgns ? &ctx : NULL);
+    *score = emb_evict_score(it, ie, &avg, sgns ? &ctx : NULL);
+    return true;
+}
 
-    /* Hold an extra reference so the slab chunk stays valid
-       until we finish unlinking.                            */
-    refcount_incr(victim);
-
-    /* ---------- 2. outside emb_lock:  unlink safely ---------- */
-
-    /* Grab the per‑bucket item lock the same way lru_pull_tail does. */
-    void *bucket_lock = NULL;
-    if ((bucket_lock = item_trylock(victim_hv)) == NULL) {
-		pthread_mutex_unlock(&emb_lock);
-		return false;
-    }
-
-    /* Unlink from the cache; this will call emb_remove_item()
-       which updates the hashmap + sampling pool once.        */
-    do_item_unlink_nolock(victim, victim_hv);
-
-    /* Release bucket lock and our extra reference */
-    item_trylock_unlock(bucket_lock);
-    do_item_remove(victim);        /* drops the ref we added above */
-    pthread_mutex_unlock(&emb_lock);
-
-    return true;                   /* we evicted something */
-}
-
-void emb_remove_item_nolock(item* it, uint32_t hv) {
-	if (EMB_API_PRINT) {
-		fprintf(stderr, "[%lu] REMOVE ptr %p hash %x\n", (unsigned long) pthread_self(), (void*) it, hv);
-	}
-	// verify the state of hashmap/sample pool
-	if (EMB_ERR_PRINT) verify_pool_and_map();
-
-	if (EMB_DEBUG_PRINT) {
-		fprintf(stderr, "[EMBDEBUG] removing item key=%.*s\n", it->nkey, ITEM_key(it));
-	}
-	if (EMB_ERR_PRINT) {
-		uint32_t confirm_hv = hash(ITEM_key(it), it->nkey);
-		if (confirm_hv != hv) {
-			fprintf(stderr, "EMB_ERR: for pointer %p passed in hv=%x but recomputed=%x\n", (void*) it, hv, confirm_hv);
-			hv = confirm_hv;
-		}
-	}
-	// delete this item from the hashmap: look up its pos in the sampling pool
-	embedding_map_slot* slot = emb_map_lookup(it, hv);
-	if (slot == NULL || !slot->present) {
-		// we don't know about this item, so it's okay
-		// check through valid items
-		if (EMB_ERR_PRINT) {
-			for (int i = 0; i < emb_valid_items_size; i++) {
-				if (emb_valid_items[i] == it) {
-					fprintf(stderr, "EMB_ERR: called remove on obj ptr %p and it's not in map, but found it in slot %u\n", (void*) it, i);
-				}
-			}
-		}
-		if (EMB_ERR_PRINT) verify_pool_and_map();
-
-		return;
-	}
-	uint32_t sample_pool_idx = slot->sample_pool_idx;
-	if (EMB_DEBUG_PRINT) {
-		fprintf(stderr, "[EMBDEBUG] found sample pool idx=%u\n", sample_pool_idx);
-	}
-
-	// swap whatever is in the back with this thing
-
-	/*if (emb_valid_items_size == 1) {
-		if (emb_valid_items[0] != it) {
-			if (EMB_DEBUG_PRINT || EMB_ERR_PRINT) fprintf(stderr, "EMB_ERROR: only one valid item left! how did this happen\n");
-			abort();
-		}
-	}*/
-
-	if (EMB_ERR_PRINT && emb_valid_items[emb_valid_items_size - 1] == NULL) {
-		fprintf(stderr, "[EMB_ERR] trying to remove obj from slot %u and the tail is %u, has nullptr\n", sample_pool_idx, emb_valid_items_size-1);
-	}
-
-	// write the tail into the index of the removed item
-	if (EMB_ERR_PRINT && emb_valid_items[sample_pool_idx] != it) {
-		fprintf(stderr, "[EMB_ERR] trying to remove obj ptr %p and obj->slot = %u but emb_items has ptr %p\n", (void*) it, sample_pool_idx, (void*) emb_valid_items[sample_pool_idx]);
-	}
-	emb_valid_items[sample_pool_idx] = emb_valid_items[emb_valid_items_size - 1];
-	emb_valid_items[emb_valid_items_size - 1] = NULL;
-	emb_valid_items_size--;
-	slot->sample_pool_idx = (uint32_t) -1;
-
-	if (sample_pool_idx != emb_valid_items_size) {
-		// update the object's position in the map
-		item* shifted_it = emb_valid_items[sample_pool_idx];
-		uint32_t shifted_hv = hash(ITEM_key(shifted_it), shifted_it->nkey);
-		if (EMB_DEBUG_PRINT) {
-			fprintf(stderr, "[EMBDEBUG] swap with=%.*s\n", shifted_it->nkey, ITEM_key(shifted_it));
-		}
-		if (EMB_API_PRINT) {
-			fprintf(stderr, "[%lu] MOVE ptr %p hash %x from slot %u into %u\n", (unsigned long) pthread_self(), (void*) shifted_it, shifted_hv, emb_valid_items_size, sample_pool_idx);
-		}
-
-		embedding_map_slot* shifted_slot = emb_map_lookup(shifted_it, shifted_hv);
-		if (EMB_ERR_PRINT && shifted_slot == NULL) {
-			fprintf(stderr, "[EMB_ERR] removing item with hash %x from slot %u and putting item with hash %x from slot %u but tail item is not in map\n", hv, sample_pool_idx, shifted_hv, emb_valid_items_size - 1);
-			abort();
-		}
-		shifted_slot->sample_pool_idx = sample_pool_idx;
-	}
-
-	// now let's remove it from the hashmap
-	emb_map_delete_entry(it, hv);
-	if (EMB_ERR_PRINT) verify_pool_and_map();
+static uint64_t emb_pool_size(const unsigned int id) {
+    uint64_t size = 0;
+    for (unsigned int j = 0; j < emb_nshards; j++) {
+        size += __atomic_load_n(&emb_pool_of(id, j)->size, __ATOMIC_RELAXED);
+    }
+    return size;
 }
 
-void emb_remove_item(item* it, uint32_t hv) {
-	pthread_mutex_lock(&emb_lock);
-	emb_remove_item_nolock(it, hv);
-	pthread_mutex_unlock(&emb_lock);
+static void emb_total_evict_samples(uint64_t *samples, uint64_t *early,
+        uint64_t *reclaimed) {
+    *samples = 0;
+    *early = 0;
+    *reclaimed = 0;
+    pthread_mutex_lock(&emb_thread_lock);
+    for (emb_thread *et = emb_thread_head; et != NULL; et = et->next) {
+        *samples += __atomic_load_n(&et->evict_samples, __ATOMIC_RELAXED);
+        *early += __atomic_load_n(&et->evict_early, __ATOMIC_RELAXED);
+        *reclaimed += __atomic_load_n(&et->evict_reclaimed, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&emb_thread_lock);
 }
+
+static void emb_stats(ADD_STAT add_stats, void *c) {
+    uint64_t samples, early, reclaimed;
+    emb_total_evict_samples(&samples, &early, &reclaimed);
+    APPEND_STAT("emb_evict_samples", "%llu", (unsigned long long)samples);
+    APPEND_STAT("emb_evict_early", "%llu", (unsigned long long)early);
+    APPEND_STAT("emb_evict_reclaimed", "%llu", (unsigned long long)reclaimed);
+    if (settings.memory_file != NULL) {
+        APPEND_STAT("emb_restored_items", "%llu",
+                    (unsigned long long)emb_restored_items);
+    }
+    if (settings.emb_async_train) {
+        APPEND_STAT("emb_train_dropped", "%llu",
+                    (unsigned long long)emb_total_train_dropped());
+    }
+    if (settings.emb_model == EMB_MODEL_SGNS) {
+        APPEND_STAT("emb_sgns_pairs", "%llu", (unsigned long long)
+                    __atomic_load_n(&emb_sgns_pairs, __ATOMIC_RELAXED));
+        APPEND_STAT("emb_centroids", "%d",
+                    __atomic_load_n(&emb_ctx.n, __ATOMIC_RELAXED));
+    }
+    if (emb_ann_lists != NULL) {
+        APPEND_STAT("emb_ann_queries", "%llu", (unsigned long long)
+                    __atomic_load_n(&emb_ann_queries, __ATOMIC_RELAXED));
+        APPEND_STAT("emb_ann_scanned", "%llu", (unsigned long long)
+                    __atomic_load_n(&emb_ann_scanned, __ATOMIC_RELAXED));
+        APPEND_STAT("emb_ann_moved", "%llu", (unsigned long long)
+                    __atomic_load_n(&emb_ann_moved, __ATOMIC_RELAXED));
+    }
+}
+
+static pthread_t emb_maintainer_tid;
+static pthread_mutex_t emb_maintainer_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int do_run_emb_maintainer_thread = 0;
+
+/* How often thread-local averages are merged, in microseconds. */
+#define EMB_MERGE_INTERVAL 10000
+/* Shortest sleep while there are queued accesses to train. */
+#define EMB_TRAIN_MIN_SLEEP 100
+
+static void *emb_maintainer_thread(void *arg) {
+    useconds_t to_sleep = EMB_MERGE_INTERVAL;
+    emb_thread *self = emb_thread_get();
+
+    pthread_mutex_lock(&emb_maintainer_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Starting embedding maintainer thread\n");
+    while (do_run_emb_maintainer_thread) {
+        useconds_t slept = to_sleep;
+        pthread_mutex_unlock(&emb_maintainer_lock);
+        usleep(to_sleep);
+        pthread_mutex_lock(&emb_maintainer_lock);
+
+        // back off like the LRU maintainer: sleep less while busy.
+        if (settings.emb_async_train && emb_train_queued(self) > 0) {
+            to_sleep /= 2;
+            if (to_sleep < EMB_TRAIN_MIN_SLEEP)
+                to_sleep = EMB_TRAIN_MIN_SLEEP;
+        } else if (to_sleep < EMB_MERGE_INTERVAL) {
+            to_sleep *= 2;
+            if (to_sleep > EMB_MERGE_INTERVAL)
+                to_sleep = EMB_MERGE_INTERVAL;
+        }
+
+        emb_merge_averages();
+        if (settings.emb_model == EMB_MODEL_SGNS) {
+            emb_publish_context();
+        }
+        if (emb_ann_lists != NULL) {
+            emb_ann_maintain(self);
+        }
+#ifdef EXTSTORE
+        emb_prefetch_scan(self, slept);
+#endif
+        emb_epoch_advance();
+    }
+    pthread_mutex_unlock(&emb_maintainer_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Embedding maintainer thread stopping\n");
+
+    return NULL;
+}
+
+int stop_emb_maintainer_thread(void) {
+    int ret;
+    pthread_mutex_lock(&emb_maintainer_lock);
+    if (!do_run_emb_maintainer_thread) {
+        pthread_mutex_unlock(&emb_maintainer_lock);
+        return 0;
+    }
+    do_run_emb_maintainer_thread = 0;
+    pthread_mutex_unlock(&emb_maintainer_lock);
+    if ((ret = pthread_join(emb_maintainer_tid, NULL)) != 0) {
+        fprintf(stderr, "Failed to stop embedding maintainer thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+int start_emb_maintainer_thread(void) {
+    int ret;
+
+    pthread_mutex_lock(&emb_maintainer_lock);
+    do_run_emb_maintainer_thread = 1;
+    if ((ret = pthread_create(&emb_maintainer_tid, NULL,
+        emb_maintainer_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create embedding maintainer thread: %s\n",
+            strerror(ret));
+        do_run_emb_maintainer_thread = 0;
+        pthread_mutex_unlock(&emb_maintainer_lock);
+        return -1;
+    }
+    thread_setname(emb_maintainer_tid, "mc-embmaint");
+    pthread_mutex_unlock(&emb_maintainer_lock);
+
+    return 0;
+}
+
+evict_policy_t evict_policy_emb = {
+    .name = "emb",
+    .lru_segmented = false,
+    .init = emb_init,
+    .start = start_emb_maintainer_thread,
+    .stop = stop_emb_maintainer_thread,
+    .thread_init = emb_thread_create,
+    .on_link = emb_link_object,
+    .on_restore = emb_restore_object,
+    .on_access = emb_update_object,
+    .on_unlink = emb_remove_item,
+    .pick_victim = emb_evict_candidate,
+    .stats = emb_stats,
+    .victim_score = emb_victim_score,
+    .pool_size = emb_pool_size,
+};
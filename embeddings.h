@@ -1,19 +1,89 @@
 #ifndef EMBEDDING_H
 #define EMBEDDING_H
 
-#define EMBEDDING_DIM 16
+#include "emb_kernels.h"
+
 typedef struct {
 	float vec[EMBEDDING_DIM];
 } embedding;
 
+/* Storage format of item vectors, see -o emb_precision */
+enum emb_precision {
+    EMB_PRECISION_FP32 = 0,
+    EMB_PRECISION_FP16,
+    EMB_PRECISION_INT8,
+};
+
+/* How item vectors are trained, see -o emb_model */
+enum emb_model {
+    EMB_MODEL_AVG = 0,
+    EMB_MODEL_SGNS,
+};
+
+/* How the emb policy ranks eviction candidates, see -o emb_evict_score */
+enum emb_evict_score {
+    EMB_EVICT_SIM = 0,
+    EMB_EVICT_GDSF,
+};
+
+/* Per-item embedding state. Lives inside the item (at ITEM_emb()) when the
+ * item has ITEM_EMB set, otherwise in a side hash table. The stored vector,
+ * in settings.emb_precision format, immediately follows the header. */
+typedef struct {
+    item *owner;        /* item this is tracked for, NULL if untracked */
+    uint32_t pool_idx;  /* position in the slab class's sampling pool */
+    uint32_t hv;        /* owner's hash value, valid while owner is set */
+    uint32_t flags;     /* EMB_* below */
+    uint32_t ann_list;  /* nearest neighbour list it is filed in, if any */
+    uint32_t ann_idx;   /* position in that list */
+} item_emb;
+
+#define ITEM_EMB_VEC(ie) ((void *)((ie) + 1))
+
+/* the stored vector has been initialized, it is not leftover slab memory */
+#define EMB_VALID 1
+
+extern evict_policy_t evict_policy_emb;
+
 void emb_init(void);
+const char *emb_precision_str(void);
+const char *emb_model_str(void);
+const char *emb_evict_score_str(void);
+void emb_item_init(item *it);
+/* per worker thread embedding state, see emb_thread_create() */
+void *emb_thread_create(void);
 // indicate that an object was accessed
 void emb_update_object(item* it);
-void emb_query_embedding(item* it);
-bool emb_evict_candidate(void);
+
+/* Most neighbours one emb_ann_query() returns. */
+#define EMB_ANN_MAX_K 100
+/* Most lists -o emb_ann_lists can ask for. */
+#define EMB_ANN_MAX_LISTS 65536
+/* Sampling pools per slab class (-o emb_shards), a power of two. */
+#define EMB_DEFAULT_SHARDS 16
+#define EMB_MAX_SHARDS 1024
+
+/* One result of emb_ann_query(). */
+typedef struct {
+    char key[KEY_MAX_LENGTH];
+    uint8_t nkey;
+    bool binary;    /* key is ITEM_KEY_BINARY */
+    float sim;      /* cosine similarity to the query */
+} emb_neighbour;
+
+/* Find up to k items whose vectors are most similar to the vector of it, or
+ * to vec if it is NULL, and at most max_dist cosine distance away. it must
+ * be referenced by the caller and is not returned itself. Returns the number
+ * of neighbours written to out, or -1 if there is nothing to query with.
+ * Requires -o emb_ann_lists. */
+int emb_ann_query(item *it, const embedding *vec, emb_neighbour *out,
+        int k, float max_dist);
+int emb_evict_candidate(const unsigned int id);
 void emb_remove_item(item* it, uint32_t hv);
 
+int start_emb_maintainer_thread(void);
+int stop_emb_maintainer_thread(void);
+
 #define EMB_DEBUG_PRINT 0
-#define USE_EMBEDDING_EVICT 1
 
 #endif
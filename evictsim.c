@@ -0,0 +1,345 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * evictsim: replay a key trace against the server's own item, slab, hash
+ * table and eviction policy code, without the network in the way.
+ *
+ * The trace is read once, then each (policy, memory size) pair runs in a
+ * forked child: the child goes through the normal memcached startup with
+ * "-m <size> -o evict_policy=<policy>" plus any extra options, and where
+ * the server would open its sockets it replays the trace instead (see
+ * evictsim_replay()). Every request is a get; misses are followed by a set
+ * of the traced size, like benchmark_scripts/fast_trace_clients.cpp.
+ *
+ * Trace lines are "timestamp key size [...]", whitespace separated.
+ * Timestamps drive the server clock, so they should be in seconds.
+ */
+#include "memcached.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+typedef struct {
+    uint64_t key;       /* offset into sim_keys */
+    uint32_t size;      /* value bytes */
+    uint32_t ts;        /* seconds since the first request */
+    uint8_t nkey;
+} sim_op;
+
+static sim_op *sim_ops = NULL;
+static uint64_t sim_nops = 0;
+static char *sim_keys = NULL;
+static uint64_t sim_keys_len = 0;
+static bool sim_verbose = false;
+
+static void usage(void) {
+    printf("usage: evictsim -t <trace> [-p <policy,...>] [-m <megabytes,...>] [-v]\n"
+           "                [-- <memcached options>]\n"
+           "   -t <file>    trace of \"timestamp key size\" lines\n"
+           "   -p <list>    eviction policies to compare (default: lru,segmented,emb,tinylfu)\n"
+           "   -m <list>    cache sizes in megabytes (default: 64)\n"
+           "   -v           also print the policy's own stats\n"
+           "Options after -- are passed to every simulated server.\n");
+}
+
+static bool load_trace(const char *file) {
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        perror(file);
+        return false;
+    }
+
+    uint64_t ops_cap = 1024 * 1024;
+    uint64_t keys_cap = 16 * 1024 * 1024;
+    sim_ops = malloc(ops_cap * sizeof(sim_op));
+    sim_keys = malloc(keys_cap);
+    if (sim_ops == NULL || sim_keys == NULL) {
+        fprintf(stderr, "Failed to allocate trace buffers\n");
+        fclose(f);
+        return false;
+    }
+
+    char line[2048];
+    double first_ts = -1;
+    uint64_t skipped = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *save = NULL;
+        char *ts_s = strtok_r(line, " \t\r\n", &save);
+        char *key = strtok_r(NULL, " \t\r\n", &save);
+        char *size_s = strtok_r(NULL, " \t\r\n", &save);
+        if (ts_s == NULL || key == NULL || size_s == NULL) {
+            skipped++;
+            continue;
+        }
+        size_t nkey = strlen(key);
+        double ts = strtod(ts_s, NULL);
+        long long size = strtoll(size_s, NULL, 10);
+        if (nkey > KEY_MAX_LENGTH || size < 0 || size > INT_MAX - 2) {
+            skipped++;
+            continue;
+        }
+
+        if (sim_nops == ops_cap) {
+            ops_cap *= 2;
+            sim_op *ops = realloc(sim_ops, ops_cap * sizeof(sim_op));
+            if (ops == NULL) {
+                fprintf(stderr, "Failed to grow trace buffer\n");
+                fclose(f);
+                return false;
+            }
+            sim_ops = ops;
+        }
+        if (sim_keys_len + nkey > keys_cap) {
+            keys_cap *= 2;
+            char *keys = realloc(sim_keys, keys_cap);
+            if (keys == NULL) {
+                fprintf(stderr, "Failed to grow trace key buffer\n");
+                fclose(f);
+                return false;
+            }
+            sim_keys = keys;
+        }
+
+        if (first_ts < 0) {
+            first_ts = ts;
+        }
+        sim_op *op = &sim_ops[sim_nops++];
+        op->key = sim_keys_len;
+        op->nkey = nkey;
+        op->size = size;
+        op->ts = ts > first_ts ? (uint32_t)(ts - first_ts) : 0;
+        memcpy(sim_keys + sim_keys_len, key, nkey);
+        sim_keys_len += nkey;
+    }
+    fclose(f);
+
+    if (skipped) {
+        fprintf(stderr, "evictsim: skipped %llu malformed trace lines\n",
+                (unsigned long long)skipped);
+    }
+    return true;
+}
+
+/* Large items are written chunk by chunk, as read_into_chunked_item() does
+ * when the value arrives over the network. */
+static bool fill_chunks(item *it) {
+    item_chunk *ch = (item_chunk *) ITEM_schunk(it);
+    int remain = it->nbytes;
+    while (remain > 0) {
+        if (ch->size == ch->used) {
+            ch = do_item_alloc_chunk(ch, remain);
+            if (ch == NULL) {
+                return false;
+            }
+        }
+        int len = ch->size - ch->used;
+        if (len > remain) {
+            len = remain;
+        }
+        ch->used += len;
+        remain -= len;
+    }
+    return true;
+}
+
+static void print_stat(const char *key, const uint16_t klen,
+                       const char *val, const uint32_t vlen,
+                       const void *cookie) {
+    if (klen > 0) {
+        printf("    %.*s %.*s\n", klen, key, vlen, val);
+    }
+}
+
+static void find_evictions(const char *key, const uint16_t klen,
+                           const char *val, const uint32_t vlen,
+                           const void *cookie) {
+    if (klen == strlen("evictions") && memcmp(key, "evictions", klen) == 0) {
+        *(uint64_t *)cookie = strtoull(val, NULL, 10);
+    }
+}
+
+/* Called by the simulated server in place of opening its sockets. */
+int evictsim_replay(void) {
+    LIBEVENT_THREAD t;
+    memset(&t, 0, sizeof(t));
+    pthread_mutex_init(&t.stats.mutex, NULL);
+    t.l = GET_LOGGER(); /* made for this thread by memcached_main() */
+    t.lru_bump_buf = item_lru_bump_buf_create();
+    if (t.l == NULL || t.lru_bump_buf == NULL) {
+        fprintf(stderr, "Failed to set up the replay thread\n");
+        return 1;
+    }
+    if (evict_policy->thread_init) {
+        t.evict_thread = evict_policy->thread_init();
+    }
+
+    uint64_t hits = 0, hit_bytes = 0, total_bytes = 0, failed = 0;
+    rel_time_t start_time = current_time;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (uint64_t i = 0; i < sim_nops; i++) {
+        sim_op *op = &sim_ops[i];
+        const char *key = sim_keys + op->key;
+        if (start_time + op->ts > current_time) {
+            current_time = start_time + op->ts;
+        }
+        total_bytes += op->size;
+
+        item *it = item_get(key, op->nkey, &t, DO_UPDATE);
+        if (it != NULL) {
+            hits++;
+            hit_bytes += op->size;
+            item_remove(it);
+            continue;
+        }
+
+        it = item_alloc(key, op->nkey, 0, 0, op->size + 2);
+        if (it == NULL) {
+            failed++;
+            continue;
+        }
+        if ((it->it_flags & ITEM_CHUNKED) == 0) {
+            memcpy(ITEM_data(it) + op->size, "\r\n", 2);
+        } else if (!fill_chunks(it)) {
+            item_remove(it);
+            failed++;
+            continue;
+        }
+        int nbytes = it->nbytes;
+        uint64_t cas = 0;
+        if (store_item(it, NREAD_SET, &t, &nbytes, &cas, 0, false) != STORED) {
+            failed++;
+        }
+        item_remove(it);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    uint64_t evictions = 0;
+    item_stats_totals(find_evictions, &evictions);
+
+    printf("%-10s %8llu %12llu %10.4f %14.4f %12llu %10llu %12.0f\n",
+            evict_policy->name,
+            (unsigned long long)(settings.maxbytes / (1024 * 1024)),
+            (unsigned long long)sim_nops,
+            sim_nops ? (double)hits / sim_nops : 0.0,
+            total_bytes ? (double)hit_bytes / total_bytes : 0.0,
+            (unsigned long long)evictions,
+            (unsigned long long)failed,
+            secs > 0 ? sim_nops / secs : 0.0);
+    if (sim_verbose && evict_policy->stats) {
+        evict_policy->stats(print_stat, NULL);
+    }
+    fflush(stdout);
+    return 0;
+}
+
+static int run_one(const char *policy, const char *mb, int nextra, char **extra) {
+    char policy_opt[128];
+    snprintf(policy_opt, sizeof(policy_opt), "evict_policy=%s", policy);
+
+    char **argv = calloc(nextra + 8, sizeof(char *));
+    if (argv == NULL) {
+        return 1;
+    }
+    int argc = 0;
+    argv[argc++] = "evictsim";
+    argv[argc++] = "-m";
+    argv[argc++] = (char *)mb;
+    argv[argc++] = "-o";
+    argv[argc++] = policy_opt;
+    if (geteuid() == 0) {
+        argv[argc++] = "-u";
+        argv[argc++] = "root";
+    }
+    for (int i = 0; i < nextra; i++) {
+        argv[argc++] = extra[i];
+    }
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        free(argv);
+        return 1;
+    }
+    if (pid == 0) {
+        optind = 1; /* memcached_main() runs its own getopt */
+        exit(memcached_main(argc, argv));
+    }
+    free(argv);
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "evictsim: run of %s with %sMB failed\n", policy, mb);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *trace = NULL;
+    char *policies = strdup("lru,segmented,emb,tinylfu");
+    char *sizes = strdup("64");
+    int c;
+
+    while ((c = getopt(argc, argv, "t:p:m:vh")) != -1) {
+        switch (c) {
+        case 't':
+            trace = optarg;
+            break;
+        case 'p':
+            free(policies);
+            policies = strdup(optarg);
+            break;
+        case 'm':
+            free(sizes);
+            sizes = strdup(optarg);
+            break;
+        case 'v':
+            sim_verbose = true;
+            break;
+        case 'h':
+            usage();
+            return EXIT_SUCCESS;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (trace == NULL || policies == NULL || sizes == NULL) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (!load_trace(trace)) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s %8s %12s %10s %14s %12s %10s %12s\n", "policy", "mem_mb",
+            "ops", "hit_ratio", "byte_hit_ratio", "evictions", "failed",
+            "ops_per_sec");
+
+    int failures = 0;
+    char *psave = NULL;
+    for (char *p = strtok_r(policies, ",", &psave); p != NULL;
+            p = strtok_r(NULL, ",", &psave)) {
+        /* sizes is tokenized again for every policy, so work on a copy */
+        char *sizes_copy = strdup(sizes);
+        char *msave = NULL;
+        for (char *m = strtok_r(sizes_copy, ",", &msave); m != NULL;
+                m = strtok_r(NULL, ",", &msave)) {
+            failures += run_one(p, m, argc - optind, argv + optind);
+        }
+        free(sizes_copy);
+    }
+
+    free(policies);
+    free(sizes);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
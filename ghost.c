@@ -0,0 +1,91 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Ghost list of evicted item hashes. See ghost.h.
+ */
+#include <stdlib.h>
+#include <pthread.h>
+#include "ghost.h"
+
+#define GHOST_MIN_SIZE 64
+#define GHOST_MAX_SIZE (1U << 28)
+#define GHOST_LOCKS 256
+
+typedef struct {
+    uint32_t hv;
+    bool used;
+    ghost_entry e;
+} ghost_slot;
+
+struct ghost_list {
+    ghost_slot *slots;
+    uint32_t mask;
+    pthread_mutex_t locks[GHOST_LOCKS];
+};
+
+ghost_list *ghost_list_new(uint32_t size) {
+    uint32_t s = GHOST_MIN_SIZE;
+    while (s < size && s < GHOST_MAX_SIZE) {
+        s <<= 1;
+    }
+
+    ghost_list *g = calloc(1, sizeof(*g));
+    if (g == NULL) {
+        return NULL;
+    }
+    g->slots = calloc(s, sizeof(ghost_slot));
+    if (g->slots == NULL) {
+        free(g);
+        return NULL;
+    }
+    g->mask = s - 1;
+    for (int i = 0; i < GHOST_LOCKS; i++) {
+        pthread_mutex_init(&g->locks[i], NULL);
+    }
+    return g;
+}
+
+void ghost_list_free(ghost_list *g) {
+    if (g == NULL) {
+        return;
+    }
+    for (int i = 0; i < GHOST_LOCKS; i++) {
+        pthread_mutex_destroy(&g->locks[i]);
+    }
+    free(g->slots);
+    free(g);
+}
+
+uint32_t ghost_list_size(ghost_list *g) {
+    return g->mask + 1;
+}
+
+/* The item lock table is indexed by the low bits of hv; using the high bits
+ * here keeps items that share an item lock from crowding one ghost slot. */
+static inline uint32_t ghost_slot_idx(ghost_list *g, const uint32_t hv) {
+    return ((hv >> 16) | (hv << 16)) & g->mask;
+}
+
+void ghost_list_add(ghost_list *g, const uint32_t hv, const ghost_entry *e) {
+    uint32_t idx = ghost_slot_idx(g, hv);
+    pthread_mutex_t *lock = &g->locks[idx % GHOST_LOCKS];
+    pthread_mutex_lock(lock);
+    g->slots[idx].hv = hv;
+    g->slots[idx].used = true;
+    g->slots[idx].e = *e;
+    pthread_mutex_unlock(lock);
+}
+
+bool ghost_list_take(ghost_list *g, const uint32_t hv, ghost_entry *e) {
+    uint32_t idx = ghost_slot_idx(g, hv);
+    ghost_slot *slot = &g->slots[idx];
+    bool found = false;
+    pthread_mutex_t *lock = &g->locks[idx % GHOST_LOCKS];
+    pthread_mutex_lock(lock);
+    if (slot->used && slot->hv == hv) {
+        *e = slot->e;
+        slot->used = false;
+        found = true;
+    }
+    pthread_mutex_unlock(lock);
+    return found;
+}
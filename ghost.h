@@ -0,0 +1,32 @@
+#ifndef GHOST_H
+#define GHOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Ghost list: the hashes of recently evicted items, so a later miss on one
+ * can be told apart from a miss on a key that was never cached.
+ *
+ * A fixed size, direct mapped table keyed by the 32-bit item hash. A newer
+ * eviction replaces whatever was in its slot, so the list remembers roughly
+ * its size worth of the most recent evictions. Slots are guarded by striped
+ * locks, so it is safe to use from any thread.
+ */
+typedef struct ghost_list ghost_list;
+
+typedef struct {
+    uint32_t time;      /* when the item was evicted */
+    uint8_t clsid;      /* slab class it was evicted from */
+    bool has_score;     /* the policy scored the victim */
+    float score;        /* that score, if has_score */
+} ghost_entry;
+
+/* size is rounded up to a power of two. Returns NULL on allocation failure. */
+ghost_list *ghost_list_new(uint32_t size);
+void ghost_list_free(ghost_list *g);
+uint32_t ghost_list_size(ghost_list *g);
+void ghost_list_add(ghost_list *g, const uint32_t hv, const ghost_entry *e);
+/* If hv is remembered, forget it and return true with its entry in e. */
+bool ghost_list_take(ghost_list *g, const uint32_t hv, ghost_entry *e);
+
+#endif
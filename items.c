@@ -4,6 +4,8 @@
 #include "storage.h"
 #include "slabs_mover.h"
 #include "embeddings.h"
+#include "tinylfu.h"
+#include "ghost.h"
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/resource.h>
@@ -20,6 +22,7 @@
 /* Forward Declarations */
 static void item_link_q(item *it);
 static void item_unlink_q(item *it);
+static void item_ghost_stats_reset(void);
 
 static unsigned int lru_type_map[4] = {HOT_LRU, WARM_LRU, COLD_LRU, TEMP_LRU};
 
@@ -45,6 +48,11 @@ typedef struct {
     uint64_t hits_to_cold;
     uint64_t hits_to_temp;
     uint64_t mem_requested;
+    uint64_t victim_scored;     /* victims the policy gave a score */
+    uint64_t ghost_hits;        /* misses on items evicted from here */
+    uint64_t ghost_hit_scored;
+    double victim_score_sum;
+    double ghost_hit_score_sum; /* scores of victims that were missed */
     rel_time_t evicted_time;
 } itemstats_t;
 
@@ -68,6 +76,7 @@ void item_stats_reset(void) {
         memset(&itemstats[i], 0, sizeof(itemstats_t));
         pthread_mutex_unlock(&lru_locks[i]);
     }
+    item_ghost_stats_reset();
 }
 
 /* called with class lru lock held */
@@ -100,6 +109,197 @@ static pthread_mutex_t bump_buf_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool lru_bump_async(lru_bump_buf *b, item *it, uint32_t hv);
 static uint64_t lru_total_bumps_dropped(void);
 
+/* The LRU policies need no hooks: LRU upkeep is built into items.c. */
+static evict_policy_t evict_policy_lru = {
+    .name = "lru",
+    .lru_segmented = false,
+};
+
+static evict_policy_t evict_policy_segmented = {
+    .name = "segmented",
+    .lru_segmented = true,
+};
+
+/* W-TinyLFU: new items sit in a small window (HOT_LRU, kept in recency
+ * order). When the window is over its share of the class, its tail competes
+ * with the tail of the main cache (COLD_LRU): whichever key the frequency
+ * sketch has seen less often is evicted, and a winning window item moves
+ * into the main cache. One-hit-wonders thus never push out popular items.
+ */
+static tinylfu_sketch *tinylfu = NULL;
+static pthread_mutex_t tinylfu_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t tinylfu_admitted = 0;
+static uint64_t tinylfu_rejected = 0;
+
+static void tinylfu_init(void) {
+    /* About one counter column per item, assuming items of ~1KB. */
+    tinylfu = tinylfu_sketch_new(settings.maxbytes / 1024);
+    if (tinylfu == NULL) {
+        fprintf(stderr, "Failed to allocate tinylfu sketch\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void tinylfu_link(item *it, const uint32_t hv) {
+    tinylfu_sketch_add(tinylfu, hv);
+}
+
+static void tinylfu_access(item *it) {
+    tinylfu_sketch_add(tinylfu, it->hv);
+}
+
+/* Lock and reference the first usable item from the tail of an LRU, as
+ * lru_pull_tail() does for LRU_PULL_RETURN_ITEM. */
+static bool lru_hold_tail(const int id, struct lru_pull_tail_return *ret) {
+    int tries = 5;
+    item *search;
+    pthread_mutex_lock(&lru_locks[id]);
+    for (search = tails[id]; tries > 0 && search != NULL; tries--, search = search->prev) {
+        if (search->nbytes == 0 && search->nkey == 0 && search->it_flags == 1) {
+            /* We are a crawler, ignore it. */
+            tries++;
+            continue;
+        }
+        uint32_t hv = search->hv;
+        void *hold_lock;
+        if ((hold_lock = item_trylock(hv)) == NULL)
+            continue;
+        if (refcount_incr(search) != 2) {
+            refcount_decr(search);
+            item_trylock_unlock(hold_lock);
+            continue;
+        }
+        ret->it = search;
+        ret->hv = hv;
+        pthread_mutex_unlock(&lru_locks[id]);
+        return true;
+    }
+    pthread_mutex_unlock(&lru_locks[id]);
+    return false;
+}
+
+/* Move a window item to the head of the main cache. */
+static void tinylfu_admit(item *it) {
+    item_unlink_q(it);
+    it->slabs_clsid = ITEM_clsid(it) | COLD_LRU;
+    item_link_q(it);
+}
+
+/* Most window items moved into the main cache per eviction while filling */
+#define TINYLFU_FILL_BATCH 64
+
+static int tinylfu_pick_victim(const unsigned int id) {
+    struct lru_pull_tail_return cand = {NULL, 0};
+    struct lru_pull_tail_return victim = {NULL, 0};
+    uint64_t window_bytes, main_bytes;
+    int pct = settings.tinylfu_window_pct;
+
+    pthread_mutex_lock(&lru_locks[id|HOT_LRU]);
+    window_bytes = sizes_bytes[id|HOT_LRU];
+    pthread_mutex_unlock(&lru_locks[id|HOT_LRU]);
+    pthread_mutex_lock(&lru_locks[id|COLD_LRU]);
+    main_bytes = sizes_bytes[id|COLD_LRU];
+    pthread_mutex_unlock(&lru_locks[id|COLD_LRU]);
+
+    /* A window far over its share means the cache only just filled, or
+     * items were freed rather than evicted: move window items straight into
+     * the main cache, as if it had had room for them. */
+    for (int i = 0; i < TINYLFU_FILL_BATCH
+            && window_bytes * 100 > (window_bytes + main_bytes) * pct * 2; i++) {
+        if (!lru_hold_tail(id|HOT_LRU, &cand)) {
+            break;
+        }
+        size_t ntotal = ITEM_ntotal(cand.it);
+        tinylfu_admit(cand.it);
+        do_item_remove(cand.it);
+        item_unlock(cand.hv);
+        window_bytes = window_bytes > ntotal ? window_bytes - ntotal : 0;
+        main_bytes += ntotal;
+    }
+
+    /* Window within its share: the main cache's LRU tail goes, which is
+     * what the caller does when we return 0. */
+    if (window_bytes * 100 <= (window_bytes + main_bytes) * pct) {
+        return 0;
+    }
+    if (!lru_hold_tail(id|HOT_LRU, &cand)) {
+        return 0;
+    }
+
+    if (lru_hold_tail(id|COLD_LRU, &victim)) {
+        if (tinylfu_sketch_estimate(tinylfu, cand.hv)
+                > tinylfu_sketch_estimate(tinylfu, victim.hv)) {
+            tinylfu_admit(cand.it);
+            pthread_mutex_lock(&tinylfu_stats_lock);
+            tinylfu_admitted++;
+            pthread_mutex_unlock(&tinylfu_stats_lock);
+        } else {
+            struct lru_pull_tail_return keep = victim;
+            victim = cand;
+            cand = keep;
+            pthread_mutex_lock(&tinylfu_stats_lock);
+            tinylfu_rejected++;
+            pthread_mutex_unlock(&tinylfu_stats_lock);
+        }
+        do_item_remove(cand.it);
+        item_unlock(cand.hv);
+    } else {
+        /* Main cache empty or its tail is busy. */
+        victim = cand;
+    }
+
+    do_item_evict(victim.it, victim.hv);
+    do_item_remove(victim.it);
+    item_unlock(victim.hv);
+    return 1;
+}
+
+static void tinylfu_stats(ADD_STAT add_stats, void *c) {
+    pthread_mutex_lock(&tinylfu_stats_lock);
+    APPEND_STAT("tinylfu_admitted", "%llu", (unsigned long long)tinylfu_admitted);
+    APPEND_STAT("tinylfu_rejected", "%llu", (unsigned long long)tinylfu_rejected);
+    pthread_mutex_unlock(&tinylfu_stats_lock);
+    APPEND_STAT("tinylfu_resets", "%llu",
+            (unsigned long long)tinylfu_sketch_resets(tinylfu));
+}
+
+/* A victim's estimated access frequency. */
+static bool tinylfu_victim_score(item *it, const uint32_t hv, float *score) {
+    *score = tinylfu_sketch_estimate(tinylfu, hv);
+    return true;
+}
+
+static evict_policy_t evict_policy_tinylfu = {
+    .name = "tinylfu",
+    .lru_segmented = false,
+    .lru_window = true,
+    .init = tinylfu_init,
+    .on_link = tinylfu_link,
+    .on_access = tinylfu_access,
+    .pick_victim = tinylfu_pick_victim,
+    .stats = tinylfu_stats,
+    .victim_score = tinylfu_victim_score,
+};
+
+static evict_policy_t *evict_policies[] = {
+    &evict_policy_lru,
+    &evict_policy_segmented,
+    &evict_policy_emb,
+    &evict_policy_tinylfu,
+};
+
+/* Chosen with -o evict_policy, or from the LRU settings if not given. */
+evict_policy_t *evict_policy = NULL;
+
+evict_policy_t *evict_policy_find(const char *name) {
+    for (int i = 0; i < sizeof(evict_policies) / sizeof(evict_policies[0]); i++) {
+        if (strcmp(evict_policies[i]->name, name) == 0) {
+            return evict_policies[i];
+        }
+    }
+    return NULL;
+}
+
 /* Get the next CAS id for a new item. */
 /* TODO: refactor some atomics for this. */
 uint64_t get_cas_id(void) {
@@ -170,41 +370,32 @@ item *do_item_alloc_pull(const size_t ntotal, const unsigned int id) {
      * This also gives one fewer code path for slab alloc/free
      */
     for (i = 0; i < 25; i++) {
-        /* Try to reclaim memory first */
-        if (!settings.lru_segmented) {
-            //lru_pull_tail(id, COLD_LRU, 0, 0, 0, NULL);
+        /* Try to reclaim memory first. Only useful if the LRU is in
+         * recency order. */
+        if (!settings.lru_segmented
+                && (evict_policy->on_access == NULL || evict_policy->lru_window)) {
+            lru_pull_tail(id, COLD_LRU, 0, 0, 0, NULL);
         }
         it = slabs_alloc(id, 0);
 
         if (it == NULL) {
-			// EMB_DEBUG: modifying this to use our eviction policy
-			if (EMB_DEBUG_PRINT) {
-				fprintf(stderr, "[EMB_DEBUG] looking for eviction candidates\n");
-			}
-
-			if (USE_EMBEDDING_EVICT) {
-
-				//pthread_mutex_lock(&lru_locks[id | COLD_LRU]);
-
-				emb_evict_candidate();
-
-				//pthread_mutex_unlock(&lru_locks[id | COLD_LRU]);
-
-				if (settings.slab_automove == 2) {
-					//slabs_reassign(settings.slab_rebal, -1, id, SLABS_REASSIGN_ALLOW_EVICTIONS);
-				}
-			} else {
-				// We send '0' in for "total_bytes" as this routine is always
-				// pulling to evict, or forcing HOT -> COLD migration.
-				// As of this writing, total_bytes isn't at all used with COLD_LRU.
-				if (lru_pull_tail(id, COLD_LRU, 0, LRU_PULL_EVICT, 0, NULL) <= 0) {
-					if (settings.lru_segmented) {
-						lru_pull_tail(id, HOT_LRU, 0, 0, 0, NULL);
-					} else {
-						break;
-					}
-				}
-			}
+            /* Let the policy pick a victim. If it found nothing it could
+             * evict (empty, or the victim was busy), fall back to the LRU
+             * tail so we don't spin until OOM. */
+            if (evict_policy->pick_victim && settings.evict_to_free
+                    && evict_policy->pick_victim(id) > 0) {
+                continue;
+            }
+            // We send '0' in for "total_bytes" as this routine is always
+            // pulling to evict, or forcing HOT -> COLD migration.
+            // As of this writing, total_bytes isn't at all used with COLD_LRU.
+            if (lru_pull_tail(id, COLD_LRU, 0, LRU_PULL_EVICT, 0, NULL) <= 0) {
+                if (settings.lru_segmented) {
+                    lru_pull_tail(id, HOT_LRU, 0, 0, 0, NULL);
+                } else {
+                    break;
+                }
+            }
         } else {
             break;
         }
@@ -278,6 +469,9 @@ item *do_item_alloc(const char *key, const size_t nkey, const client_flags_t fla
     if (settings.use_cas) {
         ntotal += sizeof(uint64_t);
     }
+    if (settings.emb_inline) {
+        ntotal += settings.emb_item_size;
+    }
 
     unsigned int id = slabs_clsid(ntotal);
     unsigned int hdr_id = 0;
@@ -296,6 +490,9 @@ item *do_item_alloc(const char *key, const size_t nkey, const client_flags_t fla
         if (settings.use_cas) {
             htotal += sizeof(uint64_t);
         }
+        if (settings.emb_inline) {
+            htotal += settings.emb_item_size;
+        }
 #ifdef NEED_ALIGN
         // header chunk needs to be padded on some systems
         int remain = htotal % 8;
@@ -324,6 +521,8 @@ item *do_item_alloc(const char *key, const size_t nkey, const client_flags_t fla
 
     /* Refcount is seeded to 1 by slabs_alloc() */
     it->next = it->prev = 0;
+    it->hv = 0;
+    it->cost = 0;
 
     /* Items are initially loaded into the HOT_LRU. This is '0' but I want at
      * least a note here. Compiler (hopefully?) optimizes this out.
@@ -331,7 +530,7 @@ item *do_item_alloc(const char *key, const size_t nkey, const client_flags_t fla
     if (settings.temp_lru &&
             exptime - current_time <= settings.temporary_ttl) {
         id |= TEMP_LRU;
-    } else if (settings.lru_segmented) {
+    } else if (settings.lru_segmented || evict_policy->lru_window) {
         id |= HOT_LRU;
     } else {
         /* There is only COLD in compat-mode */
@@ -342,6 +541,7 @@ item *do_item_alloc(const char *key, const size_t nkey, const client_flags_t fla
     DEBUG_REFCNT(it, '*');
     it->it_flags |= settings.use_cas ? ITEM_CAS : 0;
     it->it_flags |= nsuffix != 0 ? ITEM_CFLAGS : 0;
+    it->it_flags |= settings.emb_inline ? ITEM_EMB : 0;
     it->nkey = nkey;
     it->nbytes = nbytes;
     memcpy(ITEM_key(it), key, nkey);
@@ -363,22 +563,14 @@ item *do_item_alloc(const char *key, const size_t nkey, const client_flags_t fla
     }
     it->h_next = 0;
 
-	if (USE_EMBEDDING_EVICT) {
-		//fprintf(stderr, "[%lu] UPDATE INVOKED FROM do_item_alloc\n", (unsigned long) pthread_self());
-		//emb_update_object(it);
-	}
+    if (it->it_flags & ITEM_EMB) {
+        emb_item_init(it);
+    }
 
     return it;
 }
 
 void item_free(item *it) {
-	if (USE_EMBEDDING_EVICT) {
-		//uint32_t hv = hash(ITEM_key(it), it->nkey);
-		//emb_remove_item(it, hv);
-		//fprintf(stderr, "freeing item\n");
-	}
-	//fprintf(stderr, "[%lu] FREEING item %p\n", (unsigned long) pthread_self(), (void*) it);
-
     unsigned int clsid;
     assert((it->it_flags & ITEM_LINKED) == 0);
     assert(it != heads[it->slabs_clsid]);
@@ -407,6 +599,9 @@ bool item_size_ok(const size_t nkey, const client_flags_t flags, const int nbyte
     if (settings.use_cas) {
         ntotal += sizeof(uint64_t);
     }
+    if (settings.emb_inline) {
+        ntotal += settings.emb_item_size;
+    }
 
     return slabs_clsid(ntotal) != 0;
 }
@@ -415,11 +610,15 @@ bool item_size_ok(const size_t nkey, const client_flags_t flags, const int nbyte
 void do_item_link_fixup(item *it) {
     item **head, **tail;
     int ntotal = ITEM_ntotal(it);
+    /* Rehash: the hash algorithm may differ from the previous run. */
     uint32_t hv = hash(ITEM_key(it), it->nkey);
+    it->hv = hv;
     assoc_insert(it, hv);
-	if (USE_EMBEDDING_EVICT) {
-		emb_update_object(it);
-	}
+    if (evict_policy->on_restore) {
+        evict_policy->on_restore(it, hv);
+    } else if (evict_policy->on_link) {
+        evict_policy->on_link(it, hv);
+    }
 
     head = &heads[it->slabs_clsid];
     tail = &tails[it->slabs_clsid];
@@ -522,6 +721,7 @@ int do_item_link(item *it, const uint32_t hv, const uint64_t cas) {
     assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
     it->it_flags |= ITEM_LINKED;
     it->time = current_time;
+    it->hv = hv;
 
     STATS_LOCK();
     stats_state.curr_bytes += ITEM_ntotal(it);
@@ -532,9 +732,9 @@ int do_item_link(item *it, const uint32_t hv, const uint64_t cas) {
     /* Allocate a new CAS ID on link. */
     ITEM_set_cas(it, cas);
     assoc_insert(it, hv);
-	if (USE_EMBEDDING_EVICT) {
-		emb_update_object(it);
-	}
+    if (evict_policy->on_link) {
+        evict_policy->on_link(it, hv);
+    }
     item_link_q(it);
     refcount_incr(it);
     item_stats_sizes_add(it);
@@ -554,10 +754,9 @@ void do_item_unlink(item *it, const uint32_t hv) {
         stats_state.curr_items -= 1;
         STATS_UNLOCK();
         item_stats_sizes_remove(it);
-		// EMB_DEBUG
-		if (USE_EMBEDDING_EVICT) {
-			//emb_remove_item(it, hv);
-		}
+        if (evict_policy->on_unlink) {
+            evict_policy->on_unlink(it, hv);
+        }
         assoc_delete(ITEM_key(it), it->nkey, hv);
         item_unlink_q(it);
         do_item_remove(it);
@@ -576,42 +775,250 @@ void do_item_unlink_nolock(item *it, const uint32_t hv) {
         stats_state.curr_items -= 1;
         STATS_UNLOCK();
         item_stats_sizes_remove(it);
-		// EMB_DEBUG
-		if (USE_EMBEDDING_EVICT) {
-			//emb_remove_item(it, hv);
-		}
+        if (evict_policy->on_unlink) {
+            evict_policy->on_unlink(it, hv);
+        }
         assoc_delete(ITEM_key(it), it->nkey, hv);
         do_item_unlink_q(it);
         do_item_remove(it);
     }
 }
 
+/*** EVICTION QUALITY ***/
+
+/* With -o evict_ghost_size, the hashes of evicted items are remembered in a
+ * ghost list and client misses are checked against it. A miss on a ghost is
+ * an eviction the policy got wrong, so "stats evictpolicy" counts them per
+ * slab class, with how long after the eviction the key was asked for, and
+ * compares the policy's scores of those victims with the scores of all of
+ * its victims. */
+static ghost_list *evict_ghost = NULL;
+static uint64_t ghost_checks = 0;
+static uint64_t ghost_hit_age_sum = 0;
+/* ghost hits by seconds since eviction, the last bucket is anything older */
+static const rel_time_t ghost_hit_age_limits[] = {1, 10, 60, 600, 3600};
+#define GHOST_AGE_BUCKETS (sizeof(ghost_hit_age_limits) / sizeof(rel_time_t) + 1)
+static uint64_t ghost_hit_ages[GHOST_AGE_BUCKETS];
+
+void item_ghost_init(void) {
+    if (settings.evict_ghost_size == 0) {
+        return;
+    }
+    evict_ghost = ghost_list_new(settings.evict_ghost_size);
+    if (evict_ghost == NULL) {
+        fprintf(stderr, "Failed to allocate the eviction ghost list\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void item_ghost_stats_reset(void) {
+    __atomic_store_n(&ghost_checks, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ghost_hit_age_sum, 0, __ATOMIC_RELAXED);
+    for (int b = 0; b < GHOST_AGE_BUCKETS; b++) {
+        __atomic_store_n(&ghost_hit_ages[b], 0, __ATOMIC_RELAXED);
+    }
+}
+
+/* Ask the policy about a victim before it goes. Item lock must be held. */
+static void item_evict_ghost_entry(item *it, const uint32_t hv, ghost_entry *ge) {
+    ge->time = current_time;
+    ge->clsid = ITEM_clsid(it);
+    ge->has_score = evict_policy->victim_score != NULL
+        && evict_policy->victim_score(it, hv, &ge->score);
+}
+
+/* lru_locks[id] must be held. */
+static void item_evict_ghost_stats(const int id, const ghost_entry *ge) {
+    if (ge->has_score) {
+        itemstats[id].victim_scored++;
+        itemstats[id].victim_score_sum += ge->score;
+    }
+}
+
+/* Called on client misses. */
+void item_ghost_check(const char *key, const size_t nkey) {
+    if (evict_ghost == NULL) {
+        return;
+    }
+    __atomic_fetch_add(&ghost_checks, 1, __ATOMIC_RELAXED);
+
+    ghost_entry ge;
+    if (!ghost_list_take(evict_ghost, hash(key, nkey), &ge)) {
+        return;
+    }
+    rel_time_t age = current_time - ge.time;
+    unsigned int b = 0;
+    while (b < GHOST_AGE_BUCKETS - 1 && age > ghost_hit_age_limits[b]) {
+        b++;
+    }
+    __atomic_fetch_add(&ghost_hit_ages[b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ghost_hit_age_sum, age, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&lru_locks[ge.clsid]);
+    itemstats[ge.clsid].ghost_hits++;
+    if (ge.has_score) {
+        itemstats[ge.clsid].ghost_hit_scored++;
+        itemstats[ge.clsid].ghost_hit_score_sum += ge.score;
+    }
+    pthread_mutex_unlock(&lru_locks[ge.clsid]);
+}
+
+/* "stats evictpolicy" */
+void item_stats_evictpolicy(ADD_STAT add_stats, void *c) {
+    itemstats_t totals;
+    memset(&totals, 0, sizeof(totals));
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+
+    APPEND_STAT("evict_policy", "%s", evict_policy->name);
+    for (int n = 0; n < MAX_NUMBER_OF_SLAB_CLASSES; n++) {
+        itemstats_t cls;
+        memset(&cls, 0, sizeof(cls));
+        for (int x = 0; x < 4; x++) {
+            int i = n | lru_type_map[x];
+            pthread_mutex_lock(&lru_locks[i]);
+            cls.evicted += itemstats[i].evicted;
+            cls.victim_scored += itemstats[i].victim_scored;
+            cls.victim_score_sum += itemstats[i].victim_score_sum;
+            cls.ghost_hits += itemstats[i].ghost_hits;
+            cls.ghost_hit_scored += itemstats[i].ghost_hit_scored;
+            cls.ghost_hit_score_sum += itemstats[i].ghost_hit_score_sum;
+            pthread_mutex_unlock(&lru_locks[i]);
+        }
+        uint64_t pool = evict_policy->pool_size ? evict_policy->pool_size(n) : 0;
+        if (cls.evicted == 0 && cls.ghost_hits == 0 && pool == 0) {
+            continue;
+        }
+        APPEND_NUM_STAT(n, "evicted", "%llu", (unsigned long long)cls.evicted);
+        if (evict_ghost != NULL) {
+            APPEND_NUM_STAT(n, "ghost_hits", "%llu", (unsigned long long)cls.ghost_hits);
+        }
+        if (cls.victim_scored) {
+            APPEND_NUM_STAT(n, "victim_score_avg", "%.4f",
+                    cls.victim_score_sum / cls.victim_scored);
+        }
+        if (cls.ghost_hit_scored) {
+            APPEND_NUM_STAT(n, "ghost_hit_score_avg", "%.4f",
+                    cls.ghost_hit_score_sum / cls.ghost_hit_scored);
+        }
+        if (evict_policy->pool_size) {
+            APPEND_NUM_STAT(n, "pool_size", "%llu", (unsigned long long)pool);
+        }
+        totals.evicted += cls.evicted;
+        totals.victim_scored += cls.victim_scored;
+        totals.victim_score_sum += cls.victim_score_sum;
+        totals.ghost_hits += cls.ghost_hits;
+        totals.ghost_hit_scored += cls.ghost_hit_scored;
+        totals.ghost_hit_score_sum += cls.ghost_hit_score_sum;
+    }
+
+    APPEND_STAT("evicted", "%llu", (unsigned long long)totals.evicted);
+    APPEND_STAT("victim_scored", "%llu", (unsigned long long)totals.victim_scored);
+    if (totals.victim_scored) {
+        APPEND_STAT("victim_score_avg", "%.4f",
+                totals.victim_score_sum / totals.victim_scored);
+    }
+    if (evict_ghost != NULL) {
+        APPEND_STAT("ghost_size", "%u", ghost_list_size(evict_ghost));
+        APPEND_STAT("ghost_checks", "%llu", (unsigned long long)
+                __atomic_load_n(&ghost_checks, __ATOMIC_RELAXED));
+        APPEND_STAT("ghost_hits", "%llu", (unsigned long long)totals.ghost_hits);
+        for (int b = 0; b < GHOST_AGE_BUCKETS; b++) {
+            char name[32];
+            if (b < GHOST_AGE_BUCKETS - 1) {
+                snprintf(name, sizeof(name), "ghost_hits_within_%us",
+                        ghost_hit_age_limits[b]);
+            } else {
+                snprintf(name, sizeof(name), "ghost_hits_older");
+            }
+            APPEND_STAT(name, "%llu", (unsigned long long)
+                    __atomic_load_n(&ghost_hit_ages[b], __ATOMIC_RELAXED));
+        }
+        if (totals.ghost_hits) {
+            APPEND_STAT("ghost_hit_age_avg", "%.2f", (double)
+                    __atomic_load_n(&ghost_hit_age_sum, __ATOMIC_RELAXED)
+                    / totals.ghost_hits);
+        }
+        if (totals.ghost_hit_scored) {
+            APPEND_STAT("ghost_hit_score_avg", "%.4f",
+                    totals.ghost_hit_score_sum / totals.ghost_hit_scored);
+        }
+    }
+    if (evict_policy->stats) {
+        evict_policy->stats(add_stats, c);
+    }
+}
+
+/* Evict an item picked by something other than lru_pull_tail(), accounting
+ * for it the same way. The item lock and a reference must be held; the
+ * reference is left for the caller to drop. */
+void do_item_evict(item *it, const uint32_t hv) {
+    int id = it->slabs_clsid;
+    ghost_entry ge;
+    item_evict_ghost_entry(it, hv, &ge);
+    pthread_mutex_lock(&lru_locks[id]);
+    item_evict_ghost_stats(id, &ge);
+    itemstats[id].evicted++;
+    itemstats[id].evicted_time = current_time - it->time;
+    if (it->exptime != 0)
+        itemstats[id].evicted_nonzero++;
+    if ((it->it_flags & ITEM_FETCHED) == 0) {
+        itemstats[id].evicted_unfetched++;
+    }
+    if ((it->it_flags & ITEM_ACTIVE)) {
+        itemstats[id].evicted_active++;
+    }
+    pthread_mutex_unlock(&lru_locks[id]);
+    if (evict_ghost != NULL) {
+        ghost_list_add(evict_ghost, hv, &ge);
+    }
+
+    LOGGER_LOG(NULL, LOG_EVICTIONS, LOGGER_EVICTION, it);
+    STORAGE_delete(ext_storage, it);
+    do_item_unlink(it, hv);
+    if (settings.slab_automove == 2) {
+        slabs_reassign(settings.slab_rebal, -1, ITEM_clsid(it), SLABS_REASSIGN_ALLOW_EVICTIONS);
+    }
+}
+
+/* Same as do_item_evict(), for an expired or flushed item: it counts as
+ * reclaimed, like the ones lru_pull_tail() finds. */
+void do_item_reclaim(item *it, const uint32_t hv) {
+    int id = it->slabs_clsid;
+    pthread_mutex_lock(&lru_locks[id]);
+    itemstats[id].reclaimed++;
+    if ((it->it_flags & ITEM_FETCHED) == 0) {
+        itemstats[id].expired_unfetched++;
+    }
+    pthread_mutex_unlock(&lru_locks[id]);
+
+    STORAGE_delete(ext_storage, it);
+    do_item_unlink(it, hv);
+}
+
 void do_item_remove(item *it) {
     MEMCACHED_ITEM_REMOVE(ITEM_key(it), it->nkey, it->nbytes);
     assert((it->it_flags & ITEM_SLABBED) == 0);
     assert(it->refcount > 0);
 
     if (refcount_decr(it) == 0) {
-		if (USE_EMBEDDING_EVICT) {
-			emb_remove_item(it, hash(ITEM_key(it), it->nkey));
-		}
         item_free(it);
-    } else {
-	}
+    }
 }
 
 /* Bump the last accessed time, or relink if we're in compat mode */
 void do_item_update(item *it) {
     MEMCACHED_ITEM_UPDATE(ITEM_key(it), it->nkey, it->nbytes);
-	// TODO: fix this to use proper printing the string is not null terminated
-	//fprintf(stderr, "[EMB_DEBUG] accessing object %s\n", ITEM_key(it));
-	if (USE_EMBEDDING_EVICT) {
-		if ((it->it_flags & ITEM_LINKED) != 0) {
-		//fprintf(stderr, "[%lu] UPDATE INVOKED FROM do_item_update\n", (unsigned long) pthread_self());
-			emb_update_object(it);
-		}
-		return;
-	}
+    /* The policy tracks recency itself; the LRU order isn't used unless
+     * the policy keeps a window in it. */
+    if (evict_policy->on_access) {
+        if ((it->it_flags & ITEM_LINKED) != 0) {
+            evict_policy->on_access(it);
+        }
+        if (!evict_policy->lru_window)
+            return;
+    }
 
     /* Hits to COLD_LRU immediately move to WARM. */
     if (settings.lru_segmented) {
@@ -666,7 +1073,7 @@ void item_flush_expired(void) {
             if (iter->time == 0 && iter->nkey == 0 && iter->it_flags == 1) {
                 continue; // crawler item.
             }
-            uint32_t hv = hash(ITEM_key(iter), iter->nkey);
+            uint32_t hv = iter->hv;
             // if we can't lock the item, just give up.
             // we can't block here because the lock order is inverted.
             if ((hold_lock = item_trylock(hv)) == NULL) {
@@ -680,7 +1087,7 @@ void item_flush_expired(void) {
                 if ((iter->it_flags & ITEM_SLABBED) == 0) {
                     STORAGE_delete(ext_storage, iter);
                     // nolock version because we hold the LRU lock already.
-                    do_item_unlink_nolock(iter, hash(ITEM_key(iter), iter->nkey));
+                    do_item_unlink_nolock(iter, hv);
                 }
                 item_trylock_unlock(hold_lock);
             } else {
@@ -841,6 +1248,9 @@ void item_stats_totals(ADD_STAT add_stats, void *c) {
         APPEND_STAT("lru_bumps_dropped", "%llu",
                     (unsigned long long)lru_total_bumps_dropped());
     }
+    if (evict_policy->stats) {
+        evict_policy->stats(add_stats, c);
+    }
 }
 
 void item_stats(ADD_STAT add_stats, void *c) {
@@ -1172,7 +1582,7 @@ int lru_pull_tail(const int orig_id, const int cur_lru,
             tries++;
             continue;
         }
-        uint32_t hv = hash(ITEM_key(search), search->nkey);
+        uint32_t hv = search->hv;
         /* Attempt to hash item lock the "search" item. If locked, no
          * other callers can incr the refcount. Also skip ourselves. */
         if ((hold_lock = item_trylock(hv)) == NULL)
@@ -1261,6 +1671,12 @@ int lru_pull_tail(const int orig_id, const int cur_lru,
                         /* Don't think we need a counter for this. It'll OOM.  */
                         break;
                     }
+                    ghost_entry ge;
+                    item_evict_ghost_entry(search, hv, &ge);
+                    item_evict_ghost_stats(id, &ge);
+                    if (evict_ghost != NULL) {
+                        ghost_list_add(evict_ghost, hv, &ge);
+                    }
                     itemstats[id].evicted++;
                     itemstats[id].evicted_time = current_time - search->time;
                     if (search->exptime != 0)
@@ -1483,7 +1899,9 @@ static int lru_maintainer_juggle(const int slabs_clsid) {
     /* Juggle HOT/WARM up to N times */
     for (i = 0; i < 500; i++) {
         int do_more = 0;
-        if (lru_pull_tail(slabs_clsid, HOT_LRU, total_bytes, LRU_PULL_CRAWL_BLOCKS, hot_age, NULL) ||
+        /* A policy's admission window drains only through its pick_victim */
+        if ((!evict_policy->lru_window &&
+             lru_pull_tail(slabs_clsid, HOT_LRU, total_bytes, LRU_PULL_CRAWL_BLOCKS, hot_age, NULL)) ||
             lru_pull_tail(slabs_clsid, WARM_LRU, total_bytes, LRU_PULL_CRAWL_BLOCKS, warm_age, NULL)) {
             do_more++;
         }
@@ -20,6 +20,8 @@ bool item_size_ok(const size_t nkey, const client_flags_t flags, const int nbyte
 int  do_item_link(item *it, const uint32_t hv, const uint64_t cas);     /** may fail if transgresses limits */
 void do_item_unlink(item *it, const uint32_t hv);
 void do_item_unlink_nolock(item *it, const uint32_t hv);
+void do_item_evict(item *it, const uint32_t hv);
+void do_item_reclaim(item *it, const uint32_t hv);
 void do_item_remove(item *it);
 void do_item_update(item *it);   /** update LRU time to current and reposition */
 void do_item_update_nolock(item *it);
@@ -55,6 +57,9 @@ void item_stats(ADD_STAT add_stats, void *c);
 void do_item_stats_add_crawl(const int i, const uint64_t reclaimed,
         const uint64_t unfetched, const uint64_t checked);
 void item_stats_totals(ADD_STAT add_stats, void *c);
+void item_stats_evictpolicy(ADD_STAT add_stats, void *c);
+void item_ghost_init(void);
+void item_ghost_check(const char *key, const size_t nkey);
 /*@null@*/
 void item_stats_sizes(ADD_STAT add_stats, void *c);
 void item_stats_sizes_init(void);
@@ -82,3 +87,41 @@ void lru_maintainer_pause(void);
 void lru_maintainer_resume(void);
 
 void *lru_bump_buf_create(void);
+
+/* Eviction policies
+ *
+ * A policy picks which item do_item_alloc_pull() evicts when a slab class is
+ * full. Hooks left NULL are skipped. on_link, on_access and on_unlink run
+ * with the item lock held; items restored on warm restart go through
+ * on_restore instead of on_link if it is set. A policy with on_access set
+ * does its own recency tracking, so hits no longer bump the item in the LRU,
+ * unless lru_window is set: then LRU order is kept and new items are linked
+ * into HOT_LRU, which the LRU maintainer leaves alone for the policy to
+ * drain. pick_victim frees memory in class id and returns how many items
+ * it freed, which may be more than one if it reclaims expired items on the
+ * way; if it returns 0 the LRU tail is tried instead.
+ *
+ * For "stats evictpolicy", victim_score is asked how well an item about to
+ * be evicted fit the policy's model (item lock held; false if it has no
+ * opinion), and pool_size how many items of class id it picks victims from.
+ */
+typedef struct {
+    const char *name;
+    bool lru_segmented;         /* wants HOT/WARM/COLD LRUs */
+    bool lru_window;            /* HOT_LRU is the policy's admission window */
+    void (*init)(void);
+    int (*start)(void);         /* background threads */
+    int (*stop)(void);
+    void *(*thread_init)(void); /* per worker thread state */
+    void (*on_link)(item *it, const uint32_t hv);
+    void (*on_restore)(item *it, const uint32_t hv); /* warm restart link */
+    void (*on_access)(item *it);
+    void (*on_unlink)(item *it, const uint32_t hv);
+    int (*pick_victim)(const unsigned int id);
+    void (*stats)(ADD_STAT add_stats, void *c);
+    bool (*victim_score)(item *it, const uint32_t hv, float *score);
+    uint64_t (*pool_size)(const unsigned int id);
+} evict_policy_t;
+
+extern evict_policy_t *evict_policy;
+evict_policy_t *evict_policy_find(const char *name);
@@ -19,6 +19,7 @@
 #include "restart.h"
 #include "slabs_mover.h"
 #include "embeddings.h"
+#include "emb_kernels.h"
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -62,6 +63,11 @@
 #include <sys/sysctl.h>
 #endif
 
+#ifdef EVICTSIM
+/* evictsim.c has the real main(); each simulated server runs this one. */
+#define main memcached_main
+#endif
+
 /*
  * forward declarations
  */
@@ -247,8 +253,18 @@ static void settings_init(void) {
     settings.lru_crawler_sleep = 100;
     settings.lru_crawler_tocrawl = 0;
     settings.lru_maintainer_thread = false;
-	// EMB_DEBUG we changed this to false
-    settings.lru_segmented = false;
+    settings.lru_segmented = true; /* set from evict_policy after parsing */
+    settings.emb_inline = false;
+    settings.emb_item_size = 0;
+    settings.emb_precision = EMB_PRECISION_FP32;
+    settings.emb_simd = true;
+    settings.emb_async_train = false;
+    settings.emb_model = EMB_MODEL_AVG;
+    settings.emb_evict_score = EMB_EVICT_SIM;
+    settings.emb_ann_lists = 0;
+    settings.emb_shards = EMB_DEFAULT_SHARDS;
+    settings.tinylfu_window_pct = 1;
+    settings.evict_ghost_size = 0;
     settings.hot_lru_pct = 20;
     settings.warm_lru_pct = 40;
     settings.hot_max_factor = 0.2;
@@ -257,7 +273,11 @@ static void settings_init(void) {
     settings.temporary_ttl = 61;
     settings.idle_timeout = 0; /* disabled */
     settings.hashpower_init = 0;
+    settings.hash_table = ASSOC_TABLE_CHAINED;
     settings.slab_reassign = true;
+    settings.slab_cache = 0;
+    settings.slab_hugepages = SLAB_HUGEPAGES_NONE;
+    settings.slab_numa = false;
     settings.slab_automove = 1;
     settings.slab_automove_version = 0;
     settings.slab_automove_ratio = 0.8;
@@ -393,6 +413,7 @@ int stop_conn_timeout_thread(void) {
  */
 static void rbuf_release(conn *c) {
     if (c->rbuf != NULL && c->rbytes == 0 && !IS_UDP(c->transport)) {
+        prefetch_mg_reset(c);
         if (c->rbuf_malloced) {
             free(c->rbuf);
             c->rbuf_malloced = false;
@@ -430,6 +451,7 @@ bool rbuf_switch_to_malloc(conn *c) {
     if (!tmp)
         return false;
 
+    prefetch_mg_reset(c);
     memcpy(tmp, c->rcurr, c->rbytes);
     do_cache_free(c->thread->rbuf_cache, c->rbuf);
 
@@ -869,6 +891,7 @@ static void conn_close(conn *c) {
     assert(c != NULL);
 
     if (c->thread) {
+        prefetch_mg_reset(c);
         LOGGER_LOG(c->thread->l, LOG_CONNEVENTS, LOGGER_CONNECTION_CLOSE, NULL,
                 &c->request_addr, c->request_addr_size, c->transport,
                 c->close_reason, c->sfd);
@@ -1641,6 +1664,7 @@ enum store_item_type do_store_item(item *it, int comm, LIBEVENT_THREAD *t, const
                 // OOM trying to copy.
                 if (new_it == NULL)
                     break;
+                new_it->cost = it->cost ? it->cost : old_it->cost;
                 /* copy data from it and old_it to new_it */
                 if (_store_item_copy_data(comm, old_it, new_it, it) == -1) {
                     // failed data copy
@@ -1849,6 +1873,7 @@ void server_stats(ADD_STAT add_stats, void *c) {
     APPEND_STAT("conn_yields", "%llu", (unsigned long long)thread_stats.conn_yields);
     APPEND_STAT("hash_power_level", "%u", stats_state.hash_power_level);
     APPEND_STAT("hash_bytes", "%llu", (unsigned long long)stats_state.hash_bytes);
+    APPEND_STAT("hash_buckets", "%llu", (unsigned long long)stats_state.hash_buckets);
     APPEND_STAT("hash_is_expanding", "%u", stats_state.hash_is_expanding);
     if (settings.slab_reassign) {
         APPEND_STAT("slab_reassign_rescues", "%llu", stats.slab_reassign_rescues);
@@ -1932,6 +1957,12 @@ void process_stat_settings(ADD_STAT add_stats, void *c) {
     APPEND_STAT("slab_automove_ratio", "%.2f", settings.slab_automove_ratio);
     APPEND_STAT("slab_automove_window", "%u", settings.slab_automove_window);
     APPEND_STAT("slab_chunk_max", "%d", settings.slab_chunk_size_max);
+    APPEND_STAT("slab_cache", "%u", settings.slab_cache);
+    {
+        static const char *hp[] = {"no", "thp", "2m", "1g"};
+        APPEND_STAT("slab_hugepages", "%s", hp[settings.slab_hugepages]);
+    }
+    APPEND_STAT("slab_numa", "%s", settings.slab_numa ? "yes" : "no");
     APPEND_STAT("lru_crawler", "%s", settings.lru_crawler ? "yes" : "no");
     APPEND_STAT("lru_crawler_sleep", "%d", settings.lru_crawler_sleep);
     APPEND_STAT("lru_crawler_tocrawl", "%lu", (unsigned long)settings.lru_crawler_tocrawl);
@@ -1939,8 +1970,21 @@ void process_stat_settings(ADD_STAT add_stats, void *c) {
     APPEND_STAT("flush_enabled", "%s", settings.flush_enabled ? "yes" : "no");
     APPEND_STAT("dump_enabled", "%s", settings.dump_enabled ? "yes" : "no");
     APPEND_STAT("hash_algorithm", "%s", settings.hash_algorithm);
+    APPEND_STAT("hash_table", "%s",
+            settings.hash_table == ASSOC_TABLE_TAGGED ? "tagged" : "chained");
     APPEND_STAT("lru_maintainer_thread", "%s", settings.lru_maintainer_thread ? "yes" : "no");
     APPEND_STAT("lru_segmented", "%s", settings.lru_segmented ? "yes" : "no");
+    APPEND_STAT("evict_policy", "%s", evict_policy->name);
+    APPEND_STAT("emb_inline", "%s", settings.emb_inline ? "yes" : "no");
+    APPEND_STAT("emb_precision", "%s", emb_precision_str());
+    APPEND_STAT("emb_kernels", "%s", emb_kernels.name);
+    APPEND_STAT("emb_async_train", "%s", settings.emb_async_train ? "yes" : "no");
+    APPEND_STAT("emb_model", "%s", emb_model_str());
+    APPEND_STAT("emb_evict_score", "%s", emb_evict_score_str());
+    APPEND_STAT("emb_ann_lists", "%u", settings.emb_ann_lists);
+    APPEND_STAT("emb_shards", "%u", settings.emb_shards);
+    APPEND_STAT("tinylfu_window_pct", "%d", settings.tinylfu_window_pct);
+    APPEND_STAT("evict_ghost_size", "%u", settings.evict_ghost_size);
     APPEND_STAT("hot_lru_pct", "%d", settings.hot_lru_pct);
     APPEND_STAT("warm_lru_pct", "%d", settings.warm_lru_pct);
     APPEND_STAT("hot_max_factor", "%.2f", settings.hot_max_factor);
@@ -1961,6 +2005,7 @@ void process_stat_settings(ADD_STAT add_stats, void *c) {
     APPEND_STAT("ext_item_age", "%u", settings.ext_item_age);
     APPEND_STAT("ext_low_ttl", "%u", settings.ext_low_ttl);
     APPEND_STAT("ext_recache_rate", "%u", settings.ext_recache_rate);
+    APPEND_STAT("ext_prefetch_rate", "%u", settings.ext_prefetch_rate);
     APPEND_STAT("ext_wbuf_size", "%u", settings.ext_wbuf_size);
     APPEND_STAT("ext_compact_under", "%u", settings.ext_compact_under);
     APPEND_STAT("ext_drop_under", "%u", settings.ext_drop_under);
@@ -2198,17 +2243,47 @@ item* limited_get(const char *key, size_t nkey, LIBEVENT_THREAD *t, uint32_t exp
     return it;
 }
 
+// limited_get() for a batch of keys, see item_get_batch().
+void limited_get_batch(const char **keys, const size_t *nkeys, const int n, item **items, LIBEVENT_THREAD *t, bool do_update) {
+    item_get_batch(keys, nkeys, n, items, t, do_update);
+    for (int i = 0; i < n; i++) {
+        if (items[i] && items[i]->refcount > IT_REFCOUNT_LIMIT) {
+            item_remove(items[i]);
+            items[i] = NULL;
+        }
+    }
+}
+
 // Semantics are different than limited_get; since the item is returned
 // locked, caller can directly change what it needs.
 // though it might eventually be a better interface to sink it all into
 // items.c.
 item* limited_get_locked(const char *key, size_t nkey, LIBEVENT_THREAD *t, bool do_update, uint32_t *hv, bool *overflow) {
+    *hv = hash(key, nkey);
+    return limited_get_locked_hv(key, nkey, *hv, t, do_update, overflow);
+}
+
+// limited_get() and limited_get_locked() for a key whose hash the caller
+// already has.
+item* limited_get_hv(const char *key, size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, bool do_update, bool *overflow) {
+    item *it = item_get_hv(key, nkey, hv, t, do_update);
+    if (it && it->refcount > IT_REFCOUNT_LIMIT) {
+        item_remove(it);
+        it = NULL;
+        *overflow = true;
+    } else {
+        *overflow = false;
+    }
+    return it;
+}
+
+item* limited_get_locked_hv(const char *key, size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, bool do_update, bool *overflow) {
     item *it;
-    it = item_get_locked(key, nkey, t, do_update, hv);
+    it = item_get_locked_hv(key, nkey, hv, t, do_update);
     if (it && it->refcount > IT_REFCOUNT_LIMIT) {
         do_item_remove(it);
         it = NULL;
-        item_unlock(*hv);
+        item_unlock(hv);
         *overflow = true;
     } else {
         *overflow = false;
@@ -2313,6 +2388,7 @@ enum delta_result_type do_add_delta(LIBEVENT_THREAD *t, const char *key, const s
         }
         memcpy(ITEM_data(new_it), buf, res);
         memcpy(ITEM_data(new_it) + res, "\r\n", 2);
+        new_it->cost = it->cost;
         item_replace(it, new_it, hv, (settings.use_cas) ? get_cas_id() : 0);
         // Overwrite the older item's CAS with our new CAS since we're
         // returning the CAS of the old item below.
@@ -2385,6 +2461,7 @@ static enum try_read_result try_read_udp(conn *c) {
 
     assert(c != NULL);
 
+    prefetch_mg_reset(c);
     c->request_addr_size = sizeof(c->request_addr);
     res = recvfrom(c->sfd, c->rbuf, c->rsize,
                    0, (struct sockaddr *)&c->request_addr,
@@ -2432,6 +2509,7 @@ static enum try_read_result try_read_network(conn *c) {
     int num_allocs = 0;
     assert(c != NULL);
 
+    prefetch_mg_reset(c);
     if (c->rcurr != c->rbuf) {
         if (c->rbytes > 0) /* otherwise there's nothing to copy */
             memmove(c->rbuf, c->rcurr, c->rbytes);
@@ -3921,9 +3999,9 @@ static void clock_handler(const evutil_socket_t fd, const short which, void *arg
         initialized = true;
     }
 
-    // While we're here, check for hash table expansion.
+    // While we're here, check whether the hash table needs resizing.
     // This function should be quick to avoid delaying the timer.
-    assoc_start_expand(stats_state.curr_items);
+    assoc_start_resize(stats_state.curr_items);
     // also, if HUP'ed we need to do some maintenance.
     // for now that's just the authfile reload.
     if (settings.sig_hup) {
@@ -4038,7 +4116,7 @@ static void usage(void) {
     printf("-S, --enable-sasl         turn on Sasl authentication\n");
 #endif
     printf("-F, --disable-flush-all   disable flush_all command\n");
-    printf("-X, --disable-dumping     disable stats cachedump, stats detail, and lru_crawler metadump\n");
+    printf("-X, --disable-dumping     disable stats cachedump, stats detail, lru_crawler metadump and mk\n");
     printf("-W  --disable-watch       disable watch commands (live logging)\n");
     printf("-Y, --auth-file=<file>    (EXPERIMENTAL) enable ASCII protocol authentication. format:\n"
            "                          user:pass\\nuser2:pass2\\n\n");
@@ -4052,13 +4130,17 @@ static void usage(void) {
            "                          most options have a 'no_' prefix to disable\n"
            "   - maxconns_fast:       immediately close new connections after limit (default: %s)\n"
            "   - hashpower:           an integer multiplier for how large the hash\n"
-           "                          table should be. normally grows at runtime. (default starts at: %d)\n"
+           "                          table should be. normally grows at runtime, and\n"
+           "                          shrinks back to no less than this. (default starts at: %d)\n"
            "                          set based on \"STAT hash_power_level\"\n"
            "   - tail_repair_time:    time in seconds for how long to wait before\n"
            "                          forcefully killing LRU tail item.\n"
            "                          disabled by default; very dangerous option.\n"
            "   - hash_algorithm:      the hash table algorithm\n"
            "                          default is murmur3 hash. options: jenkins, murmur3, xxh3\n"
+           "   - hash_table:          the hash table layout. chained (default) or tagged:\n"
+           "                          cache line buckets with per-item hash tags, fewer\n"
+           "                          cache misses per lookup for more memory per bucket\n"
            "   - no_lru_crawler:      disable LRU Crawler background thread.\n"
            "   - lru_crawler_sleep:   microseconds to sleep between items\n"
            "                          default is %d.\n"
@@ -4095,6 +4177,69 @@ static void usage(void) {
            "   - no_modern:           uses defaults of previous major version (1.4.x)\n",
            settings.slab_chunk_size_max / (1 << 10), settings.logger_watcher_buf_size / (1 << 10),
            settings.logger_buf_size / (1 << 10));
+    printf("   - slab_cache:          free chunks per slab class each worker thread keeps\n"
+           "                          to itself, up to %d, so most sets and frees skip the\n"
+           "                          global slab lock. 0 to disable. (default: %u)\n",
+           SLABS_CACHE_MAX, settings.slab_cache);
+    verify_default("slab_cache", settings.slab_cache == 0);
+    printf("   - slab_hugepages:      map slab pages in huge page arenas: thp (madvise'd\n"
+           "                          transparent huge pages), 2m or 1g (hugetlbfs pages,\n"
+           "                          reserved via vm.nr_hugepages). linux only.\n"
+           "                          (default: disabled)\n");
+    verify_default("slab_hugepages", settings.slab_hugepages == SLAB_HUGEPAGES_NONE);
+    printf("   - slab_numa:           spread worker threads over the NUMA nodes and take\n"
+           "                          their slab pages from node local memory. linux only.\n"
+           "                          (default: disabled)\n");
+    verify_default("slab_numa", !settings.slab_numa);
+    printf("   - evict_policy:        how victims are picked when memory is full: lru,\n"
+           "                          segmented (requires lru_maintainer), emb or tinylfu.\n"
+           "                          (default: segmented, lru if no_lru_maintainer)\n");
+    verify_default("evict_policy", evict_policy == NULL);
+    printf("   - emb_inline:          store item embeddings inside the item instead of a\n"
+           "                          side table. costs memory on every item. always on\n"
+           "                          with -e, so embeddings survive restarts. (default: %s)\n",
+           flag_enabled_disabled(settings.emb_inline));
+    verify_default("emb_inline", !settings.emb_inline);
+    printf("   - emb_precision:       storage format of item embeddings: fp32, fp16, int8\n"
+           "                          (default: %s)\n"
+           "   - no_emb_simd:         use scalar embedding math even if the CPU supports\n"
+           "                          AVX2/SSE4.1/NEON.\n",
+           emb_precision_str());
+    verify_default("emb_precision", settings.emb_precision == EMB_PRECISION_FP32);
+    printf("   - emb_async_train:     queue hits for the embedding thread to train in\n"
+           "                          batches instead of training on the worker. (default: %s)\n",
+           flag_enabled_disabled(settings.emb_async_train));
+    verify_default("emb_async_train", !settings.emb_async_train);
+    printf("   - emb_model:           how item embeddings are trained: avg (towards the\n"
+           "                          rolling average of recent hits) or sgns (from keys\n"
+           "                          accessed together, implies emb_async_train).\n"
+           "                          (default: %s)\n",
+           emb_model_str());
+    verify_default("emb_model", settings.emb_model == EMB_MODEL_AVG);
+    printf("   - emb_evict_score:     how eviction candidates are ranked: sim (by\n"
+           "                          similarity alone) or gdsf (similarity times the\n"
+           "                          ms U cost hint, per byte, less near expiry).\n"
+           "                          (default: %s)\n",
+           emb_evict_score_str());
+    verify_default("emb_evict_score", settings.emb_evict_score == EMB_EVICT_SIM);
+    printf("   - emb_ann_lists:       index item embeddings in this many lists so the\n"
+           "                          \"mk\" command can find similar keys. roughly the\n"
+           "                          square root of the item count. (default: %u)\n",
+           settings.emb_ann_lists);
+    verify_default("emb_ann_lists", settings.emb_ann_lists == 0);
+    printf("   - emb_shards:          split each slab class's embedding pools this many\n"
+           "                          ways, a power of two. raise with the thread count\n"
+           "                          if the pool locks contend. (default: %u)\n",
+           settings.emb_shards);
+    verify_default("emb_shards", settings.emb_shards == EMB_DEFAULT_SHARDS);
+    printf("   - tinylfu_window_pct:  pct of slab memory new items may fill before they\n"
+           "                          must win admission to the main cache. (default: %d)\n",
+           settings.tinylfu_window_pct);
+    verify_default("tinylfu_window_pct", settings.tinylfu_window_pct == 1);
+    printf("   - evict_ghost_size:    remember this many evicted keys and count misses on\n"
+           "                          them in \"stats evictpolicy\". (default: %u)\n",
+           settings.evict_ghost_size);
+    verify_default("evict_ghost_size", settings.evict_ghost_size == 0);
     verify_default("tail_repair_time", settings.tail_repair_time == TAIL_REPAIR_TIME_DEFAULT);
     verify_default("lru_crawler_tocrawl", settings.lru_crawler_tocrawl == 0);
     verify_default("idle_timeout", settings.idle_timeout == 0);
@@ -4124,6 +4269,9 @@ static void usage(void) {
            "   - ext_low_ttl:         consider TTLs lower than this specially (default: %u)\n"
            "   - ext_drop_unread:     don't re-write unread values during compaction (default: %s)\n"
            "   - ext_recache_rate:    recache an item every N accesses (default: %u)\n"
+           "   - ext_prefetch_rate:   read up to N items per second back into RAM that the\n"
+           "                          embedding model expects to be requested soon.\n"
+           "                          requires evict_policy=emb (default: %u)\n"
            "   - ext_compact_under:   compact when fewer than this many free pages\n"
            "                          (default: 1 percent of the assigned storage)\n"
            "   - ext_drop_under:      drop COLD items when fewer than this many free pages\n"
@@ -4135,6 +4283,7 @@ static void usage(void) {
            settings.ext_page_size / (1 << 20), settings.ext_wbuf_size / (1 << 20), settings.ext_io_threadcount,
            settings.ext_item_size, settings.ext_low_ttl,
            flag_enabled_disabled(settings.ext_drop_unread), settings.ext_recache_rate,
+           settings.ext_prefetch_rate,
            settings.ext_max_frag, settings.ext_max_sleep, settings.slab_automove_freeratio);
     verify_default("ext_item_age", settings.ext_item_age == UINT_MAX);
 #endif
@@ -4433,6 +4582,8 @@ static int _mc_meta_save_cb(const char *tag, void *ctx, void *data) {
     restart_set_kv(ctx, "slab_chunk_size_max", "%d", settings.slab_chunk_size_max);
     restart_set_kv(ctx, "slab_page_size", "%d", settings.slab_page_size);
     restart_set_kv(ctx, "use_cas", "%s", settings.use_cas ? "true" : "false");
+    restart_set_kv(ctx, "emb_inline", "%s", settings.emb_inline ? "true" : "false");
+    restart_set_kv(ctx, "emb_precision", "%s", emb_precision_str());
     restart_set_kv(ctx, "slab_reassign", "%s", settings.slab_reassign ? "true" : "false");
 
     // Online state to remember.
@@ -4498,6 +4649,8 @@ static int _mc_meta_load_cb(const char *tag, void *ctx, void *data) {
         R_SLAB_PAGE_SIZE,
         R_SLAB_CONFIG,
         R_USE_CAS,
+        R_EMB_INLINE,
+        R_EMB_PRECISION,
         R_SLAB_REASSIGN,
         R_CURRENT_CAS,
         R_OLDEST_LIVE,
@@ -4517,6 +4670,8 @@ static int _mc_meta_load_cb(const char *tag, void *ctx, void *data) {
         [R_SLAB_PAGE_SIZE] = "slab_page_size",
         [R_SLAB_CONFIG] = "slab_config",
         [R_USE_CAS] = "use_cas",
+        [R_EMB_INLINE] = "emb_inline",
+        [R_EMB_PRECISION] = "emb_precision",
         [R_SLAB_REASSIGN] = "slab_reassign",
         [R_CURRENT_CAS] = "current_cas",
         [R_OLDEST_LIVE] = "oldest_live",
@@ -4597,6 +4752,16 @@ static int _mc_meta_load_cb(const char *tag, void *ctx, void *data) {
                 reuse_mmap = -1;
             }
             break;
+        case R_EMB_INLINE:
+            if (!is_bool || settings.emb_inline != val_bool) {
+                reuse_mmap = -1;
+            }
+            break;
+        case R_EMB_PRECISION:
+            if (strcmp(val, emb_precision_str()) != 0) {
+                reuse_mmap = -1;
+            }
+            break;
         case R_SLAB_REASSIGN:
             if (!is_bool || settings.slab_reassign != val_bool) {
                 reuse_mmap = -1;
@@ -4721,6 +4886,7 @@ int main (int argc, char **argv) {
         SLAB_AUTOMOVE_WINDOW,
         TAIL_REPAIR_TIME,
         HASH_ALGORITHM,
+        HASH_TABLE,
         LRU_CRAWLER,
         LRU_CRAWLER_SLEEP,
         LRU_CRAWLER_TOCRAWL,
@@ -4735,6 +4901,9 @@ int main (int argc, char **argv) {
         WORKER_LOGBUF_SIZE,
         SLAB_SIZES,
         SLAB_CHUNK_MAX,
+        SLAB_CACHE,
+        SLAB_HUGEPAGES,
+        SLAB_NUMA,
         TRACK_SIZES,
         NO_INLINE_ASCII_RESP,
         MODERN,
@@ -4750,6 +4919,17 @@ int main (int argc, char **argv) {
         DROP_PRIVILEGES,
         RESP_OBJ_MEM_LIMIT,
         READ_BUF_MEM_LIMIT,
+        EMB_INLINE,
+        EMB_PRECISION,
+        NO_EMB_SIMD,
+        EMB_ASYNC_TRAIN,
+        EMB_MODEL,
+        EMB_EVICT_SCORE,
+        EMB_ANN_LISTS,
+        EMB_SHARDS,
+        EVICT_POLICY,
+        TINYLFU_WINDOW_PCT,
+        EVICT_GHOST_SIZE,
 #ifdef TLS
         SSL_CERT,
         SSL_KEY,
@@ -4785,6 +4965,7 @@ int main (int argc, char **argv) {
         [SLAB_AUTOMOVE_WINDOW] = "slab_automove_window",
         [TAIL_REPAIR_TIME] = "tail_repair_time",
         [HASH_ALGORITHM] = "hash_algorithm",
+        [HASH_TABLE] = "hash_table",
         [LRU_CRAWLER] = "lru_crawler",
         [LRU_CRAWLER_SLEEP] = "lru_crawler_sleep",
         [LRU_CRAWLER_TOCRAWL] = "lru_crawler_tocrawl",
@@ -4799,6 +4980,9 @@ int main (int argc, char **argv) {
         [WORKER_LOGBUF_SIZE] = "worker_logbuf_size",
         [SLAB_SIZES] = "slab_sizes",
         [SLAB_CHUNK_MAX] = "slab_chunk_max",
+        [SLAB_CACHE] = "slab_cache",
+        [SLAB_HUGEPAGES] = "slab_hugepages",
+        [SLAB_NUMA] = "slab_numa",
         [TRACK_SIZES] = "track_sizes",
         [NO_INLINE_ASCII_RESP] = "no_inline_ascii_resp",
         [MODERN] = "modern",
@@ -4814,6 +4998,17 @@ int main (int argc, char **argv) {
         [DROP_PRIVILEGES] = "drop_privileges",
         [RESP_OBJ_MEM_LIMIT] = "resp_obj_mem_limit",
         [READ_BUF_MEM_LIMIT] = "read_buf_mem_limit",
+        [EMB_INLINE] = "emb_inline",
+        [EMB_PRECISION] = "emb_precision",
+        [NO_EMB_SIMD] = "no_emb_simd",
+        [EMB_ASYNC_TRAIN] = "emb_async_train",
+        [EMB_MODEL] = "emb_model",
+        [EMB_EVICT_SCORE] = "emb_evict_score",
+        [EMB_ANN_LISTS] = "emb_ann_lists",
+        [EMB_SHARDS] = "emb_shards",
+        [EVICT_POLICY] = "evict_policy",
+        [TINYLFU_WINDOW_PCT] = "tinylfu_window_pct",
+        [EVICT_GHOST_SIZE] = "evict_ghost_size",
 #ifdef TLS
         [SSL_CERT] = "ssl_chain_cert",
         [SSL_KEY] = "ssl_key",
@@ -4855,6 +5050,7 @@ int main (int argc, char **argv) {
     /* init settings */
     settings_init();
     verify_default("hash_algorithm", hash_type == MURMUR3_HASH);
+    verify_default("hash_table", settings.hash_table == ASSOC_TABLE_CHAINED);
     void *storage = NULL;
 #ifdef EXTSTORE
     void *storage_cf = storage_init_config(&settings);
@@ -5275,6 +5471,20 @@ int main (int argc, char **argv) {
                     goto error;
                 }
                 break;
+            case HASH_TABLE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing hash_table argument\n");
+                    goto error;
+                }
+                if (strcmp(subopts_value, "chained") == 0) {
+                    settings.hash_table = ASSOC_TABLE_CHAINED;
+                } else if (strcmp(subopts_value, "tagged") == 0) {
+                    settings.hash_table = ASSOC_TABLE_TAGGED;
+                } else {
+                    fprintf(stderr, "Unknown hash_table option (chained, tagged)\n");
+                    goto error;
+                }
+                break;
             case LRU_CRAWLER:
                 start_lru_crawler = true;
                 break;
@@ -5407,6 +5617,44 @@ int main (int argc, char **argv) {
                 settings.slab_chunk_size_max *= (1 << 10);
                 slab_chunk_size_changed = true;
                 break;
+            case SLAB_CACHE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing slab_cache argument\n");
+                    goto error;
+                }
+                if (!safe_strtoul(subopts_value, &settings.slab_cache)
+                        || settings.slab_cache > SLABS_CACHE_MAX) {
+                    fprintf(stderr, "slab_cache must be between 0 and %d\n",
+                            SLABS_CACHE_MAX);
+                    goto error;
+                }
+                break;
+#ifdef __linux__
+            case SLAB_HUGEPAGES:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing slab_hugepages argument\n");
+                    goto error;
+                }
+                if (strcmp(subopts_value, "thp") == 0) {
+                    settings.slab_hugepages = SLAB_HUGEPAGES_THP;
+                } else if (strcmp(subopts_value, "2m") == 0) {
+                    settings.slab_hugepages = SLAB_HUGEPAGES_2M;
+                } else if (strcmp(subopts_value, "1g") == 0) {
+                    settings.slab_hugepages = SLAB_HUGEPAGES_1G;
+                } else {
+                    fprintf(stderr, "Unknown slab_hugepages option (thp, 2m, 1g)\n");
+                    goto error;
+                }
+                break;
+            case SLAB_NUMA:
+                settings.slab_numa = true;
+                break;
+#else
+            case SLAB_HUGEPAGES:
+            case SLAB_NUMA:
+                fprintf(stderr, "slab_hugepages and slab_numa are only supported on linux\n");
+                goto error;
+#endif
             case TRACK_SIZES:
                 item_stats_sizes_init();
                 break;
@@ -5560,6 +5808,117 @@ int main (int argc, char **argv) {
                 }
                 settings.read_buf_mem_limit *= 1024 * 1024; /* megabytes */
                 break;
+            case EMB_INLINE:
+                settings.emb_inline = true;
+                break;
+            case EMB_PRECISION:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing emb_precision argument\n");
+                    goto error;
+                }
+                if (strcmp(subopts_value, "fp32") == 0) {
+                    settings.emb_precision = EMB_PRECISION_FP32;
+                } else if (strcmp(subopts_value, "fp16") == 0) {
+                    settings.emb_precision = EMB_PRECISION_FP16;
+                } else if (strcmp(subopts_value, "int8") == 0) {
+                    settings.emb_precision = EMB_PRECISION_INT8;
+                } else {
+                    fprintf(stderr, "Unknown emb_precision option (fp32, fp16, int8)\n");
+                    goto error;
+                }
+                break;
+            case NO_EMB_SIMD:
+                settings.emb_simd = false;
+                break;
+            case EMB_ASYNC_TRAIN:
+                settings.emb_async_train = true;
+                break;
+            case EMB_MODEL:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing emb_model argument\n");
+                    goto error;
+                }
+                if (strcmp(subopts_value, "avg") == 0) {
+                    settings.emb_model = EMB_MODEL_AVG;
+                } else if (strcmp(subopts_value, "sgns") == 0) {
+                    settings.emb_model = EMB_MODEL_SGNS;
+                } else {
+                    fprintf(stderr, "Unknown emb_model option (avg, sgns)\n");
+                    goto error;
+                }
+                break;
+            case EMB_EVICT_SCORE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing emb_evict_score argument\n");
+                    goto error;
+                }
+                if (strcmp(subopts_value, "sim") == 0) {
+                    settings.emb_evict_score = EMB_EVICT_SIM;
+                } else if (strcmp(subopts_value, "gdsf") == 0) {
+                    settings.emb_evict_score = EMB_EVICT_GDSF;
+                } else {
+                    fprintf(stderr, "Unknown emb_evict_score option (sim, gdsf)\n");
+                    goto error;
+                }
+                break;
+            case EMB_ANN_LISTS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing emb_ann_lists argument\n");
+                    goto error;
+                }
+                if (!safe_strtoul(subopts_value, &settings.emb_ann_lists)
+                        || settings.emb_ann_lists > EMB_ANN_MAX_LISTS) {
+                    fprintf(stderr, "emb_ann_lists must be between 0 and %d\n",
+                            EMB_ANN_MAX_LISTS);
+                    goto error;
+                }
+                break;
+            case EMB_SHARDS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing emb_shards argument\n");
+                    goto error;
+                }
+                if (!safe_strtoul(subopts_value, &settings.emb_shards)
+                        || settings.emb_shards == 0
+                        || settings.emb_shards > EMB_MAX_SHARDS
+                        || (settings.emb_shards & (settings.emb_shards - 1)) != 0) {
+                    fprintf(stderr, "emb_shards must be a power of two between 1 and %d\n",
+                            EMB_MAX_SHARDS);
+                    goto error;
+                }
+                break;
+            case EVICT_POLICY:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing evict_policy argument\n");
+                    goto error;
+                }
+                evict_policy = evict_policy_find(subopts_value);
+                if (evict_policy == NULL) {
+                    fprintf(stderr, "Unknown evict_policy option (lru, segmented, emb, tinylfu)\n");
+                    goto error;
+                }
+                break;
+            case TINYLFU_WINDOW_PCT:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing tinylfu_window_pct argument\n");
+                    goto error;
+                }
+                settings.tinylfu_window_pct = atoi(subopts_value);
+                if (settings.tinylfu_window_pct < 1 || settings.tinylfu_window_pct > 50) {
+                    fprintf(stderr, "tinylfu_window_pct must be >= 1 and <= 50\n");
+                    goto error;
+                }
+                break;
+            case EVICT_GHOST_SIZE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing evict_ghost_size argument\n");
+                    goto error;
+                }
+                if (!safe_strtoul(subopts_value, &settings.evict_ghost_size)) {
+                    fprintf(stderr, "could not parse argument to evict_ghost_size\n");
+                    goto error;
+                }
+                break;
 #ifdef PROXY
             case PROXY_CONFIG:
                 if (subopts_value == NULL) {
@@ -5704,6 +6063,51 @@ int main (int argc, char **argv) {
         exit(EX_USAGE);
     }
 
+    /* The eviction policy decides the LRU layout. */
+    if (evict_policy == NULL) {
+        evict_policy = evict_policy_find(start_lru_maintainer ? "segmented" : "lru");
+    }
+    settings.lru_segmented = evict_policy->lru_segmented;
+    if (settings.lru_segmented && !start_lru_maintainer) {
+        fprintf(stderr, "evict_policy=%s requires lru_maintainer to be enabled\n",
+                evict_policy->name);
+        exit(EX_USAGE);
+    }
+
+    if ((settings.emb_inline || settings.emb_async_train
+                || settings.emb_model != EMB_MODEL_AVG || settings.emb_ann_lists
+                || settings.emb_evict_score != EMB_EVICT_SIM
+                || settings.emb_shards != EMB_DEFAULT_SHARDS)
+            && evict_policy != &evict_policy_emb) {
+        fprintf(stderr, "emb_inline, emb_async_train, emb_model, emb_evict_score, emb_ann_lists and emb_shards require evict_policy=emb\n");
+        exit(EX_USAGE);
+    }
+
+#ifdef EXTSTORE
+    if (settings.ext_prefetch_rate && evict_policy != &evict_policy_emb) {
+        fprintf(stderr, "ext_prefetch_rate requires evict_policy=emb\n");
+        exit(EX_USAGE);
+    }
+#endif
+
+    // sgns learns from each thread's access sequence, which only the
+    // background trainer sees.
+    if (settings.emb_model == EMB_MODEL_SGNS) {
+        settings.emb_async_train = true;
+    }
+
+    // Only inline embeddings live in the memory file, so they are the ones
+    // that survive a warm restart.
+    if (settings.memory_file != NULL && evict_policy == &evict_policy_emb) {
+        settings.emb_inline = true;
+    }
+
+    if (settings.memory_file != NULL
+            && (settings.slab_hugepages != SLAB_HUGEPAGES_NONE || settings.slab_numa)) {
+        fprintf(stderr, "slab_hugepages and slab_numa cannot be used with a memory file (-e)\n");
+        exit(EX_USAGE);
+    }
+
     if (hash_init(hash_type) != 0) {
         fprintf(stderr, "Failed to initialize hash_algorithm!\n");
         exit(EX_USAGE);
@@ -5915,7 +6319,10 @@ int main (int argc, char **argv) {
     }
 
     /* initialize other stuff */
-	emb_init();
+    if (evict_policy->init) {
+        evict_policy->init();
+    }
+    item_ghost_init();
     stats_init();
     logger_init();
     logger_create(); // main process logger
@@ -6025,6 +6432,11 @@ int main (int argc, char **argv) {
         fprintf(stderr, "Failed to start storage compaction thread\n");
         exit(EXIT_FAILURE);
     }
+    if (storage && evict_policy == &evict_policy_emb
+            && start_storage_prefetch_thread(storage) != 0) {
+        fprintf(stderr, "Failed to start storage prefetch thread\n");
+        exit(EXIT_FAILURE);
+    }
     if (storage && start_storage_write_thread(storage) != 0) {
         fprintf(stderr, "Failed to start storage writer thread\n");
         exit(EXIT_FAILURE);
@@ -6039,6 +6451,11 @@ int main (int argc, char **argv) {
         return 1;
     }
 
+    if (evict_policy->start && evict_policy->start() != 0) {
+        fprintf(stderr, "Failed to start %s eviction policy threads\n", evict_policy->name);
+        exit(EXIT_FAILURE);
+    }
+
     if (settings.slab_reassign) {
         settings.slab_rebal = start_slab_maintenance_thread(storage);
         if (!settings.slab_rebal) {
@@ -6072,6 +6489,11 @@ int main (int argc, char **argv) {
 #endif
     clock_handler(0, 0, 0);
 
+#ifdef EVICTSIM
+    /* Replay the trace against the cache instead of serving clients. */
+    return evictsim_replay();
+#endif
+
     /* create unix mode sockets after dropping privileges */
     if (settings.socketpath != NULL) {
         errno = 0;
@@ -133,20 +133,28 @@ typedef uint32_t client_flags_t;
     } \
 }
 
-#define ITEM_key(item) (((char*)&((item)->data)) \
+/* inline embedding block, only valid if it_flags & ITEM_EMB */
+#define ITEM_emb(item) (((char*)&((item)->data)) \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
+#define ITEM_key(item) (((char*)&((item)->data)) \
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_EMB) ? settings.emb_item_size : 0))
+
 #define ITEM_suffix(item) ((char*) &((item)->data) + (item)->nkey + 1 \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_EMB) ? settings.emb_item_size : 0))
 
 #define ITEM_data(item) ((char*) &((item)->data) + (item)->nkey + 1 \
          + (((item)->it_flags & ITEM_CFLAGS) ? sizeof(client_flags_t) : 0) \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_EMB) ? settings.emb_item_size : 0))
 
 #define ITEM_ntotal(item) (sizeof(struct _stritem) + (item)->nkey + 1 \
          + (item)->nbytes \
          + (((item)->it_flags & ITEM_CFLAGS) ? sizeof(client_flags_t) : 0) \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_EMB) ? settings.emb_item_size : 0))
 
 #define ITEM_clsid(item) ((item)->slabs_clsid & ~(3<<6))
 #define ITEM_lruid(item) ((item)->slabs_clsid & (3<<6))
@@ -413,6 +421,9 @@ struct stats {
     uint64_t      extstore_compact_skipped; /* unhit items skipped during compaction */
     uint64_t      extstore_compact_resc_cold; /* items re-written during compaction */
     uint64_t      extstore_compact_resc_old; /* items re-written during compaction */
+    uint64_t      extstore_prefetch_queued; /* predicted reads queued */
+    uint64_t      extstore_prefetch_dropped; /* predicted reads lost to a full queue */
+    uint64_t      extstore_prefetch_recached; /* items read back ahead of a request */
 #endif
 #ifdef TLS
     uint64_t      ssl_proto_errors; /* TLS failures during SSL_read() and SSL_write() calls */
@@ -433,12 +444,13 @@ struct stats_state {
     uint64_t      curr_bytes;
     uint64_t      curr_conns;
     uint64_t      hash_bytes;       /* size used for hash tables */
+    uint64_t      hash_buckets;     /* buckets in the hash table */
     float         extstore_memory_pressure; /* when extstore might memory evict */
     unsigned int  conn_structs;
     unsigned int  reserved_fds;
     unsigned int  hash_power_level; /* Better hope it's not over 9000 */
     unsigned int  log_watchers; /* number of currently active watchers */
-    bool          hash_is_expanding; /* If the hash table is being expanded */
+    bool          hash_is_expanding; /* If the hash table is being resized */
     bool          accepting_conns;  /* whether we are currently accepting */
     bool          slab_reassign_running; /* slab reassign in progress */
     bool          lru_crawler_running; /* crawl in progress */
@@ -482,7 +494,21 @@ struct settings {
     bool lru_crawler;        /* Whether or not to enable the autocrawler thread */
     bool lru_maintainer_thread; /* LRU maintainer background thread */
     bool lru_segmented;     /* Use split or flat LRU's */
+    bool emb_inline;        /* store embeddings inside the item */
+    unsigned int emb_item_size; /* bytes added to items by emb_inline */
+    int emb_precision;      /* enum emb_precision: storage format of vectors */
+    bool emb_simd;          /* use SIMD embedding kernels if the CPU has them */
+    bool emb_async_train;   /* train embeddings in the background on hits */
+    int emb_model;          /* enum emb_model: how item vectors are trained */
+    int emb_evict_score;    /* enum emb_evict_score: how victims are ranked */
+    unsigned int emb_ann_lists; /* lists in the nearest neighbour index, 0 for none */
+    unsigned int emb_shards; /* sampling pools per slab class, a power of two */
+    int tinylfu_window_pct; /* pct of a class the tinylfu window may hold */
+    unsigned int evict_ghost_size; /* evicted keys remembered for stats evictpolicy */
     bool slab_reassign;     /* Whether or not slab reassignment is allowed */
+    unsigned int slab_cache; /* free chunks per class each worker may cache */
+    int slab_hugepages;     /* enum slab_hugepages: how slab pages are mapped */
+    bool slab_numa;         /* NUMA local slab pages, workers kept on a node */
     bool ssl_enabled; /* indicates whether SSL is enabled */
     int slab_automove;     /* Whether or not to automatically move slabs */
     unsigned int slab_automove_version; /* bump if AM config args change */
@@ -495,6 +521,7 @@ struct settings {
     bool flush_enabled;     /* flush_all enabled */
     bool dump_enabled;      /* whether cachedump/metadump commands work */
     char *hash_algorithm;     /* Hash algorithm in use */
+    int hash_table;           /* enum assoc_table: hash table layout */
     int lru_crawler_sleep;  /* Microsecond sleep between items */
     uint32_t lru_crawler_tocrawl; /* Number of items to crawl per run */
     int hot_lru_pct; /* percentage of slab space for HOT_LRU */
@@ -519,6 +546,7 @@ struct settings {
     unsigned int ext_item_age; /* max age of tail item before storing ext. */
     unsigned int ext_low_ttl; /* remaining TTL below this uses own pages */
     unsigned int ext_recache_rate; /* counter++ % recache_rate == 0 > recache */
+    unsigned int ext_prefetch_rate; /* max predicted reads per second, 0 is off */
     unsigned int ext_wbuf_size; /* read only note for the engine */
     unsigned int ext_compact_under; /* when fewer than this many pages, compact */
     unsigned int ext_drop_under; /* when fewer than this many pages, drop COLD items */
@@ -587,6 +615,8 @@ extern struct settings settings;
 #define ITEM_STALE 2048
 /* if item key was sent in binary */
 #define ITEM_KEY_BINARY 4096
+/* item carries an inline embedding between the CAS and the key */
+#define ITEM_EMB 8192
 
 /**
  * Structure for storing items within memcached.
@@ -604,6 +634,8 @@ typedef struct _stritem {
     uint16_t        it_flags;   /* ITEM_* above */
     uint8_t         slabs_clsid;/* which slab class we're in */
     uint8_t         nkey;       /* key length, w/terminating null and padding */
+    uint16_t        cost;       /* client's fetch cost hint (ms U), 0 if none */
+    uint32_t        hv;         /* hash of the key, set when linked */
     /* this odd type prevents type-punning issues when we do
      * the little shuffle to save space when not using CAS. */
     union {
@@ -611,6 +643,7 @@ typedef struct _stritem {
         char end;
     } data[];
     /* if it_flags & ITEM_CAS we have 8 bytes CAS */
+    /* if it_flags & ITEM_EMB we have settings.emb_item_size bytes embedding */
     /* then null-terminated key */
     /* then " flags length\r\n" (no terminating null) */
     /* then data with terminating \r\n (no terminating null; it's binary!) */
@@ -657,7 +690,8 @@ typedef struct _strchunk {
 static inline char *ITEM_schunk(item *it) {
     int offset = it->nkey + 1
         + ((it->it_flags & ITEM_CFLAGS) ? sizeof(client_flags_t) : 0)
-        + ((it->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0);
+        + ((it->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0)
+        + ((it->it_flags & ITEM_EMB) ? settings.emb_item_size : 0);
     int remain = offset % 8;
     if (remain != 0) {
         offset += 8 - remain;
@@ -667,7 +701,8 @@ static inline char *ITEM_schunk(item *it) {
 #else
 #define ITEM_schunk(item) ((char*) &((item)->data) + (item)->nkey + 1 \
          + (((item)->it_flags & ITEM_CFLAGS) ? sizeof(client_flags_t) : 0) \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_EMB) ? settings.emb_item_size : 0))
 #endif
 
 #ifdef EXTSTORE
@@ -714,6 +749,22 @@ struct thread_notify {
 #endif
 };
 
+/* most keys item_get_batch() takes at once */
+#define ITEM_BATCH_MAX 32
+
+/* Keys of the pipelined mg lines a conn has waiting in its read buffer,
+ * hashed ahead of their lookups, see prefetch_mg_pipeline(). Entries are
+ * pointers into the read buffer, so they are dropped whenever it moves. */
+struct mg_batch {
+    struct conn *c;             /* conn the lines belong to, or NULL */
+    int n;
+    int next;                   /* entry of the next mg line */
+    int cur;                    /* entry of the line being processed, or -1 */
+    const char *keys[ITEM_BATCH_MAX];
+    uint8_t nkeys[ITEM_BATCH_MAX];
+    uint32_t hvs[ITEM_BATCH_MAX];
+};
+
 typedef struct _mc_resp_bundle mc_resp_bundle;
 typedef struct {
     pthread_t thread_id;        /* unique ID of this thread */
@@ -736,6 +787,8 @@ typedef struct {
 #endif
     logger *l;                  /* logger buffer */
     void *lru_bump_buf;         /* async LRU bump buffer */
+    void *evict_thread;         /* per-thread eviction policy state */
+    struct mg_batch mg_batch;   /* hashed keys of upcoming mg lines */
 #ifdef TLS
     char   *ssl_wbuf;
 #endif
@@ -979,6 +1032,11 @@ extern int daemonize(int nochdir, int noclose);
  * also #define-d to directly call the underlying code in singlethreaded mode.
  */
 void memcached_thread_init(int nthreads, void *arg);
+#ifdef EVICTSIM
+/* Offline trace replay, see evictsim.c */
+int memcached_main(int argc, char **argv);
+int evictsim_replay(void);
+#endif
 void redispatch_conn(conn *c);
 void timeout_conn(conn *c);
 #ifdef PROXY
@@ -1001,7 +1059,12 @@ item *item_alloc(const char *key, size_t nkey, client_flags_t flags, rel_time_t
 #define DO_UPDATE true
 #define DONT_UPDATE false
 item *item_get(const char *key, const size_t nkey, LIBEVENT_THREAD *t, const bool do_update);
+item *item_get_hv(const char *key, const size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, const bool do_update);
 item *item_get_locked(const char *key, const size_t nkey, LIBEVENT_THREAD *t, const bool do_update, uint32_t *hv);
+item *item_get_locked_hv(const char *key, const size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, const bool do_update);
+void item_prefetch_batch(const char **keys, const size_t *nkeys, uint32_t *hvs, const int n);
+void item_prefetch_items(const uint32_t *hvs, const int n);
+void item_get_batch(const char **keys, const size_t *nkeys, const int n, item **items, LIBEVENT_THREAD *t, const bool do_update);
 item *item_touch(const char *key, const size_t nkey, uint32_t exptime, LIBEVENT_THREAD *t);
 int   item_link(item *it);
 void  item_remove(item *it);
@@ -1044,6 +1107,9 @@ void out_string(conn *c, const char *str);
 rel_time_t realtime(const time_t exptime);
 item* limited_get(const char *key, size_t nkey, LIBEVENT_THREAD *t, uint32_t exptime, bool should_touch, bool do_update, bool *overflow);
 item* limited_get_locked(const char *key, size_t nkey, LIBEVENT_THREAD *t, bool do_update, uint32_t *hv, bool *overflow);
+item* limited_get_hv(const char *key, size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, bool do_update, bool *overflow);
+item* limited_get_locked_hv(const char *key, size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, bool do_update, bool *overflow);
+void limited_get_batch(const char **keys, const size_t *nkeys, const int n, item **items, LIBEVENT_THREAD *t, bool do_update);
 // Read/Response object handlers.
 void resp_reset(mc_resp *resp);
 void resp_add_iov(mc_resp *resp, const void *buf, int len);
@@ -11,6 +11,7 @@
 #include "proto_proxy.h"
 #include "authfile.h"
 #include "storage.h"
+#include "embeddings.h"
 #include "base64.h"
 #include "tls.h"
 #include <string.h>
@@ -442,6 +443,72 @@ int try_read_command_asciiauth(conn *c) {
     return 1;
 }
 
+/*
+ * A pipeline of mg requests is read in one go but handled a line at a time.
+ * When the first of a run of them comes up, hash the keys of as many of the
+ * complete mg lines from it on as are already in rbuf, and prefetch their
+ * buckets and then the items in them, so their lookups don't each wait on
+ * memory in turn. The hashes
+ * are kept for the lookups, see mg_batch_hv(). Base64 keys hash differently
+ * once decoded, so for them the prefetch is wasted and the hash unused.
+ */
+static void prefetch_mg_pipeline(conn *c) {
+    struct mg_batch *b = &c->thread->mg_batch;
+    char *p = c->rcurr;
+    char *end = c->rcurr + c->rbytes;
+    int n = 0;
+
+    while (n < ITEM_BATCH_MAX && end - p > 3 && strncmp(p, "mg ", 3) == 0) {
+        char *el = memchr(p, '\n', end - p);
+        if (el == NULL) {
+            break;
+        }
+        char *key = p + 3;
+        while (*key == ' ') {
+            key++;
+        }
+        char *e = key;
+        while (*e != ' ' && *e != '\r' && *e != '\n') {
+            e++;
+        }
+        if (e == key || e - key > KEY_MAX_LENGTH) {
+            break;
+        }
+        size_t nkey = e - key;
+        b->keys[n] = key;
+        b->nkeys[n] = nkey;
+        item_prefetch_batch(&b->keys[n], &nkey, &b->hvs[n], 1);
+        n++;
+        p = el + 1;
+    }
+    item_prefetch_items(b->hvs, n);
+
+    b->c = c;
+    b->n = n;
+    b->next = 0;
+}
+
+/* Forget c's hashed mg keys: its read buffer is about to move or go. */
+void prefetch_mg_reset(conn *c) {
+    if (c->thread->mg_batch.c == c) {
+        c->thread->mg_batch.c = NULL;
+    }
+}
+
+/* The hash prefetch_mg_pipeline() computed for the key of the mg line being
+ * processed, if it has one. The key must still be the one hashed, at the
+ * same place in rbuf. */
+static bool mg_batch_hv(conn *c, const char *key, const size_t nkey, uint32_t *hv) {
+    struct mg_batch *b = &c->thread->mg_batch;
+    int i = b->cur;
+    if (b->c != c || i < 0 || i >= b->n
+            || b->keys[i] != key || b->nkeys[i] != nkey) {
+        return false;
+    }
+    *hv = b->hvs[i];
+    return true;
+}
+
 int try_read_command_ascii(conn *c) {
     char *el, *cont;
 
@@ -480,6 +547,16 @@ int try_read_command_ascii(conn *c) {
 
         return 0;
     }
+    if (strncmp(c->rcurr, "mg ", 3) == 0) {
+        struct mg_batch *b = &c->thread->mg_batch;
+        if (b->c != c || b->next >= b->n) {
+            prefetch_mg_pipeline(c);
+        }
+        b->cur = b->next < b->n ? b->next++ : -1;
+    } else {
+        prefetch_mg_reset(c);
+    }
+
     cont = el + 1;
     if ((el - c->rcurr) > 1 && *(el - 1) == '\r') {
         el--;
@@ -552,6 +629,10 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
     int32_t exptime_int = 0;
     rel_time_t exptime = 0;
     bool fail_length = false;
+    // keys of this line looked up together, see item_get_batch()
+    item *batch[ITEM_BATCH_MAX];
+    int batch_n = 0;
+    int batch_i = 0;
     assert(c != NULL);
     mc_resp *resp = c->resp;
 
@@ -566,6 +647,22 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
     }
 
     do {
+        batch_n = batch_i = 0;
+        if (!should_touch) {
+            const char *keys[ITEM_BATCH_MAX];
+            size_t nkeys[ITEM_BATCH_MAX];
+            for (token_t *t = key_token; t->length != 0 && t->length <= KEY_MAX_LENGTH
+                    && batch_n < ITEM_BATCH_MAX; t++) {
+                keys[batch_n] = t->value;
+                nkeys[batch_n++] = t->length;
+            }
+            if (batch_n > 1) {
+                limited_get_batch(keys, nkeys, batch_n, batch, c->thread, DO_UPDATE);
+            } else {
+                batch_n = 0;
+            }
+        }
+
         while(key_token->length != 0) {
             bool overflow; // not used here.
             key = key_token->value;
@@ -576,7 +673,11 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 goto stop;
             }
 
-            it = limited_get(key, nkey, c->thread, exptime, should_touch, DO_UPDATE, &overflow);
+            if (batch_i < batch_n) {
+                it = batch[batch_i++];
+            } else {
+                it = limited_get(key, nkey, c->thread, exptime, should_touch, DO_UPDATE, &overflow);
+            }
             if (settings.detail_enabled) {
                 stats_prefix_record_get(key, nkey, NULL != it);
             }
@@ -663,6 +764,7 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 }
                 MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
                 pthread_mutex_unlock(&c->thread->stats.mutex);
+                item_ghost_check(key, nkey);
             }
 
             key_token++;
@@ -688,6 +790,13 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
         }
     } while(key_token->value != NULL);
 stop:
+    // looked up, but not sent
+    while (batch_i < batch_n) {
+        if (batch[batch_i]) {
+            item_remove(batch[batch_i]);
+        }
+        batch_i++;
+    }
 
     if (settings.verbose > 1)
         fprintf(stderr, ">%d END\n", c->sfd);
@@ -800,6 +909,8 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
         return;
     } else if (strcmp(subcommand, "conns") == 0) {
         process_stats_conns(&append_stats, c);
+    } else if (strcmp(subcommand, "evictpolicy") == 0) {
+        item_stats_evictpolicy(&append_stats, c);
 #ifdef EXTSTORE
     } else if (strcmp(subcommand, "extstore") == 0) {
         process_extstore_stats(&append_stats, c);
@@ -907,6 +1018,158 @@ static void process_meta_command(conn *c, token_t *tokens, const size_t ntokens)
 #define MFLAG_MAX_OPT_LENGTH 20
 #define MFLAG_MAX_OPAQUE_LENGTH 32
 
+#define MK_DEFAULT_COUNT 10
+
+// mk: keys whose learned access embeddings are nearest to a key's, or to a
+// vector given with the v flag.
+static void process_mnearest_command(conn *c, token_t *tokens, const size_t ntokens) {
+    assert(c != NULL);
+
+    if (ntokens < 3 || tokens[KEY_TOKEN].length > KEY_MAX_LENGTH) {
+        out_string(c, "CLIENT_ERROR bad command line format");
+        return;
+    }
+    if (settings.emb_ann_lists == 0) {
+        out_string(c, "CLIENT_ERROR embedding index not enabled");
+        return;
+    }
+    // returns other clients' keys, so -X disables it like the key dumps
+    if (!settings.dump_enabled) {
+        out_string(c, "CLIENT_ERROR mk not allowed");
+        return;
+    }
+
+    char *key = tokens[KEY_TOKEN].value;
+    size_t nkey = tokens[KEY_TOKEN].length;
+    int32_t count = MK_DEFAULT_COUNT;
+    double max_dist = 2.0;
+    bool has_vec = false;
+    embedding vec;
+    token_t *opaque = NULL;
+    uint8_t seen[127] = {0};
+
+    for (size_t i = KEY_TOKEN + 1; i < ntokens - 1; i++) {
+        uint8_t o = (uint8_t)tokens[i].value[0];
+        if (o >= 127 || seen[o] != 0) {
+            out_string(c, "CLIENT_ERROR duplicate flag");
+            return;
+        }
+        seen[o] = 1;
+        switch (o) {
+            case 'b':
+                nkey = base64_decode((unsigned char *)key, nkey,
+                            (unsigned char *)key, nkey);
+                if (nkey == 0) {
+                    out_string(c, "CLIENT_ERROR error decoding key");
+                    return;
+                }
+                break;
+            case 'n':
+                if (!safe_strtol(tokens[i].value+1, &count)
+                        || count < 1 || count > EMB_ANN_MAX_K) {
+                    out_string(c, "CLIENT_ERROR bad token in command line format");
+                    return;
+                }
+                break;
+            case 'd':
+                if (!safe_strtod(tokens[i].value+1, &max_dist) || max_dist < 0) {
+                    out_string(c, "CLIENT_ERROR bad token in command line format");
+                    return;
+                }
+                break;
+            case 'v': {
+                char *p = tokens[i].value + 1;
+                for (int j = 0; j < EMBEDDING_DIM; j++) {
+                    char *end;
+                    vec.vec[j] = strtof(p, &end);
+                    if (end == p || *end != (j == EMBEDDING_DIM - 1 ? '\0' : ',')) {
+                        out_string(c, "CLIENT_ERROR bad vector");
+                        return;
+                    }
+                    p = end + 1;
+                }
+                has_vec = true;
+                break;
+            }
+            case 'O':
+                if (tokens[i].length > MFLAG_MAX_OPAQUE_LENGTH) {
+                    out_string(c, "CLIENT_ERROR opaque token too long");
+                    return;
+                }
+                opaque = &tokens[i];
+                break;
+            default:
+                out_string(c, "CLIENT_ERROR invalid flag");
+                return;
+        }
+    }
+
+    emb_neighbour *nb = malloc(sizeof(emb_neighbour) * count);
+    if (nb == NULL) {
+        out_of_memory(c, "SERVER_ERROR out of memory");
+        return;
+    }
+
+    int found;
+    if (has_vec) {
+        found = emb_ann_query(NULL, &vec, nb, count, max_dist);
+    } else {
+        bool overflow; // not used here.
+        item *it = limited_get(key, nkey, c->thread, 0, false, DONT_UPDATE, &overflow);
+        if (it == NULL) {
+            found = -1;
+        } else {
+            found = emb_ann_query(it, NULL, nb, count, max_dist);
+            item_remove(it);
+        }
+    }
+
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    c->thread->stats.meta_cmds++;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+
+    if (found < 0) {
+        free(nb);
+        out_string(c, "EN");
+        return;
+    }
+
+    // "NB k<key> b s<sim>\r\n" with the key base64 encoded at worst.
+    size_t size = 64 + MFLAG_MAX_OPAQUE_LENGTH
+        + found * (((KEY_MAX_LENGTH + 2) / 3) * 4 + 32);
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        free(nb);
+        out_of_memory(c, "SERVER_ERROR out of memory");
+        return;
+    }
+    char *p = buf;
+    p += snprintf(p, size, "MK %d", found);
+    if (opaque != NULL) {
+        META_SPACE(p);
+        memcpy(p, opaque->value, opaque->length);
+        p += opaque->length;
+    }
+    memcpy(p, "\r\n", 2);
+    p += 2;
+    for (int i = 0; i < found; i++) {
+        memcpy(p, "NB", 2);
+        p += 2;
+        META_CHAR(p, 'k');
+        if (!nb[i].binary) {
+            memcpy(p, nb[i].key, nb[i].nkey);
+            p += nb[i].nkey;
+        } else {
+            p += base64_encode((unsigned char *) nb[i].key, nb[i].nkey,
+                    (unsigned char *)p, size - (p - buf));
+            META_CHAR(p, 'b');
+        }
+        p += snprintf(p, size - (p - buf), " s%.4f\r\n", nb[i].sim);
+    }
+    free(nb);
+    write_and_free(c, buf, p - buf);
+}
+
 struct _meta_flags {
     unsigned int has_error :1; // flipped if we found an error during parsing.
     unsigned int no_update :1;
@@ -931,6 +1194,7 @@ struct _meta_flags {
     uint64_t cas_id_in; // client supplied next-CAS
     uint64_t delta; // ma
     uint64_t initial; // ma
+    uint16_t cost; // ms eviction cost hint
 };
 
 static int _meta_flag_preparse(token_t *tokens, const size_t start,
@@ -938,6 +1202,7 @@ static int _meta_flag_preparse(token_t *tokens, const size_t start,
     unsigned int i;
     size_t ret;
     int32_t tmp_int;
+    uint32_t tmp_uint;
     uint8_t seen[127] = {0};
     // Start just past the key token. Look at first character of each token.
     for (i = start; tokens[i].length != 0; i++) {
@@ -1068,6 +1333,18 @@ static int _meta_flag_preparse(token_t *tokens, const size_t start,
             case 'I':
                 of->set_stale = 1;
                 break;
+            case 'U': // ms cost hint, unused by other commands
+                if (strcmp(tokens[COMMAND_TOKEN].value, "ms") != 0) {
+                    *errstr = "CLIENT_ERROR invalid flag";
+                    return -1;
+                }
+                if (!safe_strtoul(tokens[i].value+1, &tmp_uint) || tmp_uint > UINT16_MAX) {
+                    *errstr = "CLIENT_ERROR bad token in command line format";
+                    of->has_error = 1;
+                } else {
+                    of->cost = tmp_uint;
+                }
+                break;
             default: // unknown flag, bail.
                 *errstr = "CLIENT_ERROR invalid flag";
                 return -1;
@@ -1125,10 +1402,17 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
     // TODO: need to indicate if the item was overflowed or not?
     // I think we do, since an overflow shouldn't trigger an alloc/replace.
     bool overflow = false;
+    bool have_hv = !of.key_binary && mg_batch_hv(c, key, nkey, &hv);
     if (!of.locked) {
-        it = limited_get(key, nkey, c->thread, 0, false, !of.no_update, &overflow);
-    } else {
+        if (have_hv) {
+            it = limited_get_hv(key, nkey, hv, c->thread, !of.no_update, &overflow);
+        } else {
+            it = limited_get(key, nkey, c->thread, 0, false, !of.no_update, &overflow);
+        }
+    } else if (have_hv) {
         // If we had to lock the item, we're doing our own bump later.
+        it = limited_get_locked_hv(key, nkey, hv, c->thread, DONT_UPDATE, &overflow);
+    } else {
         it = limited_get_locked(key, nkey, c->thread, DONT_UPDATE, &hv, &overflow);
     }
 
@@ -1357,6 +1641,7 @@ static void process_mget_command(conn *c, token_t *tokens, const size_t ntokens)
         }
         MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
         pthread_mutex_unlock(&c->thread->stats.mutex);
+        item_ghost_check(key, nkey);
 
         // This gets elided in noreply mode.
         if (c->noreply)
@@ -1573,6 +1858,7 @@ static void process_mset_command(conn *c, token_t *tokens, const size_t ntokens)
         goto error;
     }
     ITEM_set_cas(it, of.req_cas_id);
+    it->cost = of.cost;
 
     c->item = it;
 #ifdef NEED_ALIGN
@@ -2568,6 +2854,9 @@ static void process_extstore_command(conn *c, token_t *tokens, const size_t ntok
     } else if (strcmp(tokens[1].value, "recache_rate") == 0) {
         if (!safe_strtoul(tokens[2].value, &settings.ext_recache_rate))
             ok = false;
+    } else if (strcmp(tokens[1].value, "prefetch_rate") == 0) {
+        if (!safe_strtoul(tokens[2].value, &settings.ext_prefetch_rate))
+            ok = false;
     } else if (strcmp(tokens[1].value, "compact_under") == 0) {
         if (!safe_strtoul(tokens[2].value, &settings.ext_compact_under))
             ok = false;
@@ -2933,6 +3222,9 @@ void process_command_ascii(conn *c, char *command) {
             case 'e':
                 process_meta_command(c, tokens, ntokens);
                 break;
+            case 'k':
+                process_mnearest_command(c, tokens, ntokens);
+                break;
             default:
                 out_string(c, "ERROR");
                 break;
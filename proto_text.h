@@ -6,5 +6,6 @@ void complete_nread_ascii(conn *c);
 int try_read_command_asciiauth(conn *c);
 int try_read_command_ascii(conn *c);
 void process_command_ascii(conn *c, char *command);
+void prefetch_mg_reset(conn *c);
 
 #endif
@@ -17,6 +17,11 @@
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 //#define DEBUG_SLAB_MOVER
 /* powers-of-N allocation structures */
@@ -32,6 +37,9 @@ typedef struct {
 
     void **slab_list;       /* array of slab pointers */
     unsigned int list_size; /* size of prev array */
+
+    unsigned int cache_max; /* chunks a worker may cache, 0 if none */
+    bool cache_off;         /* page being moved, bypass the caches */
 } slabclass_t;
 
 static slabclass_t slabclass[MAX_NUMBER_OF_SLAB_CLASSES];
@@ -45,11 +53,70 @@ static int power_largest;
 static void *mem_base = NULL;
 static void *mem_current = NULL;
 static size_t mem_avail = 0;
+
+/*
+ * -o slab_hugepages, slab_numa (Linux only): instead of a malloc per slab
+ * page, pages are carved out of arenas mapped a huge page at a time, so slab
+ * memory takes fewer TLB entries. thp maps 2MB aligned arenas and asks for
+ * transparent huge pages with madvise(); 2m and 1g map hugetlbfs pages,
+ * which must be reserved in /proc/sys/vm/nr_hugepages, falling back to thp
+ * if there are none left. slab_numa alone maps plain pages.
+ *
+ * With slab_numa there is an arena per NUMA node. Each is bound to its node
+ * before it is touched, and a page is carved from the arena of the node the
+ * allocating thread runs on. Workers are spread over the nodes and kept on
+ * their node's CPUs, so the items a worker stores land in local memory.
+ *
+ * Arenas are protected by slabs_lock, and never unmapped: memory_release()
+ * leaves their pages in the global page pool.
+ */
+static size_t arena_size = 0; /* 0 if slab pages are malloc'ed */
+#ifdef __linux__
+#define SLABS_NUMA_MAX_NODES 64
+
+static size_t arena_hugepage = 0;
+static unsigned int numa_nodes = 1; /* online nodes, in numa_node_ids */
+static unsigned int numa_node_ids[SLABS_NUMA_MAX_NODES];
+static unsigned long numa_node_mask = 1;
+
+static struct {
+    char *cur;
+    size_t avail;
+} arenas[SLABS_NUMA_MAX_NODES];
+#endif
 /**
  * Access to the slab allocator is protected by this lock
  */
 static pthread_mutex_t slabs_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * -o slab_cache: each worker thread keeps a small stack of free chunks per
+ * slab class, so most allocs and frees don't touch slabs_lock. A stack is
+ * refilled from and drained to the class freelist half at a time.
+ *
+ * Cached chunks are allocated as far as the rest of the slabber can tell:
+ * no ITEM_SLABBED, refcount 1. The page mover would wait on them forever,
+ * so before it takes a page from a class it turns caching off for that
+ * class and drains every worker's stack; see slabs_cache_disable().
+ *
+ * Lock order is a worker's cache lock, then slabs_lock. Only the owning
+ * worker and the page mover take a cache lock, so it is rarely contended.
+ */
+typedef struct {
+    unsigned int count;
+    void *chunks[SLABS_CACHE_MAX];
+} slabs_mag;
+
+typedef struct _slabs_cache {
+    pthread_mutex_t lock;
+    struct _slabs_cache *next;
+    slabs_mag mags[MAX_NUMBER_OF_SLAB_CLASSES];
+} slabs_cache;
+
+static pthread_key_t slabs_cache_key;
+/* every worker's cache, protected by slabs_lock */
+static slabs_cache *slabs_caches = NULL;
+
 /*
  * Forward Declarations
  */
@@ -89,31 +156,250 @@ unsigned int slabs_size(const int clsid) {
     return slabclass[clsid].size;
 }
 
-// TODO: could this work with the restartable memory?
-// Docs say hugepages only work with private shm allocs.
-/* Function split out for better error path handling */
-static void * alloc_large_chunk(const size_t limit)
-{
-    void *ptr = NULL;
-#if defined(__linux__) && defined(MADV_HUGEPAGE)
-    size_t pagesize = 0;
-    FILE *fp;
-    int ret;
+#ifdef __linux__
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#define MPOL_INTERLEAVE 3
+#endif
 
-    /* Get the size of huge pages */
-    fp = fopen("/proc/meminfo", "r");
+/* meminfo's huge page size, the size THP uses. 0 if unknown. */
+static size_t thp_size(void) {
+    size_t pagesize = 0;
+    FILE *fp = fopen("/proc/meminfo", "r");
     if (fp != NULL) {
         char buf[64];
-
-        while ((fgets(buf, sizeof(buf), fp)))
-            if (!strncmp(buf, "Hugepagesize:", 13)) {
-                ret = sscanf(buf + 13, "%zu\n", &pagesize);
-
+        while (fgets(buf, sizeof(buf), fp)) {
+            if (!strncmp(buf, "Hugepagesize:", 13)
+                    && sscanf(buf + 13, "%zu", &pagesize) == 1) {
                 /* meminfo huge page size is in KiBs */
                 pagesize <<= 10;
             }
+        }
         fclose(fp);
     }
+    return pagesize;
+}
+
+/* Prefer node for [ptr, ptr + len), or interleave it over every node if
+ * node < 0. */
+static void numa_bind(void *ptr, const size_t len, const int node) {
+    unsigned long mask = node < 0 ? numa_node_mask : 1UL << node;
+    // only a hint: if the node runs out, the kernel can use another one
+    if (syscall(SYS_mbind, ptr, len, node < 0 ? MPOL_INTERLEAVE : MPOL_PREFERRED,
+                &mask, SLABS_NUMA_MAX_NODES + 1, 0) != 0 && settings.verbose > 0) {
+        perror("mbind");
+    }
+}
+
+/* Maps len bytes of slab memory (a multiple of arena_hugepage), huge page
+ * backed and placed on node if slab_numa is on (every node if node < 0). */
+static void *arena_map(const size_t len, const int node) {
+    static bool warned = false;
+    void *ptr = MAP_FAILED;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (settings.slab_hugepages == SLAB_HUGEPAGES_2M
+            || settings.slab_hugepages == SLAB_HUGEPAGES_1G) {
+        int shift = settings.slab_hugepages == SLAB_HUGEPAGES_1G ? 30 : 21;
+        ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                flags | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+        if (ptr == MAP_FAILED && !warned) {
+            warned = true;
+            fprintf(stderr, "Failed to map hugetlbfs pages for slabs, using"
+                    " transparent huge pages instead: %s\n", strerror(errno));
+        }
+    }
+
+    if (ptr == MAP_FAILED) {
+        /* over-map, then trim to a huge page boundary */
+        char *raw = mmap(NULL, len + arena_hugepage, PROT_READ | PROT_WRITE,
+                flags, -1, 0);
+        if (raw == MAP_FAILED) {
+            return NULL;
+        }
+        size_t lead = (arena_hugepage - ((uintptr_t)raw % arena_hugepage))
+            % arena_hugepage;
+        if (lead) {
+            munmap(raw, lead);
+        }
+        munmap(raw + lead + len, arena_hugepage - lead);
+        ptr = raw + lead;
+        if (settings.slab_hugepages != SLAB_HUGEPAGES_NONE
+                && madvise(ptr, len, MADV_HUGEPAGE) != 0 && settings.verbose > 0) {
+            perror("madvise(MADV_HUGEPAGE)");
+        }
+    }
+
+    if (settings.slab_numa) {
+        numa_bind(ptr, len, node);
+    }
+    return ptr;
+}
+
+/* The node the calling thread is running on. */
+static unsigned int numa_current_node(void) {
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0
+            || node >= SLABS_NUMA_MAX_NODES || !(numa_node_mask & (1UL << node))) {
+        return numa_node_ids[0];
+    }
+    return node;
+}
+
+/* One slab page from the calling thread's arena. slabs_lock must be held. */
+static void *arena_alloc(const size_t size) {
+    unsigned int node = settings.slab_numa ? numa_current_node() : 0;
+    if (arenas[node].avail < size) {
+        // what's left of the old arena is too small for a page, and lost
+        char *ptr = arena_map(arena_size, node);
+        if (ptr == NULL) {
+            return NULL;
+        }
+        arenas[node].cur = ptr;
+        arenas[node].avail = arena_size;
+    }
+    void *ret = arenas[node].cur;
+    arenas[node].cur += size;
+    arenas[node].avail -= size;
+    return ret;
+}
+
+/* Reads a list like "0-1,4" from sysfs. Returns how many numbers it lists,
+ * or 0. Stores the first max below SLABS_NUMA_MAX_NODES in ids if it isn't
+ * NULL, and sets them all in cpus if that isn't NULL. */
+static unsigned int read_node_list(const char *path, unsigned int *ids,
+        const unsigned int max, cpu_set_t *cpus) {
+    char buf[1024];
+    unsigned int count = 0;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    if (fgets(buf, sizeof(buf), fp) != NULL) {
+        char *p = buf;
+        while (*p >= '0' && *p <= '9') {
+            unsigned long lo = strtoul(p, &p, 10);
+            unsigned long hi = lo;
+            if (*p == '-') {
+                hi = strtoul(p + 1, &p, 10);
+            }
+            for (unsigned long i = lo; i <= hi && i < CPU_SETSIZE; i++, count++) {
+                if (ids != NULL && count < max && i < SLABS_NUMA_MAX_NODES) {
+                    ids[count] = i;
+                }
+                if (cpus != NULL) {
+                    CPU_SET(i, cpus);
+                }
+            }
+            if (*p == ',') {
+                p++;
+            }
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+/* Sets up the arenas. Returns false if slab_hugepages can't work here. */
+static bool arena_init(void) {
+    if (settings.slab_hugepages == SLAB_HUGEPAGES_NONE) {
+        if (!settings.slab_numa) {
+            return true;
+        }
+        // NUMA placement only: plain pages, an arena per slab page
+        arena_hugepage = sysconf(_SC_PAGESIZE);
+    } else {
+        arena_hugepage = thp_size();
+        if (arena_hugepage == 0) {
+            fprintf(stderr, "Failed to get supported huge page size\n");
+            return false;
+        }
+    }
+    arena_size = arena_hugepage;
+    if (settings.slab_hugepages == SLAB_HUGEPAGES_2M) {
+        arena_size = 2 << 20;
+    } else if (settings.slab_hugepages == SLAB_HUGEPAGES_1G) {
+        arena_size = 1 << 30;
+    }
+    // the hugetlbfs fallback maps in units of arena_hugepage too
+    if (arena_size > arena_hugepage) {
+        arena_hugepage = arena_size;
+    }
+    if (arena_size < (size_t)settings.slab_page_size) {
+        arena_size = (settings.slab_page_size + arena_hugepage - 1)
+            / arena_hugepage * arena_hugepage;
+    }
+
+    if (settings.slab_numa) {
+        // node ids can be sparse, e.g. "0,2"
+        numa_nodes = read_node_list("/sys/devices/system/node/online",
+                numa_node_ids, SLABS_NUMA_MAX_NODES, NULL);
+        if (numa_nodes == 0) {
+            numa_nodes = 1;
+        } else if (numa_nodes > SLABS_NUMA_MAX_NODES) {
+            numa_nodes = SLABS_NUMA_MAX_NODES;
+        }
+        numa_node_mask = 0;
+        for (unsigned int i = 0; i < numa_nodes; i++) {
+            numa_node_mask |= 1UL << numa_node_ids[i];
+        }
+    }
+    if (settings.verbose > 1) {
+        fprintf(stderr, "slab arenas of %zu bytes on %u node(s)\n",
+                arena_size, numa_nodes);
+    }
+    return true;
+}
+#endif
+
+/* With slab_numa, put worker number worker on its NUMA node's CPUs, and
+ * prefer that node's memory for anything else it allocates. */
+void slabs_numa_thread_init(const int worker) {
+#ifdef __linux__
+    if (!settings.slab_numa || numa_nodes < 2) {
+        return;
+    }
+    unsigned int node = numa_node_ids[worker % numa_nodes];
+    char path[64];
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+    if (read_node_list(path, NULL, 0, &cpus) > 0) {
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (ret != 0 && settings.verbose > 0) {
+            fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(ret));
+        }
+    } else if (settings.verbose > 0) {
+        fprintf(stderr, "No CPUs found for NUMA node %u\n", node);
+    }
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, SLABS_NUMA_MAX_NODES + 1) != 0
+            && settings.verbose > 0) {
+        perror("set_mempolicy");
+    }
+#else
+    (void)worker;
+#endif
+}
+
+// TODO: could this work with the restartable memory?
+// Docs say hugepages only work with private shm allocs.
+/* Function split out for better error path handling */
+static void * alloc_large_chunk(const size_t limit)
+{
+    void *ptr = NULL;
+#ifdef __linux__
+    if (arena_size) {
+        // spread over every node with slab_numa; workers on all of them use it
+        return arena_map((limit + arena_hugepage - 1) / arena_hugepage * arena_hugepage, -1);
+    }
+#endif
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    size_t pagesize = thp_size();
+    int ret;
 
     if (!pagesize) {
         fprintf(stderr, "Failed to get supported huge page size\n");
@@ -204,6 +490,12 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc, co
 
     mem_limit = limit;
 
+#ifdef __linux__
+    if (!arena_init()) {
+        exit(EXIT_FAILURE);
+    }
+#endif
+
     if (prealloc && mem_base_external == NULL) {
         mem_base = alloc_large_chunk(mem_limit);
         if (mem_base) {
@@ -247,6 +539,15 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc, co
 
         slabclass[i].size = size;
         slabclass[i].perslab = settings.slab_page_size / slabclass[i].size;
+        /* A worker holds at most 1/64th of a page per class, so large
+         * chunks aren't stranded in caches while other threads evict. */
+        slabclass[i].cache_max = settings.slab_page_size / 64 / slabclass[i].size;
+        if (slabclass[i].cache_max > settings.slab_cache) {
+            slabclass[i].cache_max = settings.slab_cache;
+        }
+        if (slabclass[i].cache_max < 2) {
+            slabclass[i].cache_max = 0;
+        }
         if (slab_sizes == NULL)
             size *= factor;
         if (settings.verbose > 1) {
@@ -280,6 +581,10 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc, co
             slabs_preallocate(power_largest);
         }
     }
+
+    if (settings.slab_cache) {
+        pthread_key_create(&slabs_cache_key, NULL);
+    }
 }
 
 void slabs_prefill_global(void) {
@@ -518,6 +823,134 @@ static void do_slabs_free(void *ptr, unsigned int id) {
     return;
 }
 
+/* Give the calling worker thread a chunk cache, if -o slab_cache is set.
+ * Other threads alloc and free on the class freelists directly. */
+void slabs_cache_thread_init(void) {
+    if (settings.slab_cache == 0) {
+        return;
+    }
+    slabs_cache *sc = calloc(1, sizeof(slabs_cache));
+    if (sc == NULL) {
+        // just runs uncached
+        return;
+    }
+    pthread_mutex_init(&sc->lock, NULL);
+    pthread_mutex_lock(&slabs_lock);
+    sc->next = slabs_caches;
+    slabs_caches = sc;
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_setspecific(slabs_cache_key, sc);
+}
+
+/* Return chunks from the top of a cache to the freelist until keep are
+ * left. The cache lock and slabs_lock must be held. */
+static void do_slabs_cache_drain(slabs_mag *m, const unsigned int id, const unsigned int keep) {
+    while (m->count > keep) {
+        do_slabs_free(m->chunks[--m->count], id);
+    }
+}
+
+/* Takes a chunk from the cache, refilling it first if it's empty. Returns
+ * false if the class isn't cached right now and the caller should go to the
+ * freelist itself. */
+static bool slabs_cache_alloc(slabs_cache *sc, const unsigned int id,
+        const unsigned int flags, void **ret) {
+    slabclass_t *p = &slabclass[id];
+    slabs_mag *m = &sc->mags[id];
+
+    pthread_mutex_lock(&sc->lock);
+    if (__atomic_load_n(&p->cache_off, __ATOMIC_RELAXED)) {
+        pthread_mutex_unlock(&sc->lock);
+        return false;
+    }
+    if (m->count == 0) {
+        pthread_mutex_lock(&slabs_lock);
+        /* only the first chunk may pull in a new page */
+        unsigned int f = flags;
+        while (m->count < p->cache_max / 2) {
+            void *it = do_slabs_alloc(id, f);
+            if (it == NULL) {
+                break;
+            }
+            m->chunks[m->count++] = it;
+            f = SLABS_ALLOC_NO_NEWPAGE;
+        }
+        pthread_mutex_unlock(&slabs_lock);
+    }
+    /* do_slabs_alloc() already cleared ITEM_SLABBED and set the refcount */
+    *ret = m->count ? m->chunks[--m->count] : NULL;
+    pthread_mutex_unlock(&sc->lock);
+    return true;
+}
+
+static bool slabs_cache_free(slabs_cache *sc, void *ptr, const unsigned int id) {
+    slabclass_t *p = &slabclass[id];
+    slabs_mag *m = &sc->mags[id];
+    item *it = (item *)ptr;
+
+    pthread_mutex_lock(&sc->lock);
+    if (__atomic_load_n(&p->cache_off, __ATOMIC_RELAXED)) {
+        pthread_mutex_unlock(&sc->lock);
+        return false;
+    }
+    if (m->count == p->cache_max) {
+        pthread_mutex_lock(&slabs_lock);
+        do_slabs_cache_drain(m, id, p->cache_max / 2);
+        pthread_mutex_unlock(&slabs_lock);
+    }
+    /* as do_slabs_alloc() would hand it out */
+    it->it_flags = 0;
+    it->slabs_clsid = id;
+    it->refcount = 1;
+    m->chunks[m->count++] = ptr;
+    pthread_mutex_unlock(&sc->lock);
+    return true;
+}
+
+/* Stop caching chunks of class id and put every cached one back on its
+ * freelist. Once this returns, every chunk in the class is either on the
+ * freelist or in use, as the page mover expects. */
+void slabs_cache_disable(const unsigned int id) {
+    slabclass_t *p = &slabclass[id];
+    if (settings.slab_cache == 0 || p->cache_max == 0) {
+        return;
+    }
+    __atomic_store_n(&p->cache_off, true, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&slabs_lock);
+    slabs_cache *sc = slabs_caches;
+    pthread_mutex_unlock(&slabs_lock);
+    /* caches are never freed, and new ones are only pushed on the front */
+    for (; sc != NULL; sc = sc->next) {
+        pthread_mutex_lock(&sc->lock);
+        pthread_mutex_lock(&slabs_lock);
+        do_slabs_cache_drain(&sc->mags[id], id, 0);
+        pthread_mutex_unlock(&slabs_lock);
+        pthread_mutex_unlock(&sc->lock);
+    }
+}
+
+void slabs_cache_enable(const unsigned int id) {
+    __atomic_store_n(&slabclass[id].cache_off, false, __ATOMIC_RELAXED);
+}
+
+/* Return every cached chunk, so a restart finds them free. The workers must
+ * be stopped. */
+void slabs_cache_drain_all(void) {
+    for (int id = POWER_SMALLEST; id <= power_largest; id++) {
+        slabs_cache_disable(id);
+    }
+}
+
+/* Chunks of class id sitting in worker caches. slabs_lock must be held; the
+ * counts are read unlocked, so this is a snapshot. */
+static unsigned int do_slabs_cached(const unsigned int id) {
+    unsigned int cached = 0;
+    for (slabs_cache *sc = slabs_caches; sc != NULL; sc = sc->next) {
+        cached += __atomic_load_n(&sc->mags[id].count, __ATOMIC_RELAXED);
+    }
+    return cached;
+}
+
 /* With refactoring of the various stats code the automover won't need a
  * custom function here.
  */
@@ -528,7 +961,7 @@ void fill_slab_stats_automove(slab_stats_automove *am) {
         slabclass_t *p = &slabclass[n];
         slab_stats_automove *cur = &am[n];
         cur->chunks_per_page = p->perslab;
-        cur->free_chunks = p->sl_curr;
+        cur->free_chunks = p->sl_curr + do_slabs_cached(n);
         cur->total_pages = p->slabs;
         cur->chunk_size = p->size;
     }
@@ -559,9 +992,10 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
     for(i = POWER_SMALLEST; i <= power_largest; i++) {
         slabclass_t *p = &slabclass[i];
         if (p->slabs != 0) {
-            uint32_t perslab, slabs;
+            uint32_t perslab, slabs, cached;
             slabs = p->slabs;
             perslab = p->perslab;
+            cached = do_slabs_cached(i);
 
             char key_str[STAT_KEY_LEN];
             char val_str[STAT_VAL_LEN];
@@ -572,8 +1006,11 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
             APPEND_NUM_STAT(i, "total_pages", "%u", slabs);
             APPEND_NUM_STAT(i, "total_chunks", "%u", slabs * perslab);
             APPEND_NUM_STAT(i, "used_chunks", "%u",
-                            slabs*perslab - p->sl_curr);
+                            slabs*perslab - p->sl_curr - cached);
             APPEND_NUM_STAT(i, "free_chunks", "%u", p->sl_curr);
+            if (settings.slab_cache) {
+                APPEND_NUM_STAT(i, "cached_chunks", "%u", cached);
+            }
             /* Stat is dead, but displaying zero instead of removing it. */
             APPEND_NUM_STAT(i, "free_chunks_end", "%u", 0);
             APPEND_NUM_STAT(i, "get_hits", "%llu",
@@ -608,7 +1045,14 @@ static void *memory_allocate(size_t size) {
 
     if (mem_base == NULL) {
         /* We are not using a preallocated large memory chunk */
+#ifdef __linux__
+        ret = arena_size ? arena_alloc(size) : malloc(size);
+#else
         ret = malloc(size);
+#endif
+        if (ret == NULL) {
+            return NULL;
+        }
     } else {
         ret = mem_current;
 
@@ -636,7 +1080,7 @@ static void *memory_allocate(size_t size) {
 /* Must only be used if all pages are item_size_max */
 static void memory_release(void) {
     void *p = NULL;
-    if (mem_base != NULL)
+    if (mem_base != NULL || arena_size)
         return;
 
     if (!settings.slab_reassign)
@@ -652,6 +1096,19 @@ static void memory_release(void) {
 void *slabs_alloc(unsigned int id, unsigned int flags) {
     void *ret;
 
+    if (settings.slab_cache && id >= POWER_SMALLEST && id <= power_largest
+            && slabclass[id].cache_max) {
+        slabs_cache *sc = pthread_getspecific(slabs_cache_key);
+        if (sc && slabs_cache_alloc(sc, id, flags, &ret)) {
+            if (ret) {
+                MEMCACHED_SLABS_ALLOCATE(id, slabclass[id].size, ret);
+            } else {
+                MEMCACHED_SLABS_ALLOCATE_FAILED(id);
+            }
+            return ret;
+        }
+    }
+
     pthread_mutex_lock(&slabs_lock);
     ret = do_slabs_alloc(id, flags);
     pthread_mutex_unlock(&slabs_lock);
@@ -659,6 +1116,16 @@ void *slabs_alloc(unsigned int id, unsigned int flags) {
 }
 
 void slabs_free(void *ptr, unsigned int id) {
+    if (settings.slab_cache && id >= POWER_SMALLEST && id <= power_largest
+            && slabclass[id].cache_max
+            && (((item *)ptr)->it_flags & ITEM_CHUNKED) == 0) {
+        slabs_cache *sc = pthread_getspecific(slabs_cache_key);
+        if (sc && slabs_cache_free(sc, ptr, id)) {
+            MEMCACHED_SLABS_FREE(id, ptr);
+            return;
+        }
+    }
+
     pthread_mutex_lock(&slabs_lock);
     do_slabs_free(ptr, id);
     pthread_mutex_unlock(&slabs_lock);
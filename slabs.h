@@ -31,6 +31,22 @@ void slabs_free(void *ptr, unsigned int id);
 /** Adjust global memory limit up or down */
 bool slabs_adjust_mem_limit(size_t new_mem_limit);
 
+/** Per worker thread caches of free chunks, see -o slab_cache */
+#define SLABS_CACHE_MAX 64
+void slabs_cache_thread_init(void);
+void slabs_cache_disable(const unsigned int id);
+void slabs_cache_enable(const unsigned int id);
+void slabs_cache_drain_all(void);
+
+/** Slab page arenas, see -o slab_hugepages and slab_numa */
+enum slab_hugepages {
+    SLAB_HUGEPAGES_NONE = 0,
+    SLAB_HUGEPAGES_THP,
+    SLAB_HUGEPAGES_2M,
+    SLAB_HUGEPAGES_1G,
+};
+void slabs_numa_thread_init(const int worker);
+
 typedef struct {
     unsigned int chunks_per_page;
     unsigned int chunk_size;
@@ -94,11 +94,15 @@ static int slab_rebalance_start(struct slab_rebal_thread *t) {
         t->allow_evictions = true;
     }
 
+    // chunks cached by the workers look busy to the mover, so they all go
+    // back to the freelist until the page is moved.
+    slabs_cache_disable(t->rebal.s_clsid);
     void *page = slabs_peek_page(t->rebal.s_clsid, &size, &perslab);
 
     // Bit-vector to keep track of completed chunks
     t->rebal.completed = (uint8_t*)calloc(perslab,sizeof(uint8_t));
     if (!t->rebal.completed) {
+        slabs_cache_enable(t->rebal.s_clsid);
         return -1;
     }
 
@@ -249,7 +253,7 @@ static int _slabs_locked_cb(void *arg) {
              * ITEM_SLABBED, but it's had ITEM_LINKED, it must be active
              * and have the key written to it already.
              */
-            a->hv = hash(ITEM_key(it), it->nkey);
+            a->hv = it->hv;
             if ((a->hold_lock = item_trylock(a->hv)) == NULL) {
                 status = MOVE_LOCKED;
             } else {
@@ -536,6 +540,7 @@ static void slab_rebalance_finish(struct slab_rebal_thread *t) {
      */
     slabs_finalize_page_move(t->rebal.s_clsid, t->rebal.d_clsid,
             t->rebal.slab_start);
+    slabs_cache_enable(t->rebal.s_clsid);
 
     STATS_LOCK();
     stats.slabs_moved++;
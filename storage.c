@@ -118,6 +118,9 @@ void storage_stats(ADD_STAT add_stats, void *c) {
         APPEND_STAT("extstore_compact_resc_cold", "%llu", (unsigned long long)stats.extstore_compact_resc_cold);
         APPEND_STAT("extstore_compact_resc_old", "%llu", (unsigned long long)stats.extstore_compact_resc_old);
         APPEND_STAT("extstore_compact_skipped", "%llu", (unsigned long long)stats.extstore_compact_skipped);
+        APPEND_STAT("extstore_prefetch_queued", "%llu", (unsigned long long)stats.extstore_prefetch_queued);
+        APPEND_STAT("extstore_prefetch_dropped", "%llu", (unsigned long long)stats.extstore_prefetch_dropped);
+        APPEND_STAT("extstore_prefetch_recached", "%llu", (unsigned long long)stats.extstore_prefetch_recached);
         STATS_UNLOCK();
         extstore_get_stats(ext_storage, &st);
         APPEND_STAT("extstore_page_allocs", "%llu", (unsigned long long)st.page_allocs);
@@ -528,6 +531,10 @@ static int storage_write(void *storage, const int clsid, const int item_age) {
                 bucket = PAGE_BUCKET_LOWTTL;
             }
             hdr_it->it_flags |= ITEM_HDR;
+            // carry the trained embedding over to the header.
+            if (hdr_it->it_flags & it->it_flags & ITEM_EMB) {
+                memcpy(ITEM_emb(hdr_it), ITEM_emb(it), settings.emb_item_size);
+            }
             io.len = orig_ntotal;
             io.mode = OBJ_IO_WRITE;
             // NOTE: when the item is read back in, the slab mover
@@ -1018,6 +1025,9 @@ static void storage_compact_readback(void *storage, logger *l,
                             new_it->it_flags = hdr_it->it_flags & (~ITEM_LINKED);
                             new_it->time = hdr_it->time;
                             new_it->nbytes = hdr_it->nbytes;
+                            if (new_it->it_flags & ITEM_EMB) {
+                                memcpy(ITEM_emb(new_it), ITEM_emb(hdr_it), settings.emb_item_size);
+                            }
 
                             // copy the hdr data.
                             item_hdr *new_hdr = (item_hdr *) ITEM_data(new_it);
@@ -1215,6 +1225,195 @@ int start_storage_compact_thread(void *arg) {
     return 0;
 }
 
+/*
+ * PREFETCH THREAD
+ *
+ * Reads items back from extstore into RAM before a client asks for them.
+ * Which items is up to the eviction policy (see emb_prefetch_scan()); this
+ * thread only does the IO, one read at a time and at most ext_prefetch_rate
+ * reads per second.
+ */
+
+#define PREFETCH_QUEUE_SIZE 64
+
+static pthread_t storage_prefetch_tid;
+static pthread_mutex_t storage_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t storage_prefetch_cond = PTHREAD_COND_INITIALIZER;
+// header items waiting to be read, each holding a reference.
+static struct {
+    item *it;
+    uint32_t hv;
+} prefetch_queue[PREFETCH_QUEUE_SIZE];
+static unsigned int prefetch_head = 0;
+static unsigned int prefetch_count = 0;
+
+struct storage_prefetch_wrap {
+    obj_io io;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    bool miss;
+};
+
+// Queue a header item to be read back into RAM. The item lock must be held.
+// Returns false if the queue is full.
+bool storage_prefetch(item *it, uint32_t hv) {
+    bool queued = false;
+    pthread_mutex_lock(&storage_prefetch_lock);
+    if (prefetch_count < PREFETCH_QUEUE_SIZE) {
+        unsigned int tail = (prefetch_head + prefetch_count) % PREFETCH_QUEUE_SIZE;
+        refcount_incr(it);
+        prefetch_queue[tail].it = it;
+        prefetch_queue[tail].hv = hv;
+        prefetch_count++;
+        queued = true;
+        pthread_cond_signal(&storage_prefetch_cond);
+    }
+    pthread_mutex_unlock(&storage_prefetch_lock);
+
+    STATS_LOCK();
+    if (queued) {
+        stats.extstore_prefetch_queued++;
+    } else {
+        stats.extstore_prefetch_dropped++;
+    }
+    STATS_UNLOCK();
+    return queued;
+}
+
+static void _storage_prefetch_cb(void *e, obj_io *io, int ret) {
+    struct storage_prefetch_wrap *wrap = (struct storage_prefetch_wrap *)io->data;
+    pthread_mutex_lock(&wrap->lock);
+    wrap->miss = ret < 1;
+    wrap->done = true;
+    pthread_cond_signal(&wrap->cond);
+    pthread_mutex_unlock(&wrap->lock);
+}
+
+// Read one header's item and swap it in the way recache_or_free() does for
+// client reads. Chunked items are left on flash. Returns true if recached.
+static bool storage_prefetch_one(void *storage, struct storage_prefetch_wrap *wrap,
+        item *hdr_it, uint32_t hv) {
+    item_hdr hdr;
+    bool valid;
+    size_t ntotal;
+
+    item_lock(hv);
+    valid = (hdr_it->it_flags & (ITEM_LINKED|ITEM_HDR)) == (ITEM_LINKED|ITEM_HDR);
+    memcpy(&hdr, ITEM_data(hdr_it), sizeof(hdr));
+    ntotal = ITEM_ntotal(hdr_it);
+    item_unlock(hv);
+    if (!valid || ntotal > settings.slab_chunk_size_max) {
+        return false;
+    }
+
+    unsigned int clsid = slabs_clsid(ntotal);
+    item *it = do_item_alloc_pull(ntotal, clsid);
+    if (it == NULL) {
+        return false;
+    }
+    it->slabs_clsid = clsid;
+
+    obj_io *io = &wrap->io;
+    io->buf = (void *)it;
+    io->len = ntotal;
+    io->page_version = hdr.page_version;
+    io->page_id = hdr.page_id;
+    io->offset = hdr.offset;
+    io->next = NULL;
+    pthread_mutex_lock(&wrap->lock);
+    wrap->done = false;
+    wrap->miss = false;
+    extstore_submit_bg(storage, io);
+    while (!wrap->done) {
+        pthread_cond_wait(&wrap->cond, &wrap->lock);
+    }
+    pthread_mutex_unlock(&wrap->lock);
+
+    bool recached = false;
+    if (!wrap->miss && (uint32_t)it->exptime ==
+            crc32c(0, (char *)it+STORE_OFFSET, ntotal-STORE_OFFSET)) {
+        item_lock(hv);
+        item_hdr *cur = (item_hdr *)ITEM_data(hdr_it);
+        // still the same header, pointing at what we just read?
+        if ((hdr_it->it_flags & (ITEM_LINKED|ITEM_HDR)) == (ITEM_LINKED|ITEM_HDR)
+                && cur->page_id == hdr.page_id
+                && cur->page_version == hdr.page_version
+                && cur->offset == hdr.offset) {
+            it->exptime = hdr_it->exptime;
+            it->it_flags &= ~ITEM_LINKED;
+            it->refcount = 0;
+            it->h_next = NULL;
+            // keep what the embedding learned while the item was on flash.
+            if (it->it_flags & hdr_it->it_flags & ITEM_EMB) {
+                memcpy(ITEM_emb(it), ITEM_emb(hdr_it), settings.emb_item_size);
+            }
+            STORAGE_delete(storage, hdr_it);
+            item_replace(hdr_it, it, hv, ITEM_get_cas(hdr_it));
+            recached = true;
+        }
+        item_unlock(hv);
+    }
+    if (!recached) {
+        slabs_free(it, clsid);
+    }
+    return recached;
+}
+
+static void *storage_prefetch_thread(void *arg) {
+    void *storage = arg;
+    struct storage_prefetch_wrap wrap;
+    memset(&wrap, 0, sizeof(wrap));
+    pthread_mutex_init(&wrap.lock, NULL);
+    pthread_cond_init(&wrap.cond, NULL);
+    wrap.io.data = &wrap;
+    wrap.io.iov = NULL;
+    wrap.io.mode = OBJ_IO_READ;
+    wrap.io.cb = _storage_prefetch_cb;
+
+    pthread_mutex_lock(&storage_prefetch_lock);
+    while (1) {
+        while (prefetch_count == 0) {
+            pthread_cond_wait(&storage_prefetch_cond, &storage_prefetch_lock);
+        }
+        item *it = prefetch_queue[prefetch_head].it;
+        uint32_t hv = prefetch_queue[prefetch_head].hv;
+        prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE_SIZE;
+        prefetch_count--;
+        pthread_mutex_unlock(&storage_prefetch_lock);
+
+        bool recached = storage_prefetch_one(storage, &wrap, it, hv);
+        item_remove(it);
+        if (recached) {
+            STATS_LOCK();
+            stats.extstore_prefetch_recached++;
+            STATS_UNLOCK();
+        }
+
+        unsigned int rate = settings.ext_prefetch_rate;
+        if (rate) {
+            usleep(1000000 / rate);
+        }
+        pthread_mutex_lock(&storage_prefetch_lock);
+    }
+
+    return NULL;
+}
+
+int start_storage_prefetch_thread(void *arg) {
+    int ret;
+
+    if ((ret = pthread_create(&storage_prefetch_tid, NULL,
+        storage_prefetch_thread, arg)) != 0) {
+        fprintf(stderr, "Can't create storage_prefetch thread: %s\n",
+            strerror(ret));
+        return -1;
+    }
+    thread_setname(storage_prefetch_tid, "mc-ext-prefetch");
+
+    return 0;
+}
+
 /*** UTILITY ***/
 // /path/to/file:100G:bucket1
 // FIXME: Modifies argument. copy instead?
@@ -1316,6 +1515,7 @@ void *storage_init_config(struct settings *s) {
     s->ext_item_age = UINT_MAX;
     s->ext_low_ttl = 0;
     s->ext_recache_rate = 2000;
+    s->ext_prefetch_rate = 0;
     s->ext_max_frag = 0.8;
     s->ext_drop_unread = false;
     s->ext_wbuf_size = 1024 * 1024 * 4;
@@ -1351,6 +1551,7 @@ int storage_read_config(void *conf, char **subopt) {
         EXT_ITEM_AGE,
         EXT_LOW_TTL,
         EXT_RECACHE_RATE,
+        EXT_PREFETCH_RATE,
         EXT_COMPACT_UNDER,
         EXT_DROP_UNDER,
         EXT_MAX_SLEEP,
@@ -1369,6 +1570,7 @@ int storage_read_config(void *conf, char **subopt) {
         [EXT_ITEM_AGE] = "ext_item_age",
         [EXT_LOW_TTL] = "ext_low_ttl",
         [EXT_RECACHE_RATE] = "ext_recache_rate",
+        [EXT_PREFETCH_RATE] = "ext_prefetch_rate",
         [EXT_COMPACT_UNDER] = "ext_compact_under",
         [EXT_DROP_UNDER] = "ext_drop_under",
         [EXT_MAX_SLEEP] = "ext_max_sleep",
@@ -1466,6 +1668,16 @@ int storage_read_config(void *conf, char **subopt) {
                 return 1;
             }
             break;
+        case EXT_PREFETCH_RATE:
+            if (subopts_value == NULL) {
+                fprintf(stderr, "Missing ext_prefetch_rate argument\n");
+                return 1;
+            }
+            if (!safe_strtoul(subopts_value, &settings.ext_prefetch_rate)) {
+                fprintf(stderr, "could not parse argument to ext_prefetch_rate\n");
+                return 1;
+            }
+            break;
         case EXT_COMPACT_UNDER:
             if (subopts_value == NULL) {
                 fprintf(stderr, "Missing ext_compact_under argument\n");
@@ -16,6 +16,7 @@ void storage_stats(ADD_STAT add_stats, void *c);
 void process_extstore_stats(ADD_STAT add_stats, void *c);
 bool storage_validate_item(void *e, item *it);
 int storage_get_item(conn *c, item *it, mc_resp *resp);
+bool storage_prefetch(item *it, uint32_t hv);
 
 // callback for the IO queue subsystem.
 void storage_submit_cb(io_queue_t *q);
@@ -27,6 +28,7 @@ void storage_write_resume(void);
 int start_storage_compact_thread(void *arg);
 void storage_compact_pause(void);
 void storage_compact_resume(void);
+int start_storage_prefetch_thread(void *arg);
 
 // Init functions.
 struct extstore_conf_file *storage_conf_parse(char *arg, unsigned int page_size);
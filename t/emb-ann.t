@@ -0,0 +1,114 @@
+#!/usr/bin/env perl
+# With emb_ann_lists the "mk" command finds keys whose learned access
+# embeddings are nearest to a key's, through an approximate index.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval { new_memcached("-o emb_ann_lists=8"); };
+ok($@, "emb_ann_lists needs evict_policy=emb");
+
+{
+    my $server = new_memcached("-o evict_policy=emb");
+    my $sock = $server->sock;
+    print $sock "mk foo\r\n";
+    like(scalar <$sock>, qr/^CLIENT_ERROR /, "mk needs the index");
+}
+
+{
+    my $server = new_memcached("-X -o evict_policy=emb,emb_ann_lists=8");
+    my $sock = $server->sock;
+    print $sock "set foo 0 0 1\r\nx\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored foo");
+    print $sock "mk foo\r\n";
+    is(scalar <$sock>, "CLIENT_ERROR mk not allowed\r\n", "mk disabled by -X");
+}
+
+my $server = new_memcached("-m 64 -o evict_policy=emb,emb_ann_lists=8");
+my $sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{emb_ann_lists}, 8, "emb_ann_lists set");
+}
+
+for my $group (0 .. 9) {
+    for my $key (0 .. 49) {
+        print $sock "set g${group}_$key 0 0 1\r\nx\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored g${group}_$key");
+    }
+}
+# Give the model something to learn.
+for my $group (0 .. 9) {
+    for (1 .. 5) {
+        for my $key (0 .. 49) {
+            mem_get_is($sock, "g${group}_$key", "x");
+        }
+    }
+}
+sleep 1; # let the maintainer seed the index
+
+sub mk {
+    my $cmd = shift;
+    print $sock "$cmd\r\n";
+    my $res = <$sock>;
+    return ($res) unless $res =~ /^MK (\d+)/;
+    my @nb;
+    for (1 .. $1) {
+        my $line = <$sock>;
+        like($line, qr/^NB k\S+ s-?[0-9.]+\r\n$/, "neighbour line");
+        push(@nb, $line);
+    }
+    return ($res, @nb);
+}
+
+{
+    my ($res, @nb) = mk("mk g9_1 n5 Oopaque");
+    is($res, "MK 5 Oopaque\r\n", "five neighbours");
+    my @sims = map { /s(-?[0-9.]+)/ } @nb;
+    is_deeply(\@sims, [sort { $b <=> $a } @sims], "nearest first");
+    ok(!grep(/kg9_1 /, @nb), "the query key is not returned");
+
+    ($res, @nb) = mk("mk g9_1 n3 d0.5");
+    like($res, qr/^MK [0-3]\r\n$/, "k caps the neighbours");
+    for (@nb) {
+        my ($sim) = /s(-?[0-9.]+)/;
+        cmp_ok($sim, '>=', 0.5, "within the distance");
+    }
+
+    ($res) = mk("mk nosuch");
+    is($res, "EN\r\n", "miss");
+
+    ($res, @nb) = mk("mk any n2 v" . join(",", (1) x 16));
+    is($res, "MK 2\r\n", "query by vector");
+
+    ($res) = mk("mk any v1,2,3");
+    is($res, "CLIENT_ERROR bad vector\r\n", "short vector");
+
+    ($res) = mk("mk g9_1 n0");
+    like($res, qr/^CLIENT_ERROR /, "bad n");
+}
+
+{
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{emb_ann_queries}, '>=', 3, "queries counted");
+    cmp_ok($stats->{emb_ann_scanned}, '>', 0, "lists scanned");
+    cmp_ok($stats->{emb_ann_scanned}, '<', $stats->{emb_ann_queries} * 500,
+        "not every item scanned");
+}
+
+# The index follows unlinks.
+for my $key (0 .. 49) {
+    print $sock "delete g9_$key\r\n";
+    is(scalar <$sock>, "DELETED\r\n", "deleted g9_$key");
+}
+{
+    my ($res, @nb) = mk("mk g8_1 n100");
+    ok(!grep(/kg9_/, @nb), "deleted keys are gone");
+}
+
+done_testing();
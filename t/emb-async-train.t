@@ -0,0 +1,35 @@
+#!/usr/bin/env perl
+# Hits queued for background embedding training must not change what the
+# client sees, and items keep being evicted by embedding score.
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+for my $opts ("emb_async_train", "emb_async_train,emb_inline") {
+    my $server = new_memcached("-m 3 -o evict_policy=emb,$opts");
+    my $sock = $server->sock;
+
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{emb_async_train}, "yes", "emb_async_train enabled");
+
+    print $sock "set foo 0 0 6\r\nfooval\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored foo");
+    for (1 .. 100) {
+        mem_get_is($sock, "foo", "fooval");
+    }
+
+    my $value = "B"x8192;
+    for my $key (0 .. 1000) {
+        print $sock "set key$key 0 0 8192\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored key$key");
+    }
+
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{evictions}, '>', 0, "items were evicted");
+    is($stats->{emb_train_dropped}, 0, "no accesses dropped");
+}
+
+done_testing();
@@ -0,0 +1,45 @@
+#!/usr/bin/env perl
+# -o emb_evict_score=gdsf: items set with a high "ms U" cost hint outlive
+# cheap ones.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 3 -o evict_policy=emb,emb_evict_score=gdsf");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{emb_evict_score}, "gdsf", "emb_evict_score set");
+
+print $sock "ms foo 2 U70000\r\nhi\r\n";
+like(scalar <$sock>, qr/^CLIENT_ERROR/, "cost hint out of range");
+print $sock "ms foo 2 Uabc\r\nhi\r\n";
+like(scalar <$sock>, qr/^CLIENT_ERROR/, "cost hint not a number");
+print $sock "mg foo U5 v\r\n";
+is(scalar <$sock>, "CLIENT_ERROR invalid flag\r\n", "cost hint only for ms");
+
+my $value = "C" x 8192;
+for my $key (1 .. 1000) {
+    my $cost = $key % 2 ? " U1000" : "";
+    print $sock "ms key$key 8192$cost T0\r\n$value\r\n";
+    is(scalar <$sock>, "HD\r\n", "stored key$key");
+}
+
+my %kept = (cheap => 0, costly => 0);
+for my $key (1 .. 1000) {
+    print $sock "mg key$key\r\n";
+    my $line = <$sock>;
+    if ($line eq "HD\r\n") {
+        $kept{$key % 2 ? "costly" : "cheap"}++;
+    }
+}
+
+$stats = mem_stats($sock);
+cmp_ok($stats->{evictions}, '>', 0, "items were evicted");
+cmp_ok($kept{costly}, '>', $kept{cheap} * 2, "costly items kept over cheap ones");
+
+done_testing();
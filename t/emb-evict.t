@@ -0,0 +1,40 @@
+#!/usr/bin/env perl
+# The emb policy keeps its best eviction candidates between evictions, so it
+# scores fewer than EMB_EVICT_SAMPLES fresh items per eviction.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 3 -o evict_policy=emb");
+my $sock = $server->sock;
+
+my $value = "E" x 8192;
+for my $key (1 .. 2000) {
+    print $sock "set key$key 0 0 8192\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored key$key");
+    # keep the model moving
+    if ($key % 4 == 0) {
+        print $sock "get key" . ($key - 1) . "\r\n";
+        my $line = <$sock>;
+        if ($line ne "END\r\n") {
+            <$sock>; <$sock>;
+        }
+    }
+}
+
+my $stats = mem_stats($sock);
+my $evicted = $stats->{evictions};
+cmp_ok($evicted, '>', 0, "items were evicted");
+cmp_ok($stats->{emb_evict_samples}, '>', 0, "samples counted");
+cmp_ok($stats->{emb_evict_samples}, '<', $evicted * 32,
+    "fewer samples than a full scan per eviction");
+ok(exists $stats->{emb_evict_early}, "early exits counted");
+
+$stats = mem_stats($sock, ' evictpolicy');
+cmp_ok($stats->{emb_evict_samples}, '>', 0, "shown in stats evictpolicy");
+
+done_testing();
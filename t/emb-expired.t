@@ -0,0 +1,42 @@
+#!/usr/bin/env perl
+# The emb policy frees expired items it samples instead of evicting live
+# ones, even with the LRU crawler off.
+
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw(sleep);
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 3 -o evict_policy=emb,no_lru_crawler");
+my $sock = $server->sock;
+
+my $value = "X" x 8192;
+for my $key (1 .. 250) {
+    print $sock "set dead$key 0 1 8192\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored dead$key");
+}
+sleep 2.5;
+
+for my $key (1 .. 250) {
+    print $sock "set live$key 0 0 8192\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored live$key");
+}
+
+my $stats = mem_stats($sock);
+cmp_ok($stats->{emb_evict_reclaimed}, '>', 0, "expired items reclaimed");
+cmp_ok($stats->{reclaimed}, '>=', $stats->{emb_evict_reclaimed},
+    "counted as reclaimed");
+cmp_ok($stats->{evictions}, '<', $stats->{emb_evict_reclaimed},
+    "few live items evicted");
+
+my $live = 0;
+for my $key (1 .. 250) {
+    print $sock "mg live$key\r\n";
+    $live++ if scalar <$sock> eq "HD\r\n";
+}
+cmp_ok($live, '>', 200, "most live items kept");
+
+done_testing();
@@ -0,0 +1,63 @@
+#!/usr/bin/env perl
+# Items carrying an inline embedding must keep key/flags/cas/data intact,
+# whatever the precision of the stored vector.
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+for my $precision (qw(fp32 fp16 int8)) {
+    my $server = new_memcached("-m 3 -o evict_policy=emb,emb_inline,emb_precision=$precision");
+    my $sock = $server->sock;
+
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{emb_inline}, "yes", "emb_inline enabled");
+    is($stats->{emb_precision}, $precision, "emb_precision set");
+
+    print $sock "set foo 123 0 6\r\nfooval\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored foo");
+    mem_get_is({ sock => $sock, flags => 123 }, "foo", "fooval");
+
+    print $sock "gets foo\r\n";
+    like(scalar <$sock>, qr/^VALUE foo 123 6 (\d+)\r\n/, "gets foo has cas");
+    is(scalar <$sock>, "fooval\r\n", "gets foo value");
+    is(scalar <$sock>, "END\r\n", "gets foo end");
+
+    print $sock "append foo 0 0 3\r\nbar\r\n";
+    is(scalar <$sock>, "STORED\r\n", "appended foo");
+    mem_get_is({ sock => $sock, flags => 123 }, "foo", "foovalbar");
+
+    print $sock "set num 0 0 1\r\n1\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored num");
+    print $sock "incr num 41\r\n";
+    is(scalar <$sock>, "42\r\n", "incr num");
+
+    # Push well past the memory limit so items get evicted and their chunks
+    # reused with stale embedding blocks.
+    my $value = "B"x8192;
+    for my $key (0 .. 1000) {
+        print $sock "set key$key $key 0 8192\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored key$key");
+    }
+
+    # Victims are picked by embedding score rather than recency, so any of
+    # these may be gone; whatever is still there must be intact.
+    my $hits = 0;
+    for my $key (990 .. 1000) {
+        print $sock "get key$key\r\n";
+        my $line = <$sock>;
+        next if $line eq "END\r\n";
+        is($line, "VALUE key$key $key 8192\r\n", "key$key header");
+        is(scalar <$sock>, "$value\r\n", "key$key value");
+        is(scalar <$sock>, "END\r\n", "key$key end");
+        $hits++;
+    }
+    cmp_ok($hits, '>', 0, "recent items survive");
+
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{curr_items}, '<', 1001, "some items were evicted");
+}
+
+done_testing();
@@ -0,0 +1,73 @@
+#!/usr/bin/env perl
+# Item embeddings and the rolling average survive a warm restart, so the
+# embedding policy doesn't start over with random vectors.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# See t/restart.t: use a ram disk for this in real life.
+my $mem_path = "/tmp/mc_emb_restart.$$";
+my $opts = "-m 64 -e $mem_path -o evict_policy=emb";
+
+my $server = new_memcached($opts);
+my $sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{emb_inline}, "yes", "-e turns on emb_inline");
+    $stats = mem_stats($sock);
+    is($stats->{emb_restored_items}, 0, "nothing restored on a cold start");
+}
+
+my $count = 500;
+my $value = "V" x 1000;
+for my $key (1 .. $count) {
+    print $sock "set key$key 0 0 1000\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored key$key");
+}
+# Give the model something to learn.
+for (1 .. 5) {
+    for my $key (1 .. 50) {
+        mem_get_is($sock, "key$key", $value);
+    }
+}
+sleep 1; # let the maintainer merge the averages
+
+$server->graceful_stop();
+diag "killed, waiting";
+sleep 5;
+
+$server = new_memcached($opts);
+$sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock);
+    is($stats->{curr_items}, $count, "all items restored");
+    is($stats->{emb_restored_items}, $count, "all embeddings restored");
+}
+
+for my $key (1 .. $count) {
+    mem_get_is($sock, "key$key", $value);
+}
+
+# Eviction still works on the restored pools.
+{
+    my $good = 1;
+    for my $key (1 .. 80000) {
+        print $sock "set new$key 0 0 1000\r\n$value\r\n";
+        $good = 0 if (scalar <$sock> ne "STORED\r\n");
+    }
+    is($good, 1, "set responses were all STORED");
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{evictions}, '>', 0, "evicted after restart");
+}
+
+done_testing();
+
+END {
+    unlink $mem_path if $mem_path;
+}
@@ -0,0 +1,53 @@
+#!/usr/bin/env perl
+# emb_model=sgns trains item vectors from keys accessed together and scores
+# evictions against context centroids.
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval { new_memcached("-o emb_model=sgns"); };
+ok($@, "emb_model needs evict_policy=emb");
+
+for my $opts ("emb_model=sgns", "emb_model=sgns,emb_inline,emb_precision=int8") {
+    my $server = new_memcached("-m 3 -o evict_policy=emb,$opts");
+    my $sock = $server->sock;
+
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{emb_model}, "sgns", "emb_model set");
+    is($stats->{emb_async_train}, "yes", "sgns trains in the background");
+
+    # A few groups of keys that are always read together.
+    for my $group (0 .. 9) {
+        for my $key (0 .. 4) {
+            print $sock "set g${group}_$key 0 0 5\r\nvalue\r\n";
+            is(scalar <$sock>, "STORED\r\n", "stored g${group}_$key");
+        }
+    }
+    for (1 .. 20) {
+        for my $group (0 .. 9) {
+            for my $key (0 .. 4) {
+                mem_get_is($sock, "g${group}_$key", "value");
+            }
+        }
+    }
+    sleep 1;
+
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{emb_sgns_pairs}, '>', 0, "co-accessed pairs trained");
+    cmp_ok($stats->{emb_centroids}, '>', 0, "context centroids found");
+
+    my $value = "B"x8192;
+    for my $key (0 .. 1000) {
+        print $sock "set key$key 0 0 8192\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored key$key");
+    }
+
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{evictions}, '>', 0, "items were evicted");
+    is($stats->{emb_train_dropped}, 0, "no accesses dropped");
+}
+
+done_testing();
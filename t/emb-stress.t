@@ -0,0 +1,96 @@
+#!/usr/bin/env perl
+# Hammer the emb policy from many connections at once, under memory pressure
+# so links, unlinks, training and evictions all race each other, in each of
+# the training and scoring modes.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use POSIX ();
+
+my $children = 8;
+my $ops = 4000;
+
+my @configs = (
+    "evict_policy=emb,emb_shards=64",
+    "evict_policy=emb,emb_shards=1",
+    "evict_policy=emb,emb_async_train,emb_inline",
+    "evict_policy=emb,emb_model=sgns,emb_ann_lists=16,emb_evict_score=gdsf",
+);
+
+# Returns how many replies didn't look right.
+sub hammer {
+    my ($sock, $seed) = @_;
+    srand($seed);
+    my $bad = 0;
+    for my $n (1 .. $ops) {
+        my $key = "key" . int(rand(rand() < 0.8 ? 500 : 20000));
+        my $len = 100 + int(rand(4000));
+        my $op = rand();
+        if ($op < 0.4) {
+            print $sock "set $key 0 0 $len\r\n" . ("s" x $len) . "\r\n";
+            my $line = <$sock> // '';
+            $bad++ unless $line eq "STORED\r\n";
+        } elsif ($op < 0.5) {
+            my $cost = int(rand(100));
+            print $sock "ms $key $len T0 U$cost\r\n" . ("m" x $len) . "\r\n";
+            my $line = <$sock> // '';
+            $bad++ unless $line =~ /^HD/;
+        } elsif ($op < 0.8) {
+            print $sock "get $key\r\n";
+            my $line = <$sock> // '';
+            if ($line =~ /^VALUE \S+ \d+ (\d+)/) {
+                read($sock, my $data, $1 + 2);
+                $line = <$sock> // '';
+            }
+            $bad++ unless $line eq "END\r\n";
+        } elsif ($op < 0.9) {
+            print $sock "mg $key s v\r\n";
+            my $line = <$sock> // '';
+            if ($line =~ /^VA (\d+)/) {
+                read($sock, my $data, $1 + 2);
+            } elsif ($line ne "EN\r\n") {
+                $bad++;
+            }
+        } else {
+            print $sock "delete $key\r\n";
+            my $line = <$sock> // '';
+            $bad++ unless $line =~ /^(DELETED|NOT_FOUND)\r\n/;
+        }
+    }
+    return $bad;
+}
+
+for my $config (@configs) {
+    my $server = new_memcached("-t 8 -m 8 -o $config");
+    my @pids;
+    for my $child (1 .. $children) {
+        my $pid = fork();
+        die "fork failed: $!" unless defined $pid;
+        if ($pid == 0) {
+            my $sock = $server->new_sock;
+            my $bad = hammer($sock, $child);
+            # not exit(): the server handle's destructor would kill it
+            POSIX::_exit($bad > 255 ? 255 : $bad);
+        }
+        push(@pids, $pid);
+    }
+    for my $pid (@pids) {
+        waitpid($pid, 0);
+        is($? >> 8, 0, "$config: child $pid got only good replies");
+    }
+
+    my $sock = $server->sock;
+    print $sock "version\r\n";
+    like(scalar <$sock>, qr/^VERSION /, "$config: server still up");
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{evictions}, '>', 0, "$config: items were evicted");
+    my $settings = mem_stats($sock, ' settings');
+    my ($shards) = $config =~ /emb_shards=(\d+)/;
+    is($settings->{emb_shards}, $shards // 16, "$config: emb_shards");
+}
+
+done_testing();
@@ -0,0 +1,49 @@
+#!/usr/bin/env perl
+# Every eviction policy can be selected at runtime and keeps evicting once
+# memory is full.
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my %segmented = (lru => "no", segmented => "yes", emb => "no", tinylfu => "no");
+
+for my $policy (qw(lru segmented emb tinylfu)) {
+    my $server = new_memcached("-m 3 -o evict_policy=$policy");
+    my $sock = $server->sock;
+
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{evict_policy}, $policy, "evict_policy is $policy");
+    is($stats->{lru_segmented}, $segmented{$policy}, "lru_segmented for $policy");
+
+    my $value = "B"x8192;
+    for my $key (0 .. 1000) {
+        print $sock "set key$key 0 0 8192\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "$policy: stored key$key");
+    }
+
+    $stats = mem_stats($sock);
+    cmp_ok($stats->{evictions}, '>', 0, "$policy: items were evicted");
+    cmp_ok($stats->{curr_items}, '<', 1001, "$policy: curr_items below sets");
+}
+
+{
+    my $server = new_memcached();
+    my $stats = mem_stats($server->sock, ' settings');
+    is($stats->{evict_policy}, "segmented", "segmented by default");
+}
+
+{
+    my $server = new_memcached("-o no_lru_maintainer");
+    my $stats = mem_stats($server->sock, ' settings');
+    is($stats->{evict_policy}, "lru", "lru without the LRU maintainer");
+}
+
+eval {
+    my $server = new_memcached("-o evict_policy=segmented,no_lru_maintainer");
+};
+ok($@, "segmented needs the LRU maintainer");
+
+done_testing();
@@ -0,0 +1,48 @@
+#!/usr/bin/env perl
+# With evict_policy=tinylfu a scan of keys that are set once must not push
+# frequently read keys out of the cache.
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 3 -o evict_policy=tinylfu");
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{evict_policy}, "tinylfu", "evict_policy is tinylfu");
+is($stats->{tinylfu_window_pct}, 1, "default window size");
+
+my $value = "B"x8192;
+for my $key (0 .. 19) {
+    print $sock "set hot$key 0 0 8192\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored hot$key");
+}
+for (1 .. 5) {
+    for my $key (0 .. 19) {
+        mem_get_is($sock, "hot$key", $value);
+    }
+}
+
+# Several times the cache size of keys seen only once.
+for my $key (0 .. 1000) {
+    print $sock "set scan$key 0 0 8192\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored scan$key");
+}
+
+for my $key (0 .. 19) {
+    mem_get_is($sock, "hot$key", $value, "hot$key survived the scan");
+}
+
+$stats = mem_stats($sock);
+cmp_ok($stats->{evictions}, '>', 0, "scan keys were evicted");
+cmp_ok($stats->{tinylfu_rejected}, '>', 0, "scan keys were refused admission");
+
+eval {
+    my $server = new_memcached("-o evict_policy=tinylfu,tinylfu_window_pct=0");
+};
+ok($@, "tinylfu_window_pct must be at least 1");
+
+done_testing();
@@ -0,0 +1,104 @@
+#!/usr/bin/env perl
+# "stats evictpolicy": how often evicted keys are asked for again, and how
+# the policy scored its victims.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+sub fill_and_miss {
+    my $sock = shift;
+    my $value = "V" x 8192;
+    for my $key (1 .. 1000) {
+        print $sock "set key$key 0 0 8192\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored key$key");
+    }
+    # half through get, half through meta get: both are checked
+    my @missed = ();
+    for my $key (1 .. 50) {
+        print $sock "get key$key\r\n";
+        my $line = <$sock>;
+        if ($line eq "END\r\n") {
+            push(@missed, "key$key");
+            next;
+        }
+        <$sock>; <$sock>;
+    }
+    for my $key (51 .. 100) {
+        print $sock "mg key$key v\r\n";
+        my $line = <$sock>;
+        if ($line eq "EN\r\n") {
+            push(@missed, "key$key");
+            next;
+        }
+        <$sock>;
+    }
+    return @missed;
+}
+
+{
+    my $server = new_memcached("-m 3 -o evict_policy=lru");
+    my $sock = $server->sock;
+    my @missed = fill_and_miss($sock);
+    cmp_ok(scalar @missed, '>', 0, "early keys were evicted");
+
+    my $stats = mem_stats($sock, ' evictpolicy');
+    is($stats->{evict_policy}, "lru", "policy name");
+    cmp_ok($stats->{evicted}, '>', 0, "evictions counted");
+    ok(!exists $stats->{ghost_hits}, "no ghost list by default");
+}
+
+for my $policy ("lru", "emb", "tinylfu") {
+    my $server = new_memcached("-m 3 -o evict_policy=$policy,evict_ghost_size=10000");
+    my $sock = $server->sock;
+
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{evict_ghost_size}, 10000, "evict_ghost_size set");
+
+    my @missed = fill_and_miss($sock);
+    my $misses = scalar @missed;
+    cmp_ok($misses, '>', 0, "$policy: early keys were evicted");
+
+    $stats = mem_stats($sock, ' evictpolicy');
+    is($stats->{evict_policy}, $policy, "policy name");
+    is($stats->{ghost_size}, 16384, "ghost list size rounded up");
+    is($stats->{ghost_checks}, $misses, "$policy: every miss checked");
+    # The list is direct mapped, so a few ghosts are pushed out by others.
+    cmp_ok($stats->{ghost_hits}, '>', $misses / 2, "$policy: misses were on evicted keys");
+    cmp_ok($stats->{ghost_hits}, '<=', $misses, "$policy: no more ghost hits than misses");
+    my $aged = 0;
+    $aged += $stats->{$_} for grep { /^ghost_hits_(within|older)/ } keys %$stats;
+    is($aged, $stats->{ghost_hits}, "ghost hits bucketed by age");
+    ok(exists $stats->{ghost_hit_age_avg}, "average age");
+
+    my ($cls) = map { /^(\d+):evicted$/ ? $1 : () } keys %$stats;
+    ok(defined $cls, "per class stats");
+    cmp_ok($stats->{"$cls:ghost_hits"}, '>', 0, "per class ghost hits");
+    if ($policy eq "lru") {
+        is($stats->{victim_scored}, 0, "lru doesn't score victims");
+    } else {
+        cmp_ok($stats->{victim_scored}, '>', 0, "$policy: victims scored");
+        ok(exists $stats->{victim_score_avg}, "average victim score");
+        ok(exists $stats->{ghost_hit_score_avg}, "average score of ghost hits");
+    }
+    if ($policy eq "emb") {
+        cmp_ok($stats->{"$cls:pool_size"}, '>', 0, "sampling pool size");
+    }
+
+    # Asking again is a plain miss: the ghost is forgotten once hit.
+    print $sock "get $missed[0]\r\n";
+    is(scalar <$sock>, "END\r\n", "still missing");
+    my $again = mem_stats($sock, ' evictpolicy');
+    is($again->{ghost_hits}, $stats->{ghost_hits}, "ghost hit only once");
+
+    print $sock "stats reset\r\n";
+    is(scalar <$sock>, "RESET\r\n", "stats reset");
+    $stats = mem_stats($sock, ' evictpolicy');
+    is($stats->{ghost_checks}, 0, "ghost checks reset");
+    is($stats->{ghost_hits}, 0, "ghost hits reset");
+}
+
+done_testing();
@@ -0,0 +1,46 @@
+#!/usr/bin/env perl
+# evictsim replays a trace offline against each eviction policy and reports
+# a hit ratio for every (policy, size) pair.
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use Cwd;
+
+my $exe = getcwd . "/evictsim";
+plan skip_all => "evictsim not built" unless -x $exe;
+
+my $trace = "/tmp/evictsim.$$.trace";
+open(my $fh, ">", $trace) or die "can't write $trace: $!";
+# A small hot set read over and over, mixed with keys that are seen once.
+for my $i (0 .. 19999) {
+    my $key = $i % 2 ? "hot" . ($i % 50) : "once$i";
+    print $fh int($i / 1000), " $key 2000 0\n";
+}
+close($fh);
+
+my @out = `$exe -t $trace -p lru,tinylfu -m 2,4`;
+is($?, 0, "evictsim ran");
+unlink($trace);
+
+like(shift @out, qr/^policy\s+mem_mb\s+ops\s+hit_ratio/, "header");
+is(scalar @out, 4, "one row per policy and size");
+
+my %hits;
+for my $row (@out) {
+    my ($policy, $mb, $ops, $ratio, $bratio, $evictions, $failed) = split ' ', $row;
+    is($ops, 20000, "$policy/$mb: replayed every op");
+    is($failed, 0, "$policy/$mb: no failed stores");
+    cmp_ok($evictions, '>', 0, "$policy/$mb: cache filled up");
+    $hits{"$policy/$mb"} = $ratio;
+}
+
+# Hot keys are read every other op, so every policy keeps most of them.
+for my $run (sort keys %hits) {
+    cmp_ok($hits{$run}, '>', 0.4, "$run: hot set stays cached");
+}
+cmp_ok($hits{"tinylfu/2"}, '>=', $hits{"lru/2"}, "tinylfu keeps the hot set through the one-hit keys");
+
+done_testing();
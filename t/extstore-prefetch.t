@@ -0,0 +1,79 @@
+#!/usr/bin/env perl
+# With evict_policy=emb and ext_prefetch_rate, items on flash that look like
+# what clients are hitting get read back into RAM ahead of time.
+
+use strict;
+use warnings;
+use Test::More;
+use Time::HiRes qw(sleep);
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $ext_path;
+
+if (!supports_extstore()) {
+    plan skip_all => 'extstore not enabled';
+    exit 0;
+}
+
+$ext_path = "/tmp/extstore-prefetch.$$";
+
+eval {
+    my $server = new_memcached("-o ext_prefetch_rate=10,ext_path=$ext_path:64m");
+};
+ok($@, "ext_prefetch_rate needs evict_policy=emb");
+
+my $server = new_memcached("-m 64 -U 0 -o evict_policy=emb,ext_page_size=8,ext_wbuf_size=2,ext_threads=1,ext_io_depth=2,ext_item_size=512,ext_item_age=2,ext_recache_rate=0,ext_path=$ext_path:64m,slab_automove=0,ext_prefetch_rate=200");
+my $sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{ext_prefetch_rate}, 200, "ext_prefetch_rate set");
+    print $sock "extstore prefetch_rate 100\r\n";
+    is(scalar <$sock>, "OK\r\n", "prefetch_rate changed");
+    $stats = mem_stats($sock, ' settings');
+    is($stats->{ext_prefetch_rate}, 100, "new ext_prefetch_rate");
+}
+
+my $value = "P" x 2000;
+for my $key (1 .. 500) {
+    print $sock "set big$key 0 0 2000\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored big$key");
+}
+# small items live next to the extstore headers
+for my $key (1 .. 500) {
+    print $sock "set small$key 0 0 1\r\ns\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored small$key");
+}
+wait_ext_flush($sock);
+
+{
+    my $stats = mem_stats($sock);
+    is($stats->{extstore_prefetch_recached}, 0, "nothing prefetched while idle");
+}
+
+# Keep reading a set of flashed items; they and their neighbours should
+# start being prefetched.
+for (1 .. 30) {
+    for my $key (1 .. 50) {
+        mem_get_is($sock, "big$key", $value);
+    }
+    sleep 0.1;
+}
+
+{
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{extstore_prefetch_queued}, '>', 0, "prefetches queued");
+    cmp_ok($stats->{extstore_prefetch_recached}, '>', 0, "items prefetched");
+}
+
+for my $key (1 .. 500) {
+    mem_get_is($sock, "big$key", $value);
+}
+
+done_testing();
+
+END {
+    unlink $ext_path if $ext_path;
+}
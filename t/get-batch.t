@@ -0,0 +1,72 @@
+#!/usr/bin/env perl
+# Multigets and pipelined mg requests have their keys looked up in batches;
+# every key still gets its own answer, in order.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+# every third key is missing
+my @keys = map { "bkey$_" } 1 .. 100;
+for my $n (grep { $_ % 3 } 1 .. 100) {
+    print $sock "set bkey$n 0 0 " . length($n) . " noreply\r\n$n\r\n";
+}
+
+print $sock "get " . join(" ", @keys) . "\r\n";
+my @got;
+while (my $line = <$sock>) {
+    last if $line eq "END\r\n";
+    if ($line =~ /^VALUE bkey(\d+) 0 \d+/) {
+        my $val = <$sock>;
+        push(@got, $1) if $val eq "$1\r\n";
+    }
+}
+is_deeply(\@got, [grep { $_ % 3 } 1 .. 100], "multiget returns the hits in order");
+
+# the same key many times over
+print $sock "gets " . join(" ", ("bkey1") x 40) . "\r\n";
+my $hits = 0;
+while (my $line = <$sock>) {
+    last if $line eq "END\r\n";
+    $hits++ if $line =~ /^VALUE bkey1 0 1 \d+/;
+    <$sock>;
+}
+is($hits, 40, "repeated keys each answered");
+
+# a bad key part way through a line ends the batch before it
+print $sock "get bkey1 bkey2 " . ("x" x 251) . " bkey4\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n", "too long key rejected");
+mem_get_is($sock, "bkey1", "1", "item still usable after the error");
+
+my $stats = mem_stats($sock);
+# bkey1 and bkey2 were answered before the bad key was reached
+is($stats->{get_hits}, 67 + 40 + 2 + 1, "get_hits counted per key");
+is($stats->{get_misses}, 33, "get_misses counted per key");
+
+# pipelined mg, with hits, misses and a non-mg line in the middle
+my $req = "";
+my @expect;
+for my $n (1 .. 60) {
+    if ($n == 30) {
+        $req .= "mn\r\n";
+        push(@expect, "MN\r\n");
+    }
+    $req .= "mg bkey$n v\r\n";
+    push(@expect, $n % 3 ? "VA " . length($n) . "\r\n$n\r\n" : "EN\r\n");
+}
+print $sock $req;
+my @replies;
+for my $expect (@expect) {
+    my $line = <$sock>;
+    $line .= <$sock> if $line =~ /^VA/;
+    push(@replies, $line);
+}
+is_deeply(\@replies, \@expect, "pipelined mg answered in order");
+
+done_testing();
@@ -0,0 +1,92 @@
+#!/usr/bin/env perl
+# The hash table grows a bucket at a time while it is being read, and shrinks
+# back once the items are gone, for both table layouts.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use POSIX ();
+
+my $base = 8192;
+my $fixed = 5000;
+my $extra = 60000;
+
+sub wait_for {
+    my ($sock, $done) = @_;
+    my $stats;
+    for (1 .. 100) {
+        $stats = mem_stats($sock);
+        last if $done->($stats) && !$stats->{hash_is_expanding};
+        select(undef, undef, undef, 0.1);
+    }
+    return $stats;
+}
+
+# Returns how many of keys 1 .. $n were found with the right value.
+sub found {
+    my ($sock, $n) = @_;
+    my $hits = 0;
+    for (my $i = 1; $i <= $n; $i += 100) {
+        my $last = $i + 99 > $n ? $n : $i + 99;
+        print $sock "get " . join(" ", map { "rkey$_" } $i .. $last) . "\r\n";
+        while (my $line = <$sock>) {
+            last if $line eq "END\r\n";
+            if ($line =~ /^VALUE rkey(\d+) 0 \d+/) {
+                $hits++ if <$sock> eq "$1\r\n";
+            }
+        }
+    }
+    return $hits;
+}
+
+for my $table (qw(chained tagged)) {
+    my $server = new_memcached("-m 128 -o hash_table=$table,hashpower=13");
+    my $sock = $server->sock;
+
+    my $stats = mem_stats($sock);
+    is($stats->{hash_buckets}, $base, "$table: starts at hashpower");
+    my $start_bytes = $stats->{hash_bytes};
+
+    for my $n (1 .. $fixed) {
+        print $sock "set rkey$n 0 0 " . length($n) . " noreply\r\n$n\r\n";
+    }
+
+    # keep reading the first keys while the table grows and shrinks
+    my $pid = fork();
+    die "fork failed: $!" unless defined $pid;
+    if ($pid == 0) {
+        my $rsock = $server->new_sock;
+        my $missed = 0;
+        for (1 .. 40) {
+            $missed += $fixed - found($rsock, $fixed);
+        }
+        # not exit(): the server handle's destructor would kill it
+        POSIX::_exit($missed ? 1 : 0);
+    }
+
+    for my $n ($fixed + 1 .. $fixed + $extra) {
+        print $sock "set rkey$n 0 0 " . length($n) . " noreply\r\n$n\r\n";
+    }
+    $stats = wait_for($sock, sub { $_[0]->{hash_buckets} > $base * 3 });
+    cmp_ok($stats->{hash_buckets}, '>', $base * 3, "$table: table grew");
+    cmp_ok($stats->{hash_bytes}, '>', $start_bytes, "$table: hash_bytes grew");
+    my $peak_bytes = $stats->{hash_bytes};
+    is(found($sock, $fixed + $extra), $fixed + $extra, "$table: every item found");
+
+    for my $n ($fixed + 1 .. $fixed + $extra) {
+        print $sock "delete rkey$n noreply\r\n";
+    }
+    $stats = wait_for($sock, sub { $_[0]->{hash_buckets} < $base * 3 });
+    cmp_ok($stats->{hash_buckets}, '<', $base * 3, "$table: table shrank");
+    cmp_ok($stats->{hash_buckets}, '>=', $base, "$table: not below hashpower");
+    cmp_ok($stats->{hash_bytes}, '<', $peak_bytes, "$table: segments freed");
+    is(found($sock, $fixed), $fixed, "$table: remaining items found");
+
+    waitpid($pid, 0);
+    is($? >> 8, 0, "$table: no misses while resizing");
+}
+
+done_testing();
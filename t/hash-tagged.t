@@ -0,0 +1,80 @@
+#!/usr/bin/env perl
+# -o hash_table=tagged: finds, deletes and hash walks still see every item,
+# across hash table expansions and with overflowing buckets.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 64 -o hash_table=tagged,hashpower=13');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{hash_table}, "tagged", "tagged hash table in use");
+
+my $count = 40000;
+for my $n (1 .. $count) {
+    print $sock "set tkey$n 0 0 " . length($n) . " noreply\r\n$n\r\n";
+}
+print $sock "version\r\n";
+like(scalar <$sock>, qr/^VERSION/, "bulk sets completed");
+
+my $stats;
+for (1 .. 50) {
+    $stats = mem_stats($sock);
+    last if $stats->{hash_power_level} > 13 && !$stats->{hash_is_expanding};
+    select(undef, undef, undef, 0.1);
+}
+cmp_ok($stats->{hash_power_level}, '>', 13, "hash table expanded");
+is($stats->{hash_is_expanding}, 0, "expansion finished");
+is($stats->{curr_items}, $count, "all items stored");
+
+# misses go through the same buckets and tags
+sub found {
+    my @keys = @_;
+    my %seen;
+    while (my @batch = splice(@keys, 0, 100)) {
+        print $sock "get " . join(" ", map { "tkey$_" } @batch) . "\r\n";
+        while (my $line = <$sock>) {
+            last if $line eq "END\r\n";
+            if ($line =~ /^VALUE tkey(\d+) 0 \d+/) {
+                my $val = <$sock>;
+                $seen{$1} = 1 if $val eq "$1\r\n";
+            }
+        }
+    }
+    return scalar keys %seen;
+}
+
+is(found(1 .. $count), $count, "every item found");
+is(found($count + 1 .. $count + 1000), 0, "missing keys not found");
+
+for my $n (grep { $_ % 3 == 0 } 1 .. $count) {
+    print $sock "delete tkey$n noreply\r\n";
+}
+print $sock "version\r\n";
+like(scalar <$sock>, qr/^VERSION/, "bulk deletes completed");
+
+my $left = $count - int($count / 3);
+is(found(grep { $_ % 3 == 0 } 1 .. $count), 0, "deleted items gone");
+is(found(grep { $_ % 3 != 0 } 1 .. $count), $left, "other items still found");
+
+# re-adding fills the slots freed by the deletes
+for my $n (grep { $_ % 3 == 0 } 1 .. 3000) {
+    print $sock "set tkey$n 0 0 " . length($n) . " noreply\r\n$n\r\n";
+}
+$left += 1000;
+is(found(1 .. 3000), 3000, "re-added items found");
+
+print $sock "lru_crawler metadump hash\r\n";
+my $dumped = 0;
+while (<$sock>) {
+    last if /^(\.|END)/;
+    $dumped++ if /^key=tkey\d+/;
+}
+is($dumped, $left, "metadump hash walks every item");
+
+done_testing();
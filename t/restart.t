@@ -61,10 +61,11 @@ diag "load enough items to change hash power level";
     $stats = mem_stats($sock);
     is($stats->{hash_power_level}, 17, "new hash power level is 17");
 
-    # Now delete all these items, so the auto-restore won't cause the hash
-    # table to re-inflate, but the restart code should restore the hash table
-    # to where it was regardless.
-    $todo = 2**17;
+    # Now delete half of these items, so the auto-restore won't cause the
+    # hash table to re-inflate, but the restart code should restore the hash
+    # table to where it was regardless. The rest keep the table from
+    # shrinking back before we stop.
+    $todo = 2**16;
     $good = 1;
     while ($todo--) {
         print $sock "delete z${todo}\r\n";
@@ -0,0 +1,128 @@
+#!/usr/bin/env perl
+# -o slab_cache: workers keep free chunks to themselves, without the slab
+# stats or the page mover losing track of them.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use POSIX ();
+
+my $server = new_memcached('-m 64 -t 4 -o slab_cache=32,slab_reassign,slab_automove=0,no_lru_crawler');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{slab_cache}, 32, "slab_cache set");
+
+# the class holding the most items
+sub busiest_class {
+    my $s = mem_stats($sock, 'slabs');
+    my ($cls, $used) = (0, -1);
+    for my $k (keys %$s) {
+        next unless $k =~ /^(\d+):used_chunks$/;
+        ($cls, $used) = ($1, $s->{$k}) if $s->{$k} > $used;
+    }
+    return $cls;
+}
+
+# cached chunks are counted apart from used and free ones
+for my $n (1 .. 100) {
+    print $sock "set small$n 0 0 10 noreply\r\n0123456789\r\n";
+}
+mem_get_is($sock, "small100", "0123456789");
+my $cls = busiest_class();
+my $s = mem_stats($sock, 'slabs');
+is($s->{"$cls:used_chunks"}, 100, "used_chunks counts the items");
+cmp_ok($s->{"$cls:cached_chunks"}, '>', 0, "the worker cached some chunks");
+is($s->{"$cls:used_chunks"} + $s->{"$cls:free_chunks"} + $s->{"$cls:cached_chunks"},
+    $s->{"$cls:total_chunks"}, "every chunk accounted for");
+
+for my $n (1 .. 100) {
+    print $sock "delete small$n noreply\r\n";
+}
+mem_get_is($sock, "small1", undef);
+$s = mem_stats($sock, 'slabs');
+is($s->{"$cls:used_chunks"}, 0, "deleted items go back to the cache or freelist");
+
+# fill a few pages of one class, free most of it, and move a page away:
+# freed chunks sit in the worker caches and must be handed back
+my $value = "v" x 2000;
+for my $n (1 .. 2000) {
+    print $sock "set big$n 0 0 2000 noreply\r\n$value\r\n";
+}
+mem_get_is($sock, "big2000", $value, "big items stored");
+for my $n (grep { $_ % 10 } 1 .. 2000) {
+    print $sock "delete big$n noreply\r\n";
+}
+mem_get_is($sock, "big1", undef);
+$cls = busiest_class();
+$s = mem_stats($sock, 'slabs');
+my $pages = $s->{"$cls:total_pages"};
+cmp_ok($pages, '>', 2, "class filled a few pages");
+
+my $stats = mem_stats($sock);
+print $sock "slabs reassign $cls 0\r\n";
+is(scalar <$sock>, "OK\r\n", "reassign started");
+my $moved = 0;
+for (1 .. 100) {
+    my $st = mem_stats($sock);
+    if ($st->{slabs_moved} > $stats->{slabs_moved} && !$st->{slab_reassign_running}) {
+        $moved = 1;
+        last;
+    }
+    select(undef, undef, undef, 0.1);
+}
+ok($moved, "page moved despite cached chunks");
+$s = mem_stats($sock, 'slabs');
+is($s->{"$cls:total_pages"}, $pages - 1, "class lost a page");
+my $found = 0;
+for my $n (grep { $_ % 10 == 0 } 1 .. 2000) {
+    print $sock "get big$n\r\n";
+    my $line = <$sock>;
+    if ($line =~ /^VALUE/) {
+        $found++ if <$sock> eq "$value\r\n";
+        $line = <$sock>;
+    }
+}
+is($found, 200, "items on the moved page were rescued");
+
+# workers allocate and free from their caches while pages keep moving
+my @pids;
+for my $child (1 .. 4) {
+    my $pid = fork();
+    die "fork failed: $!" unless defined $pid;
+    if ($pid == 0) {
+        my $csock = $server->new_sock;
+        my $bad = 0;
+        for my $n (1 .. 3000) {
+            my $key = "c${child}_" . ($n % 300);
+            my $len = 100 + ($n * 37) % 3000;
+            print $csock "set $key 0 0 $len\r\n" . ("c" x $len) . "\r\n";
+            my $line = <$csock> // '';
+            $bad++ unless $line eq "STORED\r\n";
+            if ($n % 3 == 0) {
+                print $csock "delete $key\r\n";
+                $line = <$csock> // '';
+                $bad++ unless $line eq "DELETED\r\n";
+            }
+        }
+        # not exit(): the server handle's destructor would kill it
+        POSIX::_exit($bad > 255 ? 255 : $bad);
+    }
+    push(@pids, $pid);
+}
+for (1 .. 20) {
+    print $sock "slabs reassign $cls 0\r\n";
+    <$sock>;
+    select(undef, undef, undef, 0.05);
+}
+for my $pid (@pids) {
+    waitpid($pid, 0);
+    is($? >> 8, 0, "child $pid got only good replies");
+}
+print $sock "version\r\n";
+like(scalar <$sock>, qr/^VERSION /, "server still up");
+
+done_testing();
@@ -0,0 +1,52 @@
+#!/usr/bin/env perl
+# -o slab_hugepages, slab_numa: slab pages carved out of huge page arenas
+# hold items like malloc'ed ones do.
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if ($^O ne 'linux') {
+    plan skip_all => 'slab arenas are linux only';
+}
+
+# 2m has no reserved hugetlbfs pages on most test boxes, and falls back to thp
+for my $opts ('-o slab_hugepages=thp', '-o slab_hugepages=thp,slab_numa',
+        '-o slab_numa', '-o slab_hugepages=2m', '-L -o slab_hugepages=thp,slab_numa') {
+    my $server = new_memcached("-m 64 $opts");
+    my $sock = $server->sock;
+
+    my $settings = mem_stats($sock, ' settings');
+    my ($hp) = $opts =~ /slab_hugepages=(\w+)/;
+    is($settings->{slab_hugepages}, $hp // 'no', "$opts: slab_hugepages set");
+    is($settings->{slab_numa}, $opts =~ /slab_numa/ ? 'yes' : 'no',
+        "$opts: slab_numa set");
+
+    # enough for several arenas, in two classes, then past the limit
+    my $value = "v" x 5000;
+    my $small = "s" x 50;
+    for my $n (1 .. 16000) {
+        print $sock "set big$n 0 0 5000 noreply\r\n$value\r\n";
+        print $sock "set small$n 0 0 50 noreply\r\n$small\r\n" if $n <= 2000;
+    }
+    mem_get_is($sock, "small2000", $small, "$opts: small item stored");
+    mem_get_is($sock, "big16000", $value, "$opts: big item stored");
+
+    my $stats = mem_stats($sock);
+    cmp_ok($stats->{evictions}, '>', 0, "$opts: memory limit still applies");
+    $stats = mem_stats($sock, 'slabs');
+    cmp_ok($stats->{total_malloced}, '<=', 64 * 1024 * 1024,
+        "$opts: no more pages than the limit");
+}
+
+my $server = eval { new_memcached('-o slab_hugepages=bogus') };
+ok(!$server, "unknown slab_hugepages value rejected");
+
+$server = eval { new_memcached('-o slab_numa -e /tmp/slabs-hugepages.mem') };
+ok(!$server, "slab arenas not usable with a memory file");
+unlink('/tmp/slabs-hugepages.mem');
+
+done_testing();
@@ -17,13 +17,17 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <math.h>
 
 #include "config.h"
 #include "cache.h"
 #include "crc32c.h"
+#include "emb_kernels.h"
 #include "hash.h"
 #include "jenkins_hash.h"
 #include "stats_prefix.h"
+#include "tinylfu.h"
+#include "ghost.h"
 #include "util.h"
 #include "protocol_binary.h"
 #ifdef TLS
@@ -485,6 +489,38 @@ static enum test_return test_safe_strtol(void) {
     return TEST_PASS;
 }
 
+static enum test_return test_mc_rng(void) {
+    mc_rng a, b;
+    mc_rng_seed(&a, 1);
+    mc_rng_seed(&b, 1);
+    assert(mc_rng_next(&a) == mc_rng_next(&b));
+    mc_rng_seed(&b, 2);
+    assert(mc_rng_next(&a) != mc_rng_next(&b));
+
+    // every value in range, and nothing outside it
+    int counts[10] = {0};
+    for (int i = 0; i < 10000; i++) {
+        uint32_t v = mc_rng_bounded(&a, 10);
+        assert(v < 10);
+        counts[v]++;
+    }
+    for (int i = 0; i < 10; i++) {
+        assert(counts[i] > 800 && counts[i] < 1200);
+    }
+    assert(mc_rng_bounded(&a, 1) == 0);
+    assert(mc_rng_bounded(&a, UINT32_MAX) < UINT32_MAX);
+
+    float f[256];
+    mc_rng_fill_floats(&a, f, 256, -1.0f, 1.0f);
+    float sum = 0;
+    for (int i = 0; i < 256; i++) {
+        assert(f[i] >= -1.0f && f[i] < 1.0f);
+        sum += f[i];
+    }
+    assert(sum > -64 && sum < 64);
+    return TEST_PASS;
+}
+
 /**
  * Function to start the server and let it listen on a random port
  *
@@ -2256,6 +2292,124 @@ struct testcase {
     TEST_FUNC function;
 };
 
+static bool emb_close(float a, float b) {
+    float d = a - b;
+    return d < 1e-4f && d > -1e-4f;
+}
+
+static enum test_return test_emb_kernels(void) {
+    float a[EMBEDDING_DIM], b[EMBEDDING_DIM], y1[EMBEDDING_DIM], y2[EMBEDDING_DIM];
+    uint16_t h1[EMBEDDING_DIM], h2[EMBEDDING_DIM];
+    int8_t q[EMBEDDING_DIM];
+
+    emb_kernels_init(false);
+    emb_kernels_t sw = emb_kernels;
+    emb_kernels_init(true);
+    emb_kernels_t hw = emb_kernels;
+    assert(strcmp(sw.name, "scalar") == 0);
+
+    for (int run = 0; run < 100; run++) {
+        for (int x = 0; x < EMBEDDING_DIM; x++) {
+            a[x] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+            b[x] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+            q[x] = (int8_t)(a[x] * EMB_INT8_SCALE);
+        }
+
+        /* Compare SIMD to scalar implementation */
+        assert(emb_close(sw.dot(a, b), hw.dot(a, b)));
+        assert(emb_close(sw.dot_int8(q, b), hw.dot_int8(q, b)));
+
+        memcpy(y1, a, sizeof(a));
+        memcpy(y2, a, sizeof(a));
+        sw.axpy(y1, 0.1f, b);
+        hw.axpy(y2, 0.1f, b);
+        sw.normalize(y1);
+        hw.normalize(y2);
+        for (int x = 0; x < EMBEDDING_DIM; x++) {
+            assert(emb_close(y1[x], y2[x]));
+        }
+        assert(emb_close(sw.dot(y1, y1), 1.0f));
+
+        /* Both round to nearest even, so conversions must be identical */
+        sw.to_fp16(h1, a);
+        hw.to_fp16(h2, a);
+        assert(memcmp(h1, h2, sizeof(h1)) == 0);
+        sw.from_fp16(y1, h1);
+        hw.from_fp16(y2, h2);
+        assert(memcmp(y1, y2, sizeof(y1)) == 0);
+        for (int x = 0; x < EMBEDDING_DIM; x++) {
+            assert(fabsf(y1[x] - a[x]) < 1e-3f);
+        }
+        assert(emb_close(sw.dot_fp16(h1, b), hw.dot_fp16(h2, b)));
+    }
+
+    /* Zero vectors are left alone */
+    memset(y1, 0, sizeof(y1));
+    hw.normalize(y1);
+    assert(y1[0] == 0.0f);
+
+    return TEST_PASS;
+}
+
+static enum test_return test_tinylfu_sketch(void) {
+    tinylfu_sketch *s = tinylfu_sketch_new(1000);
+    assert(s != NULL);
+
+    /* First sight only goes to the doorkeeper */
+    assert(tinylfu_sketch_estimate(s, 42) == 0);
+    tinylfu_sketch_add(s, 42);
+    assert(tinylfu_sketch_estimate(s, 42) == 1);
+    for (int i = 0; i < 5; i++) {
+        tinylfu_sketch_add(s, 42);
+    }
+    assert(tinylfu_sketch_estimate(s, 42) == 6);
+
+    /* Counters saturate */
+    for (int i = 0; i < 100; i++) {
+        tinylfu_sketch_add(s, 7);
+    }
+    assert(tinylfu_sketch_estimate(s, 7) == TINYLFU_COUNTER_MAX + 1);
+
+    /* Enough other keys age the sketch: counts halve, doorkeeper clears */
+    uint32_t hv = 1000;
+    while (tinylfu_sketch_resets(s) == 0) {
+        tinylfu_sketch_add(s, hash(&hv, sizeof(hv)));
+        hv++;
+    }
+    unsigned int aged = tinylfu_sketch_estimate(s, 7);
+    assert(aged >= TINYLFU_COUNTER_MAX / 2 && aged <= TINYLFU_COUNTER_MAX / 2 + 2);
+    assert(tinylfu_sketch_estimate(s, 42) <= 4);
+
+    tinylfu_sketch_free(s);
+    return TEST_PASS;
+}
+
+static enum test_return test_ghost_list(void) {
+    ghost_list *g = ghost_list_new(100);
+    assert(g != NULL);
+    assert(ghost_list_size(g) == 128);
+
+    ghost_entry e = { .time = 10, .clsid = 3, .has_score = true, .score = 0.5f };
+    ghost_entry out;
+    assert(!ghost_list_take(g, 42, &out));
+    ghost_list_add(g, 42, &e);
+    assert(ghost_list_take(g, 42, &out));
+    assert(out.time == 10 && out.clsid == 3 && out.has_score && out.score == 0.5f);
+    /* A hit forgets the entry */
+    assert(!ghost_list_take(g, 42, &out));
+
+    /* A later eviction in the same slot replaces the older one */
+    uint32_t other = 42 ^ (128 << 16);
+    ghost_list_add(g, 42, &e);
+    e.time = 20;
+    ghost_list_add(g, other, &e);
+    assert(!ghost_list_take(g, 42, &out));
+    assert(ghost_list_take(g, other, &out) && out.time == 20);
+
+    ghost_list_free(g);
+    return TEST_PASS;
+}
+
 struct testcase testcases[] = {
     { "cache_create", cache_create_test },
     { "cache_reuse", cache_reuse_test },
@@ -2271,10 +2425,14 @@ struct testcase testcases[] = {
     { "strtoll", test_safe_strtoll },
     { "strtoul", test_safe_strtoul },
     { "strtoull", test_safe_strtoull },
+    { "mc_rng", test_mc_rng },
     { "issue_44", test_issue_44 },
     { "vperror", test_vperror },
     { "issue_101", test_issue_101 },
     { "crc32c", test_crc32c },
+    { "emb_kernels", test_emb_kernels },
+    { "tinylfu_sketch", test_tinylfu_sketch },
+    { "ghost_list", test_ghost_list },
     /* The following tests all run towards the same server */
     { "start_server", start_memcached_server },
     { "issue_92", test_issue_92 },
@@ -238,6 +238,11 @@ void stop_threads(void) {
         if (settings.verbose > 0)
             fprintf(stderr, "stopped maintainer\n");
     }
+    if (evict_policy->stop) {
+        evict_policy->stop();
+        if (settings.verbose > 0)
+            fprintf(stderr, "stopped eviction policy threads\n");
+    }
     if (settings.slab_reassign) {
         stop_slab_maintenance_thread(settings.slab_rebal);
         if (settings.verbose > 0)
@@ -265,6 +270,9 @@ void stop_threads(void) {
         fprintf(stderr, "all background threads stopped\n");
 
     // At this point, every background thread must be stopped.
+    // Chunks the workers cached go back to the slabs, so a restart sees
+    // them as free.
+    slabs_cache_drain_all();
 }
 
 /*
@@ -512,6 +520,14 @@ static void *worker_libevent(void *arg) {
      */
     me->l = logger_create();
     me->lru_bump_buf = item_lru_bump_buf_create();
+    slabs_cache_thread_init();
+    slabs_numa_thread_init(me - threads);
+    if (evict_policy->thread_init) {
+        me->evict_thread = evict_policy->thread_init();
+        if (me->evict_thread == NULL) {
+            abort();
+        }
+    }
     if (me->l == NULL || me->lru_bump_buf == NULL) {
         abort();
     }
@@ -876,24 +892,71 @@ item *item_alloc(const char *key, size_t nkey, client_flags_t flags, rel_time_t
  * lazy-expiring as needed.
  */
 item *item_get(const char *key, const size_t nkey, LIBEVENT_THREAD *t, const bool do_update) {
+    return item_get_hv(key, nkey, hash(key, nkey), t, do_update);
+}
+
+/* item_get() for a key whose hash the caller already has. */
+item *item_get_hv(const char *key, const size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, const bool do_update) {
     item *it;
-    uint32_t hv;
-    hv = hash(key, nkey);
     item_lock(hv);
     it = do_item_get(key, nkey, hv, t, do_update);
     item_unlock(hv);
     return it;
 }
 
+/*
+ * Hash n keys into hvs and prefetch every key's item lock and bucket, so
+ * their cache misses overlap instead of being taken one key after another.
+ * Takes no locks: nothing prefetched is read yet.
+ */
+void item_prefetch_batch(const char **keys, const size_t *nkeys, uint32_t *hvs, const int n) {
+    for (int i = 0; i < n; i++) {
+        hvs[i] = hash(keys[i], nkeys[i]);
+        __builtin_prefetch(&item_locks[hvs[i] & hashmask(item_lock_hashpower)]);
+        assoc_prefetch(hvs[i]);
+    }
+}
+
+/*
+ * Prefetch the items each hvs[i]'s bucket points at. Run it a while after
+ * item_prefetch_batch(), once the buckets have had time to arrive. Takes no
+ * locks either: see assoc_prefetch_items().
+ */
+void item_prefetch_items(const uint32_t *hvs, const int n) {
+    for (int i = 0; i < n; i++) {
+        assoc_prefetch_items(hvs[i]);
+    }
+}
+
+/*
+ * item_get() for up to ITEM_BATCH_MAX keys at once: items[i] is keys[i]'s
+ * item or NULL. All the buckets, then all the items they point at, are
+ * prefetched before the first lookup, and each key then takes its item lock
+ * once.
+ */
+void item_get_batch(const char **keys, const size_t *nkeys, const int n, item **items, LIBEVENT_THREAD *t, const bool do_update) {
+    uint32_t hvs[ITEM_BATCH_MAX];
+    assert(n <= ITEM_BATCH_MAX);
+    item_prefetch_batch(keys, nkeys, hvs, n);
+    item_prefetch_items(hvs, n);
+    for (int i = 0; i < n; i++) {
+        item_lock(hvs[i]);
+        items[i] = do_item_get(keys[i], nkeys[i], hvs[i], t, do_update);
+        item_unlock(hvs[i]);
+    }
+}
+
 // returns an item with the item lock held.
 // lock will still be held even if return is NULL, allowing caller to replace
 // an item atomically if desired.
 item *item_get_locked(const char *key, const size_t nkey, LIBEVENT_THREAD *t, const bool do_update, uint32_t *hv) {
-    item *it;
     *hv = hash(key, nkey);
-    item_lock(*hv);
-    it = do_item_get(key, nkey, *hv, t, do_update);
-    return it;
+    return item_get_locked_hv(key, nkey, *hv, t, do_update);
+}
+
+item *item_get_locked_hv(const char *key, const size_t nkey, const uint32_t hv, LIBEVENT_THREAD *t, const bool do_update) {
+    item_lock(hv);
+    return do_item_get(key, nkey, hv, t, do_update);
 }
 
 item *item_touch(const char *key, size_t nkey, uint32_t exptime, LIBEVENT_THREAD *t) {
@@ -912,7 +975,12 @@ item *item_touch(const char *key, size_t nkey, uint32_t exptime, LIBEVENT_THREAD
  */
 void item_remove(item *item) {
     uint32_t hv;
-    hv = hash(ITEM_key(item), item->nkey);
+    hv = item->hv;
+    /* Never linked, so hv was never set. Hash the key rather than have
+     * every such item pile onto item_locks[0]. */
+    if (hv == 0 && (item->it_flags & ITEM_LINKED) == 0) {
+        hv = hash(ITEM_key(item), item->nkey);
+    }
 
     item_lock(hv);
     do_item_remove(item);
@@ -933,7 +1001,7 @@ int item_replace(item *old_it, item *new_it, const uint32_t hv, const uint64_t c
  */
 void item_unlink(item *item) {
     uint32_t hv;
-    hv = hash(ITEM_key(item), item->nkey);
+    hv = item->hv;
     item_lock(hv);
     do_item_unlink(item, hv);
     item_unlock(hv);
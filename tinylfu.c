@@ -0,0 +1,180 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Frequency sketch for TinyLFU admission. See tinylfu.h.
+ *
+ * Counters are 4 bits wide and packed 16 to a 64-bit word, so halving the
+ * whole table is a shift and a mask per word. Each row spreads the item
+ * hash with its own odd multiplier; the doorkeeper probes two bits.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include "tinylfu.h"
+
+#define TINYLFU_ROWS 4
+#define TINYLFU_MIN_WIDTH 64
+#define TINYLFU_MAX_WIDTH (1U << 24)
+/* How many additions between agings, as a multiple of the width. */
+#define TINYLFU_SAMPLE_FACTOR 10
+/* Doorkeeper bits per counter column: ~6 bits per addition between agings
+ * keeps false positives under 10% even if every key is new. */
+#define TINYLFU_DOOR_BITS 64
+/* Words aged per addition while an aging is under way: at the maximum width
+ * the whole sketch is swept within a fraction of the next sample. */
+#define TINYLFU_AGE_SLICE 64
+
+struct tinylfu_sketch {
+    uint64_t *table;    /* TINYLFU_ROWS * width counters */
+    uint64_t *door;     /* width * TINYLFU_DOOR_BITS bits */
+    uint32_t width;
+    uint32_t sample;
+    uint32_t additions;
+    uint32_t words;     /* table words, then door words */
+    uint32_t age_pos;   /* next word to age; words or more when idle */
+    uint64_t resets;
+};
+
+static const uint32_t row_seeds[TINYLFU_ROWS] = {
+    0x97cb3127, 0xb7a0c9a1, 0x4f1bbcdd, 0x2c1b3c6d
+};
+
+tinylfu_sketch *tinylfu_sketch_new(uint32_t width) {
+    uint32_t w = TINYLFU_MIN_WIDTH;
+    while (w < width && w < TINYLFU_MAX_WIDTH) {
+        w <<= 1;
+    }
+
+    tinylfu_sketch *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->width = w;
+    s->sample = w * TINYLFU_SAMPLE_FACTOR;
+    s->words = w * TINYLFU_ROWS / 16 + w * TINYLFU_DOOR_BITS / 64;
+    s->age_pos = s->words;
+    s->table = calloc(w * TINYLFU_ROWS / 16, sizeof(uint64_t));
+    s->door = calloc(w * TINYLFU_DOOR_BITS / 64, sizeof(uint64_t));
+    if (s->table == NULL || s->door == NULL) {
+        tinylfu_sketch_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void tinylfu_sketch_free(tinylfu_sketch *s) {
+    if (s == NULL) {
+        return;
+    }
+    free(s->table);
+    free(s->door);
+    free(s);
+}
+
+/* Position of hv's counter in the given row. */
+static inline uint32_t counter_pos(tinylfu_sketch *s, const uint32_t hv, int row) {
+    uint32_t h = hv * row_seeds[row];
+    h ^= h >> 16;
+    return row * s->width + (h & (s->width - 1));
+}
+
+static inline unsigned int counter_get(tinylfu_sketch *s, uint32_t pos) {
+    uint64_t word = __atomic_load_n(&s->table[pos >> 4], __ATOMIC_RELAXED);
+    return (word >> ((pos & 15) << 2)) & 0xf;
+}
+
+static inline void counter_incr(tinylfu_sketch *s, uint32_t pos) {
+    uint64_t *word = &s->table[pos >> 4];
+    int shift = (pos & 15) << 2;
+    uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    do {
+        if (((old >> shift) & 0xf) == TINYLFU_COUNTER_MAX) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(word, &old, old + (1ULL << shift),
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void door_bits(tinylfu_sketch *s, const uint32_t hv, uint32_t *b1, uint32_t *b2) {
+    uint32_t mask = s->width * TINYLFU_DOOR_BITS - 1;
+    uint32_t h = hv * 0x9e3779b1;
+    *b1 = (h ^ (h >> 16)) & mask;
+    h = (hv ^ (hv >> 13)) * 0xcc9e2d51;
+    *b2 = (h ^ (h >> 15)) & mask;
+}
+
+static inline bool door_test(tinylfu_sketch *s, uint32_t bit) {
+    return (__atomic_load_n(&s->door[bit >> 6], __ATOMIC_RELAXED) >> (bit & 63)) & 1;
+}
+
+static bool door_contains(tinylfu_sketch *s, const uint32_t hv) {
+    uint32_t b1, b2;
+    door_bits(s, hv, &b1, &b2);
+    return door_test(s, b1) && door_test(s, b2);
+}
+
+/* Returns true if hv was already in the doorkeeper. */
+static bool door_add(tinylfu_sketch *s, const uint32_t hv) {
+    uint32_t b1, b2;
+    door_bits(s, hv, &b1, &b2);
+    if (door_test(s, b1) && door_test(s, b2)) {
+        return true;
+    }
+    __atomic_fetch_or(&s->door[b1 >> 6], 1ULL << (b1 & 63), __ATOMIC_RELAXED);
+    __atomic_fetch_or(&s->door[b2 >> 6], 1ULL << (b2 & 63), __ATOMIC_RELAXED);
+    return false;
+}
+
+/* Age the next slice of words, if an aging is under way: halve the
+ * counters, then forget the doorkeeper. Spreading the sweep over many
+ * additions keeps any one request from stalling on the whole sketch.
+ * Increments racing with this may be lost. */
+static void sketch_age_slice(tinylfu_sketch *s) {
+    if (__atomic_load_n(&s->age_pos, __ATOMIC_RELAXED) >= s->words) {
+        return;
+    }
+    uint32_t i = __atomic_fetch_add(&s->age_pos, TINYLFU_AGE_SLICE, __ATOMIC_RELAXED);
+    uint32_t end = i + TINYLFU_AGE_SLICE;
+    uint32_t table_words = s->width * TINYLFU_ROWS / 16;
+    bool last = end >= s->words && i < s->words;
+    if (end > s->words) {
+        end = s->words;
+    }
+    for (; i < end && i < table_words; i++) {
+        uint64_t w = __atomic_load_n(&s->table[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&s->table[i], (w >> 1) & 0x7777777777777777ULL, __ATOMIC_RELAXED);
+    }
+    for (; i < end; i++) {
+        __atomic_store_n(&s->door[i - table_words], 0, __ATOMIC_RELAXED);
+    }
+    if (last) {
+        __atomic_fetch_add(&s->resets, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void tinylfu_sketch_add(tinylfu_sketch *s, const uint32_t hv) {
+    if (door_add(s, hv)) {
+        for (int r = 0; r < TINYLFU_ROWS; r++) {
+            counter_incr(s, counter_pos(s, hv, r));
+        }
+    }
+    /* Only the thread that lands exactly on the sample size starts aging. */
+    if (__atomic_add_fetch(&s->additions, 1, __ATOMIC_RELAXED) == s->sample) {
+        __atomic_store_n(&s->additions, s->sample / 2, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->age_pos, 0, __ATOMIC_RELAXED);
+    }
+    sketch_age_slice(s);
+}
+
+unsigned int tinylfu_sketch_estimate(tinylfu_sketch *s, const uint32_t hv) {
+    unsigned int freq = TINYLFU_COUNTER_MAX;
+    for (int r = 0; r < TINYLFU_ROWS; r++) {
+        unsigned int c = counter_get(s, counter_pos(s, hv, r));
+        if (c < freq) {
+            freq = c;
+        }
+    }
+    return freq + (door_contains(s, hv) ? 1 : 0);
+}
+
+uint64_t tinylfu_sketch_resets(tinylfu_sketch *s) {
+    return __atomic_load_n(&s->resets, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,31 @@
+#ifndef TINYLFU_H
+#define TINYLFU_H
+
+#include <stdint.h>
+
+/* Approximate access frequency of keys, for TinyLFU admission.
+ *
+ * A count-min sketch of 4-bit counters (4 rows) in front of which sits a
+ * doorkeeper bloom filter: a key's first access only sets its doorkeeper
+ * bits, so one-hit-wonders never reach the counters. After 10 * width
+ * additions every counter is halved and the doorkeeper cleared, so old
+ * popularity fades. The aging is done a slice at a time by the additions
+ * that follow. Keys are identified by their 32-bit item hash.
+ *
+ * Safe to call from any thread without locks; concurrent updates may be
+ * lost, which only makes the estimate slightly less exact.
+ */
+#define TINYLFU_COUNTER_MAX 15
+
+typedef struct tinylfu_sketch tinylfu_sketch;
+
+/* width is rounded up to a power of two. Returns NULL on allocation failure. */
+tinylfu_sketch *tinylfu_sketch_new(uint32_t width);
+void tinylfu_sketch_free(tinylfu_sketch *s);
+void tinylfu_sketch_add(tinylfu_sketch *s, const uint32_t hv);
+/* 0 if never seen, up to TINYLFU_COUNTER_MAX + 1. */
+unsigned int tinylfu_sketch_estimate(tinylfu_sketch *s, const uint32_t hv);
+/* Number of times the sketch has been aged. */
+uint64_t tinylfu_sketch_resets(tinylfu_sketch *s);
+
+#endif
@@ -276,3 +276,25 @@ void mc_timespec_add(struct timespec *ts1,
     }
 }
 
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void mc_rng_seed(mc_rng *r, uint64_t seed) {
+    // splitmix64 maps distinct inputs to distinct outputs, so at most one
+    // word is zero: never the all zero state xoshiro would be stuck in.
+    for (int i = 0; i < 4; i++) {
+        r->s[i] = splitmix64(&seed);
+    }
+}
+
+void mc_rng_fill_floats(mc_rng *r, float *out, size_t n, float lo, float hi) {
+    const float range = hi - lo;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = lo + mc_rng_float(r) * range;
+    }
+}
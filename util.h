@@ -46,3 +46,57 @@ void vperror(const char *fmt, ...)
  */
 
 void mc_timespec_add(struct timespec *ts1, struct timespec *ts2);
+
+/*
+ * Fast PRNG (xoshiro256**) for sampling and initialization, not for
+ * anything security related. The state is not locked: keep one per thread,
+ * e.g. in a per-thread struct such as emb_thread, instead of sharing one,
+ * which is what makes it cheaper than rand().
+ */
+typedef struct {
+    uint64_t s[4];
+} mc_rng;
+
+/* Seeds from a single value, expanded with splitmix64. */
+void mc_rng_seed(mc_rng *r, uint64_t seed);
+/* Fills out[0..n) with floats uniform in [lo, hi). */
+void mc_rng_fill_floats(mc_rng *r, float *out, size_t n, float lo, float hi);
+
+static inline uint64_t mc_rng_rotl(const uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t mc_rng_next(mc_rng *r) {
+    uint64_t *s = r->s;
+    const uint64_t result = mc_rng_rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+
+    s[2] ^= t;
+    s[3] = mc_rng_rotl(s[3], 45);
+
+    return result;
+}
+
+/* Uniform in [0, n) without the bias of a modulo. n must not be 0. */
+static inline uint32_t mc_rng_bounded(mc_rng *r, const uint32_t n) {
+    uint64_t m = (mc_rng_next(r) >> 32) * n;
+    uint32_t low = (uint32_t)m;
+    if (low < n) {
+        const uint32_t threshold = -n % n;
+        while (low < threshold) {
+            m = (mc_rng_next(r) >> 32) * n;
+            low = (uint32_t)m;
+        }
+    }
+    return m >> 32;
+}
+
+/* Uniform in [0, 1). */
+static inline float mc_rng_float(mc_rng *r) {
+    return (mc_rng_next(r) >> 40) * (1.0f / (1 << 24));
+}
@@ -0,0 +1 @@
+m4_define([VERSION_NUMBER], [UNKNOWN])